@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "crypto_hal.h"
+#include "crypto_backend.h"
+#include "cbor_minimal.h"
+#include "ctap2.h"
+#include "counter_store.h"
+#include "u2f.h"
+#include "user_presence.h"
+
+// crypto_hal microbenchmarks plus the protocol operations built on them,
+// run through the real u2f.c/ctap2.c handlers with the HID transport and the
+// button stubbed out below.
+//
+//   bench_crypto [--time-ms N] [--json FILE] [--baseline FILE] [--tolerance F]
+//
+// ops/s counts timed calls only (1 / mean latency).
+// --json writes one result object per line; a results file is also a valid
+// --baseline. The run fails (exit 1) when any operation listed in the
+// baseline drops below (1 - F) of its baseline ops/sec.
+//
+// "warm" operations wait, untimed, until the idle-time nonce and keypair
+// pools are full before each call, which is how a request finds the device
+// after any pause. The rest run back to back. A prep hook, if set, also
+// runs untimed before each call.
+
+#define BENCH_MAX_SAMPLES   100000
+#define BENCH_MIN_SAMPLES   20
+#define BENCH_MAX_RESULTS   32
+#define BENCH_RP_ID         "example.com"
+#define BENCH_FOREIGN_IDS   9 // allowList entries ahead of ours in the long request
+
+typedef struct {
+    const char *name;
+    bool warm;
+    int (*run)(void); // 0 on success
+    void (*prep)(void);
+} bench_t;
+
+typedef struct {
+    const char *name;
+    size_t iterations;
+    double ops_per_sec;
+    double p50_us;
+    double p99_us;
+} bench_result_t;
+
+static int64_t samples[BENCH_MAX_SAMPLES];
+
+// Fixed inputs, filled by setup()
+static uint8_t msg_1k[1024];
+static uint8_t hash[32];
+static uint8_t ecc_priv[32];
+static uint8_t ecc_pub[65];
+static uint8_t ed_seed[32];
+static uint8_t app_param[32];
+static uint8_t kh[U2F_KH_MAX_SIZE];
+static int kh_len;
+static hal_gcm_key_t *wrap_key;
+static uint8_t wrap_iv[12];
+static uint8_t wrapped[32];
+static uint8_t wrap_tag[16];
+
+static uint8_t u2f_register_apdu[5 + 64];
+static uint8_t u2f_auth_apdu[5 + 65 + U2F_KH_MAX_SIZE];
+static uint16_t u2f_auth_apdu_len;
+static uint8_t make_credential_req[256];
+static uint16_t make_credential_len;
+static uint8_t get_assertion_req[256];
+static uint8_t get_assertion_long_req[1024];
+static uint16_t get_assertion_long_len;
+static uint32_t stream_txn;
+static uint16_t get_assertion_len;
+
+// Last message the handlers sent
+static uint8_t resp[1024];
+static size_t resp_len;
+static uint8_t resp_cmd;
+
+// HID transport and user presence stand-ins
+
+void u2f_hid_init(void) {
+}
+
+void u2f_hid_set_keepalive_status(uint8_t status) {
+}
+
+void u2f_send_segments(uint32_t cid, uint8_t cmd, const u2f_hid_segment_t *segs, size_t count) {
+    resp_cmd = cmd;
+    resp_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (resp_len + segs[i].len > sizeof(resp)) break;
+        if (segs[i].len) memcpy(resp + resp_len, segs[i].data, segs[i].len);
+        resp_len += segs[i].len;
+    }
+}
+
+void u2f_send_response(uint32_t cid, uint8_t cmd, const uint8_t *data, uint16_t len) {
+    const u2f_hid_segment_t seg = {data, len};
+    u2f_send_segments(cid, cmd, &seg, 1);
+}
+
+void u2f_send_error(uint32_t cid, uint8_t error) {
+    u2f_send_response(cid, U2FHID_ERROR, &error, 1);
+}
+
+bool up_check(void) {
+    return true;
+}
+
+up_result_t up_wait(uint32_t timeout_ms) {
+    return UP_OK;
+}
+
+// Operations
+
+static int run_sha256_64(void) {
+    return hal_sha256(msg_1k, 64, hash);
+}
+
+static int run_sha256_1k(void) {
+    return hal_sha256(msg_1k, sizeof(msg_1k), hash);
+}
+
+static int run_ecc_generate_keypair(void) {
+    uint8_t priv[32], pub[65];
+    return hal_ecc_generate_keypair(priv, pub);
+}
+
+static int run_ecc_take_keypair(void) {
+    uint8_t priv[32], pub[65];
+    return hal_ecc_take_keypair(priv, pub);
+}
+
+static int run_ecc_sign(void) {
+    uint8_t sig[HAL_ECC_SIG_DER_MAX];
+    return hal_ecc_sign(ecc_priv, hash, sig) > 0 ? 0 : -1;
+}
+
+// The pool-empty path: k*G inline
+static int run_ecc_sign_inline(void) {
+    uint8_t sig[HAL_ECC_SIG_RAW_SIZE];
+    return HAL_BACKEND_TABLE.p256_sign(ecc_priv, hash, sig);
+}
+
+static int run_ed25519_sign(void) {
+    uint8_t sig[HAL_ED25519_SIG_SIZE];
+    return hal_ed25519_sign(ed_seed, msg_1k, 64 + 32, sig);
+}
+
+static int run_gcm_wrap(void) {
+    uint8_t out[32], tag[16];
+    return hal_gcm_key_encrypt(wrap_key, wrap_iv, sizeof(wrap_iv), app_param, sizeof(app_param),
+                               ecc_priv, sizeof(ecc_priv), out, tag, sizeof(tag));
+}
+
+static int run_gcm_unwrap(void) {
+    uint8_t out[32];
+    return hal_gcm_key_decrypt(wrap_key, wrap_iv, sizeof(wrap_iv), app_param, sizeof(app_param),
+                               wrapped, sizeof(wrapped), out, wrap_tag, sizeof(wrap_tag));
+}
+
+static int run_kh_create(void) {
+    uint8_t out[U2F_KH_MAX_SIZE];
+    return u2f_create_credential_id(app_param, ecc_priv, HAL_ALG_ES256, out) > 0 ? 0 : -1;
+}
+
+static int run_kh_unwrap(void) {
+    uint8_t priv[32];
+    int32_t alg;
+    return u2f_unwrap_credential_id(app_param, kh, (uint8_t)kh_len, priv, &alg);
+}
+
+static int u2f_status_ok(void) {
+    return resp_cmd == U2FHID_MSG && resp_len >= 2 &&
+           resp[resp_len - 2] == 0x90 && resp[resp_len - 1] == 0x00 ? 0 : -1;
+}
+
+static int run_u2f_register(void) {
+    u2f_process_apdu(1, u2f_register_apdu, sizeof(u2f_register_apdu));
+    return u2f_status_ok();
+}
+
+static int run_u2f_authenticate(void) {
+    u2f_process_apdu(1, u2f_auth_apdu, u2f_auth_apdu_len);
+    return u2f_status_ok();
+}
+
+static int ctap2_status_ok(void) {
+    return resp_cmd == U2FHID_CBOR && resp_len > 1 && resp[0] == CTAP2_OK ? 0 : -1;
+}
+
+static int run_get_info(void) {
+    uint8_t cmd = CTAP2_GET_INFO;
+    ctap2_handle_cbor(1, &cmd, 1);
+    return ctap2_status_ok();
+}
+
+static int run_make_credential(void) {
+    ctap2_handle_cbor(1, make_credential_req, make_credential_len);
+    return ctap2_status_ok();
+}
+
+static int run_get_assertion(void) {
+    ctap2_handle_cbor(1, get_assertion_req, get_assertion_len);
+    return ctap2_status_ok();
+}
+
+// What the worker does once a response is out: write the counter
+// reservations it queued, and erase ahead when idle
+static void prep_counter_commit(void) {
+    counter_store_commit();
+    counter_store_maintain();
+}
+
+// Long allowList, ours last: every packet but the last is fed to the
+// stream prefetch (untimed), then only what runs after the last packet is
+// timed. "_long" is the same request with nothing prefetched.
+static void prep_stream_get_assertion(void) {
+    counter_store_commit();
+    stream_txn++;
+    size_t n = U2F_HID_INIT_DATA_SIZE;
+    while (n < get_assertion_long_len) {
+        ctap2_stream_feed(stream_txn, get_assertion_long_req, n);
+        n += U2F_HID_CONT_DATA_SIZE;
+    }
+}
+
+static int run_get_assertion_long(void) {
+    ctap2_handle_cbor(1, get_assertion_long_req, get_assertion_long_len);
+    if (ctap2_status_ok() != 0) return -1;
+    // The matching credential is the last one. Status, then
+    // {1: {"id": h'<kh>'}, ...}: A3 01 A1 62 'i' 'd' 58 <len> <kh>
+    return resp_len > 9 + (size_t)kh_len && memcmp(resp + 9, kh, kh_len) == 0 ? 0 : -1;
+}
+
+static int run_get_assertion_streamed(void) {
+    ctap2_stream_feed(stream_txn, get_assertion_long_req, get_assertion_long_len);
+    int ret = run_get_assertion_long();
+    ctap2_stream_reset();
+    return ret;
+}
+
+static const bench_t benches[] = {
+    {"hal_sha256_64", false, run_sha256_64, NULL},
+    {"hal_sha256_1k", false, run_sha256_1k, NULL},
+    {"hal_ecc_generate_keypair", false, run_ecc_generate_keypair, NULL},
+    {"hal_ecc_take_keypair", true, run_ecc_take_keypair, NULL},
+    {"hal_ecc_sign", true, run_ecc_sign, NULL},
+    {"hal_ecc_sign_inline", false, run_ecc_sign_inline, NULL},
+    {"hal_ed25519_sign", false, run_ed25519_sign, NULL},
+    {"hal_gcm_key_wrap", false, run_gcm_wrap, NULL},
+    {"hal_gcm_key_unwrap", false, run_gcm_unwrap, NULL},
+    {"u2f_create_credential_id", false, run_kh_create, NULL},
+    {"u2f_unwrap_credential_id", false, run_kh_unwrap, NULL},
+    {"u2f_register", true, run_u2f_register, NULL},
+    {"u2f_authenticate", true, run_u2f_authenticate, prep_counter_commit},
+    {"ctap2_get_info", false, run_get_info, NULL},
+    {"ctap2_make_credential", true, run_make_credential, NULL},
+    {"ctap2_get_assertion", true, run_get_assertion, prep_counter_commit},
+    {"ctap2_get_assertion_long", true, run_get_assertion_long, prep_counter_commit},
+    {"ctap2_get_assertion_streamed", true, run_get_assertion_streamed, prep_stream_get_assertion},
+};
+
+static int setup(void) {
+    if (hal_crypto_init() != 0) return -1;
+    u2f_init();
+    ctap2_init();
+
+    hal_rng_generate(msg_1k, sizeof(msg_1k));
+    hal_sha256(msg_1k, sizeof(msg_1k), hash);
+    hal_sha256((const uint8_t *)BENCH_RP_ID, strlen(BENCH_RP_ID), app_param);
+    if (hal_ecc_generate_keypair(ecc_priv, ecc_pub) != 0) return -1;
+    hal_rng_generate(ed_seed, sizeof(ed_seed));
+
+    kh_len = u2f_create_credential_id(app_param, ecc_priv, HAL_ALG_ES256, kh);
+    if (kh_len <= 0) return -1;
+
+    uint8_t wrap_raw[32];
+    hal_rng_generate(wrap_raw, sizeof(wrap_raw));
+    wrap_key = hal_gcm_key_create(wrap_raw);
+    hal_rng_generate(wrap_iv, sizeof(wrap_iv));
+    if (hal_gcm_key_encrypt(wrap_key, wrap_iv, sizeof(wrap_iv), app_param, sizeof(app_param),
+                            ecc_priv, sizeof(ecc_priv), wrapped, wrap_tag, sizeof(wrap_tag)) != 0) {
+        return -1;
+    }
+
+    // U2F REGISTER / AUTHENTICATE (P1 = enforce user presence), short APDUs
+    uint8_t *a = u2f_register_apdu;
+    a[0] = 0x00; a[1] = U2F_INS_REGISTER; a[2] = 0x00; a[3] = 0x00; a[4] = 64;
+    memcpy(a + 5, hash, 32);
+    memcpy(a + 5 + 32, app_param, 32);
+
+    a = u2f_auth_apdu;
+    a[0] = 0x00; a[1] = U2F_INS_AUTHENTICATE; a[2] = 0x03; a[3] = 0x00; a[4] = (uint8_t)(65 + kh_len);
+    memcpy(a + 5, hash, 32);
+    memcpy(a + 5 + 32, app_param, 32);
+    a[5 + 64] = (uint8_t)kh_len;
+    memcpy(a + 5 + 65, kh, kh_len);
+    u2f_auth_apdu_len = (uint16_t)(5 + 65 + kh_len);
+
+    // authenticatorMakeCredential {1: clientDataHash, 2: rp, 3: user, 4: pubKeyCredParams}
+    cbor_encoder_t enc;
+    make_credential_req[0] = CTAP2_MAKE_CREDENTIAL;
+    cbor_encoder_init(&enc, make_credential_req + 1, sizeof(make_credential_req) - 1);
+    cbor_encode_map_start(&enc, 4);
+    cbor_encode_uint(&enc, 0x01);
+    cbor_encode_bytes(&enc, hash, 32);
+    cbor_encode_uint(&enc, 0x02);
+    cbor_encode_map_start(&enc, 1);
+    cbor_encode_text(&enc, "id");
+    cbor_encode_text(&enc, BENCH_RP_ID);
+    cbor_encode_uint(&enc, 0x03);
+    cbor_encode_map_start(&enc, 1);
+    cbor_encode_text(&enc, "id");
+    cbor_encode_bytes(&enc, ed_seed, 16);
+    cbor_encode_uint(&enc, 0x04);
+    cbor_encode_array_start(&enc, 1);
+    cbor_encode_map_start(&enc, 2);
+    cbor_encode_text(&enc, "alg");
+    cbor_encode_int(&enc, HAL_ALG_ES256);
+    cbor_encode_text(&enc, "type");
+    cbor_encode_text(&enc, "public-key");
+    make_credential_len = (uint16_t)(1 + enc.offset);
+
+    // authenticatorGetAssertion {1: rpId, 2: clientDataHash, 3: allowList}
+    get_assertion_req[0] = CTAP2_GET_ASSERTION;
+    cbor_encoder_init(&enc, get_assertion_req + 1, sizeof(get_assertion_req) - 1);
+    cbor_encode_map_start(&enc, 3);
+    cbor_encode_uint(&enc, 0x01);
+    cbor_encode_text(&enc, BENCH_RP_ID);
+    cbor_encode_uint(&enc, 0x02);
+    cbor_encode_bytes(&enc, hash, 32);
+    cbor_encode_uint(&enc, 0x03);
+    cbor_encode_array_start(&enc, 1);
+    cbor_encode_map_start(&enc, 2);
+    cbor_encode_text(&enc, "id");
+    cbor_encode_bytes(&enc, kh, kh_len);
+    cbor_encode_text(&enc, "type");
+    cbor_encode_text(&enc, "public-key");
+    get_assertion_len = (uint16_t)(1 + enc.offset);
+
+    // The same with BENCH_FOREIGN_IDS IDs from another device ahead of ours
+    uint8_t foreign[U2F_KH_MAX_SIZE];
+    get_assertion_long_req[0] = CTAP2_GET_ASSERTION;
+    cbor_encoder_init(&enc, get_assertion_long_req + 1, sizeof(get_assertion_long_req) - 1);
+    cbor_encode_map_start(&enc, 3);
+    cbor_encode_uint(&enc, 0x01);
+    cbor_encode_text(&enc, BENCH_RP_ID);
+    cbor_encode_uint(&enc, 0x02);
+    cbor_encode_bytes(&enc, hash, 32);
+    cbor_encode_uint(&enc, 0x03);
+    cbor_encode_array_start(&enc, BENCH_FOREIGN_IDS + 1);
+    for (int i = 0; i <= BENCH_FOREIGN_IDS; i++) {
+        memcpy(foreign, kh, kh_len);
+        if (i < BENCH_FOREIGN_IDS) hal_rng_generate(foreign + 1, kh_len - 1);
+        cbor_encode_map_start(&enc, 2);
+        cbor_encode_text(&enc, "id");
+        cbor_encode_bytes(&enc, foreign, kh_len);
+        cbor_encode_text(&enc, "type");
+        cbor_encode_text(&enc, "public-key");
+    }
+    if (enc.error) return -1;
+    get_assertion_long_len = (uint16_t)(1 + enc.offset);
+    return 0;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Until the crypto_idle task has topped both pools up (bounded, in case it stalls)
+static void wait_pools_full(void) {
+    const size_t want_nonces = HAL_ECDSA_DETERMINISTIC ? 0 : HAL_NONCE_POOL_SIZE;
+    const struct timespec pause = {0, 20000};
+    int64_t deadline = now_ns() + 1000000000;
+    size_t nonces, keypairs;
+    do {
+        hal_precompute_levels(&nonces, &keypairs);
+        if (nonces >= want_nonces && keypairs >= HAL_KEYPAIR_POOL_SIZE) return;
+        nanosleep(&pause, NULL);
+    } while (now_ns() < deadline);
+}
+
+static int cmp_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int run_bench(const bench_t *b, int64_t budget_ns, bench_result_t *out) {
+    // One untimed call first: lazy init, caches
+    if (b->warm) wait_pools_full();
+    if (b->prep) b->prep();
+    if (b->run() != 0) return -1;
+
+    size_t n = 0;
+    int64_t total = 0;
+    int64_t stop = now_ns() + budget_ns;
+    while (n < BENCH_MAX_SAMPLES && (n < BENCH_MIN_SAMPLES || now_ns() < stop)) {
+        if (b->warm) wait_pools_full();
+        if (b->prep) b->prep();
+        int64_t t0 = now_ns();
+        int ret = b->run();
+        int64_t dt = now_ns() - t0;
+        if (ret != 0) return -1;
+        samples[n++] = dt;
+        total += dt;
+    }
+
+    qsort(samples, n, sizeof(samples[0]), cmp_i64);
+    out->name = b->name;
+    out->iterations = n;
+    out->ops_per_sec = total > 0 ? (double)n * 1e9 / (double)total : 0;
+    out->p50_us = samples[n / 2] / 1e3;
+    out->p99_us = samples[n * 99 / 100] / 1e3;
+    return 0;
+}
+
+static int write_json(const char *path, const bench_result_t *results, size_t count) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "{\n  \"backend\": \"%s\",\n  \"results\": [\n", HAL_BACKEND_TABLE.name);
+    for (size_t i = 0; i < count; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"iterations\": %zu, \"ops_per_sec\": %.1f, "
+                   "\"p50_us\": %.2f, \"p99_us\": %.2f}%s\n",
+                r->name, r->iterations, r->ops_per_sec, r->p50_us, r->p99_us,
+                i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+// Reads the one-object-per-line format written above. Returns the number of
+// regressions, or -1 if the file cannot be read.
+static int check_baseline(const char *path, const bench_result_t *results, size_t count, double tolerance) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    int regressions = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        const char *p = strstr(line, "\"name\": \"");
+        const char *ops = strstr(line, "\"ops_per_sec\": ");
+        if (!p || !ops || sscanf(p + 9, "%63[^\"]", name) != 1) continue;
+        double base = strtod(ops + 15, NULL);
+
+        const bench_result_t *r = NULL;
+        for (size_t i = 0; i < count; i++) {
+            if (strcmp(results[i].name, name) == 0) r = &results[i];
+        }
+        if (!r) {
+            printf("[-] %s: in baseline but not measured\n", name);
+            regressions++;
+        } else if (r->ops_per_sec < base * (1.0 - tolerance)) {
+            printf("[-] %s: %.1f ops/s, baseline %.1f (-%.0f%%)\n",
+                   name, r->ops_per_sec, base, 100.0 * (1.0 - r->ops_per_sec / base));
+            regressions++;
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    const char *json_path = NULL;
+    const char *baseline_path = NULL;
+    double tolerance = 0.2;
+    long time_ms = 300;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--time-ms") == 0 && i + 1 < argc) {
+            time_ms = strtol(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--time-ms N] [--json FILE] [--baseline FILE] [--tolerance F]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (setup() != 0) {
+        fprintf(stderr, "setup failed\n");
+        return 2;
+    }
+
+    bench_result_t results[BENCH_MAX_RESULTS];
+    size_t count = 0;
+    printf("backend: %s\n", HAL_BACKEND_TABLE.name);
+    printf("%-30s %10s %12s %10s %10s\n", "operation", "iters", "ops/s", "p50 us", "p99 us");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bench_result_t *r = &results[count];
+        if (run_bench(&benches[i], time_ms * 1000000, r) != 0) {
+            fprintf(stderr, "%s failed\n", benches[i].name);
+            return 2;
+        }
+        printf("%-30s %10zu %12.1f %10.2f %10.2f\n", r->name, r->iterations, r->ops_per_sec, r->p50_us, r->p99_us);
+        count++;
+    }
+
+    counter_store_stats_t st;
+    counter_store_get_stats(&st);
+    printf("counter journal: %lu records (%lu on the request path), %lu sectors erased (%lu on the request path)\n",
+           (unsigned long)st.records_written, (unsigned long)st.sync_commits, (unsigned long)st.sectors_erased,
+           (unsigned long)st.sync_erases);
+
+    if (json_path && write_json(json_path, results, count) != 0) return 2;
+
+    if (baseline_path) {
+        int regressions = check_baseline(baseline_path, results, count, tolerance);
+        if (regressions < 0) return 2;
+        if (regressions > 0) {
+            printf("%d operation(s) regressed more than %.0f%% against %s\n", regressions, tolerance * 100, baseline_path);
+            return 1;
+        }
+        printf("[+] no regression beyond %.0f%% against %s\n", tolerance * 100, baseline_path);
+    }
+    return 0;
+}
@@ -0,0 +1,400 @@
+#include <string.h>
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/crypto.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rand.h>
+#include "crypto_backend.h"
+
+// Portable host backend (OpenSSL libcrypto), for Linux builds and for
+// checking the device backends against an independent implementation.
+// OpenSSL keeps its own state behind pointers, so the hal_* contexts only
+// hold a handle.
+
+typedef struct {
+    EVP_MD_CTX *md;
+} host_sha256_t;
+
+typedef struct {
+    EVP_CIPHER_CTX *cipher;
+    uint8_t key[32];
+} host_gcm_t;
+
+_Static_assert(sizeof(host_sha256_t) <= sizeof(hal_sha256_ctx_t), "hal_sha256_ctx_t too small");
+_Static_assert(sizeof(host_gcm_t) <= sizeof(hal_gcm_ctx_t), "hal_gcm_ctx_t too small");
+
+// Signing group, created once by init()
+static EC_GROUP *p256 = NULL;
+
+static int host_init(void) {
+    // crypto_hal's precompute thread keeps running until the process exits,
+    // so libcrypto must not tear itself down in an atexit handler under it
+    OPENSSL_init_crypto(OPENSSL_INIT_NO_ATEXIT, NULL);
+    if (!p256) {
+        p256 = EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
+    }
+    return p256 ? 0 : -1;
+}
+
+// OpenSSL's RAND is already a DRBG seeded from the OS
+static int host_drbg_seed(const uint8_t *pers, size_t pers_len) {
+    return RAND_status() == 1 ? 0 : -1;
+}
+
+static int host_drbg_random(uint8_t *buf, size_t len) {
+    return RAND_bytes(buf, (int)len) == 1 ? 0 : -1;
+}
+
+static int host_sha256_init(hal_sha256_ctx_t *ctx) {
+    host_sha256_t *c = (host_sha256_t *)ctx->opaque;
+    c->md = EVP_MD_CTX_new();
+    if (!c->md || EVP_DigestInit_ex(c->md, EVP_sha256(), NULL) != 1) return -1;
+    return 0;
+}
+
+static int host_sha256_update(hal_sha256_ctx_t *ctx, const uint8_t *data, size_t len) {
+    host_sha256_t *c = (host_sha256_t *)ctx->opaque;
+    return EVP_DigestUpdate(c->md, data, len) == 1 ? 0 : -1;
+}
+
+static int host_sha256_final(hal_sha256_ctx_t *ctx, uint8_t output[32]) {
+    host_sha256_t *c = (host_sha256_t *)ctx->opaque;
+    int ret = EVP_DigestFinal_ex(c->md, output, NULL) == 1 ? 0 : -1;
+    EVP_MD_CTX_free(c->md);
+    c->md = NULL;
+    return ret;
+}
+
+static void host_sha256_clone(hal_sha256_ctx_t *dst, const hal_sha256_ctx_t *src) {
+    host_sha256_t *d = (host_sha256_t *)dst->opaque;
+    const host_sha256_t *s = (const host_sha256_t *)src->opaque;
+    d->md = EVP_MD_CTX_new();
+    EVP_MD_CTX_copy_ex(d->md, s->md);
+}
+
+static int host_gcm_setkey(hal_gcm_ctx_t *ctx, const uint8_t *key) {
+    host_gcm_t *c = (host_gcm_t *)ctx->opaque;
+    c->cipher = EVP_CIPHER_CTX_new();
+    if (!c->cipher) return -1;
+    memcpy(c->key, key, sizeof(c->key));
+    return 0;
+}
+
+static int host_gcm_encrypt(hal_gcm_ctx_t *ctx, const uint8_t *iv, size_t iv_len,
+                            const uint8_t *aad, size_t aad_len,
+                            const uint8_t *input, size_t length,
+                            uint8_t *output, uint8_t *tag, size_t tag_len) {
+    host_gcm_t *c = (host_gcm_t *)ctx->opaque;
+    int n;
+    if (EVP_EncryptInit_ex(c->cipher, EVP_aes_256_gcm(), NULL, NULL, NULL) != 1 ||
+        EVP_CIPHER_CTX_ctrl(c->cipher, EVP_CTRL_GCM_SET_IVLEN, (int)iv_len, NULL) != 1 ||
+        EVP_EncryptInit_ex(c->cipher, NULL, NULL, c->key, iv) != 1 ||
+        (aad_len > 0 && EVP_EncryptUpdate(c->cipher, NULL, &n, aad, (int)aad_len) != 1) ||
+        (length > 0 && EVP_EncryptUpdate(c->cipher, output, &n, input, (int)length) != 1) ||
+        EVP_EncryptFinal_ex(c->cipher, output + length, &n) != 1 ||
+        EVP_CIPHER_CTX_ctrl(c->cipher, EVP_CTRL_GCM_GET_TAG, (int)tag_len, tag) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+static int host_gcm_decrypt(hal_gcm_ctx_t *ctx, const uint8_t *iv, size_t iv_len,
+                            const uint8_t *aad, size_t aad_len,
+                            const uint8_t *input, size_t length,
+                            uint8_t *output, const uint8_t *tag, size_t tag_len) {
+    host_gcm_t *c = (host_gcm_t *)ctx->opaque;
+    int n;
+    if (EVP_DecryptInit_ex(c->cipher, EVP_aes_256_gcm(), NULL, NULL, NULL) != 1 ||
+        EVP_CIPHER_CTX_ctrl(c->cipher, EVP_CTRL_GCM_SET_IVLEN, (int)iv_len, NULL) != 1 ||
+        EVP_DecryptInit_ex(c->cipher, NULL, NULL, c->key, iv) != 1 ||
+        (aad_len > 0 && EVP_DecryptUpdate(c->cipher, NULL, &n, aad, (int)aad_len) != 1) ||
+        (length > 0 && EVP_DecryptUpdate(c->cipher, output, &n, input, (int)length) != 1) ||
+        EVP_CIPHER_CTX_ctrl(c->cipher, EVP_CTRL_GCM_SET_TAG, (int)tag_len, (void *)tag) != 1) {
+        return -1;
+    }
+    if (EVP_DecryptFinal_ex(c->cipher, output + length, &n) != 1) {
+        memset(output, 0, length); // Same contract as mbedTLS: no plaintext on failure
+        return HAL_BACKEND_ERR_AUTH;
+    }
+    return 0;
+}
+
+static void host_gcm_free(hal_gcm_ctx_t *ctx) {
+    host_gcm_t *c = (host_gcm_t *)ctx->opaque;
+    EVP_CIPHER_CTX_free(c->cipher);
+    c->cipher = NULL;
+    memset(c->key, 0, sizeof(c->key));
+}
+
+static int host_cbc_crypt(int enc, const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length,
+                          uint8_t *output) {
+    int ret = -1;
+    int n;
+    EVP_CIPHER_CTX *c = EVP_CIPHER_CTX_new();
+    if (c && EVP_CipherInit_ex(c, EVP_aes_256_cbc(), NULL, key, iv, enc) == 1 &&
+        EVP_CIPHER_CTX_set_padding(c, 0) == 1 &&
+        EVP_CipherUpdate(c, output, &n, input, (int)length) == 1 &&
+        EVP_CipherFinal_ex(c, output + n, &n) == 1) {
+        ret = 0;
+    }
+    EVP_CIPHER_CTX_free(c);
+    return ret;
+}
+
+static int host_cbc_encrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length,
+                            uint8_t *output) {
+    return host_cbc_crypt(1, key, iv, input, length, output);
+}
+
+static int host_cbc_decrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length,
+                            uint8_t *output) {
+    return host_cbc_crypt(0, key, iv, input, length, output);
+}
+
+// EC_KEY is deprecated in OpenSSL 3 but is still the shortest route to raw
+// scalars and r||s; the firmware never links this file.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+static int host_p256_public_key(const uint8_t *private_key, uint8_t *public_key) {
+    int ret = -1;
+    EC_GROUP *grp = EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
+    EC_POINT *q = grp ? EC_POINT_new(grp) : NULL;
+    BIGNUM *d = BN_bin2bn(private_key, 32, NULL);
+    if (q && d && EC_POINT_mul(grp, q, d, NULL, NULL, NULL) == 1 &&
+        EC_POINT_point2oct(grp, q, POINT_CONVERSION_UNCOMPRESSED, public_key, 65, NULL) == 65) {
+        ret = 0;
+    }
+    BN_clear_free(d);
+    EC_POINT_free(q);
+    EC_GROUP_free(grp);
+    return ret;
+}
+
+static int host_p256_verify(const uint8_t *public_key, const uint8_t *hash, const uint8_t *sig_rs) {
+    int ret = -1;
+    EC_KEY *key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    EC_POINT *q = key ? EC_POINT_new(EC_KEY_get0_group(key)) : NULL;
+    ECDSA_SIG *sig = ECDSA_SIG_new();
+    BIGNUM *r = BN_bin2bn(sig_rs, 32, NULL);
+    BIGNUM *s = BN_bin2bn(sig_rs + 32, 32, NULL);
+    if (q && sig && r && s &&
+        EC_POINT_oct2point(EC_KEY_get0_group(key), q, public_key, 65, NULL) == 1 &&
+        EC_KEY_set_public_key(key, q) == 1 &&
+        ECDSA_SIG_set0(sig, r, s) == 1) {
+        r = s = NULL; // Owned by sig now
+        ret = ECDSA_do_verify(hash, 32, sig, key) == 1 ? 0 : -1;
+    }
+    BN_free(r);
+    BN_free(s);
+    ECDSA_SIG_free(sig);
+    EC_POINT_free(q);
+    EC_KEY_free(key);
+    return ret;
+}
+
+// EC_POINT_oct2point() rejects points that are not on the curve
+static int host_p256_ecdh(const uint8_t *private_key, const uint8_t *peer_public_key, uint8_t *shared_x) {
+    int ret = -1;
+    EC_POINT *q = EC_POINT_new(p256);
+    EC_POINT *z = EC_POINT_new(p256);
+    BIGNUM *d = BN_bin2bn(private_key, 32, NULL);
+    BIGNUM *x = BN_new();
+    if (q && z && d && x &&
+        EC_POINT_oct2point(p256, q, peer_public_key, 65, NULL) == 1 &&
+        EC_POINT_mul(p256, z, NULL, q, d, NULL) == 1 &&
+        !EC_POINT_is_at_infinity(p256, z) &&
+        EC_POINT_get_affine_coordinates(p256, z, x, NULL, NULL) == 1 &&
+        BN_bn2binpad(x, shared_x, 32) == 32) {
+        ret = 0;
+    }
+    BN_clear_free(x);
+    BN_clear_free(d);
+    EC_POINT_clear_free(z);
+    EC_POINT_free(q);
+    return ret;
+}
+
+#pragma GCC diagnostic pop
+
+// Uniform scalar in [1, n-1] by rejection sampling on hal_rng_generate(),
+// like mbedtls_ecp_gen_privkey()
+static int rand_scalar(const BIGNUM *n, BIGNUM *k) {
+    uint8_t buf[32];
+    for (int tries = 0; tries < 32; tries++) {
+        if (hal_rng_generate(buf, sizeof(buf)) != 0) break;
+        if (!BN_bin2bn(buf, sizeof(buf), k)) break;
+        if (!BN_is_zero(k) && BN_cmp(k, n) < 0) {
+            OPENSSL_cleanse(buf, sizeof(buf));
+            return 0;
+        }
+    }
+    OPENSSL_cleanse(buf, sizeof(buf));
+    return -1;
+}
+
+static int host_p256_check_key(const uint8_t *private_key) {
+    BIGNUM *d = BN_bin2bn(private_key, 32, NULL);
+    int ret = (d && !BN_is_zero(d) && BN_cmp(d, EC_GROUP_get0_order(p256)) < 0) ? 0 : -1;
+    BN_clear_free(d);
+    return ret;
+}
+
+static int host_p256_keygen(uint8_t *private_key, uint8_t *public_key) {
+    int ret = -1;
+    BIGNUM *d = BN_secure_new();
+    EC_POINT *q = EC_POINT_new(p256);
+    if (d && q && rand_scalar(EC_GROUP_get0_order(p256), d) == 0 &&
+        BN_bn2binpad(d, private_key, 32) == 32 &&
+        EC_POINT_mul(p256, q, d, NULL, NULL, NULL) == 1 &&
+        EC_POINT_point2oct(p256, q, POINT_CONVERSION_UNCOMPRESSED, public_key, 65, NULL) == 65) {
+        ret = 0;
+    }
+    EC_POINT_free(q);
+    BN_clear_free(d);
+    return ret;
+}
+
+static int host_p256_nonce(uint8_t *ktinv_out, uint8_t *t_out, uint8_t *r_out) {
+    int ret = -1;
+    const BIGNUM *n = EC_GROUP_get0_order(p256);
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *k = BN_secure_new();
+    BIGNUM *t = BN_secure_new();
+    BIGNUM *ktinv = BN_secure_new();
+    BIGNUM *x = BN_new();
+    BIGNUM *r = BN_new();
+    EC_POINT *R = EC_POINT_new(p256);
+    if (!ctx || !k || !t || !ktinv || !x || !r || !R) goto exit;
+
+    do {
+        if (rand_scalar(n, k) != 0 ||
+            EC_POINT_mul(p256, R, k, NULL, NULL, ctx) != 1 ||
+            EC_POINT_get_affine_coordinates(p256, R, x, NULL, ctx) != 1 ||
+            BN_nnmod(r, x, n, ctx) != 1) {
+            goto exit;
+        }
+    } while (BN_is_zero(r));
+
+    BN_set_flags(k, BN_FLG_CONSTTIME);
+    if (rand_scalar(n, t) != 0 ||
+        BN_mod_mul(k, k, t, n, ctx) != 1 ||
+        !BN_mod_inverse(ktinv, k, n, ctx) ||
+        BN_bn2binpad(ktinv, ktinv_out, 32) != 32 ||
+        BN_bn2binpad(t, t_out, 32) != 32 ||
+        BN_bn2binpad(r, r_out, 32) != 32) {
+        goto exit;
+    }
+    ret = 0;
+
+exit:
+    EC_POINT_free(R);
+    BN_free(r);
+    BN_free(x);
+    BN_clear_free(ktinv);
+    BN_clear_free(t);
+    BN_clear_free(k);
+    BN_CTX_free(ctx);
+    return ret;
+}
+
+// s = (e*t + r*(d*t)) * (k*t)^-1 = k^-1 * (e + r*d) mod n
+static int host_p256_sign_nonce(const uint8_t *private_key, const uint8_t *hash,
+                                const uint8_t *ktinv_bin, const uint8_t *t_bin, const uint8_t *r_bin,
+                                uint8_t *sig_rs) {
+    int ret = -1;
+    const BIGNUM *n = EC_GROUP_get0_order(p256);
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *d = BN_bin2bn(private_key, 32, BN_secure_new());
+    BIGNUM *ktinv = BN_bin2bn(ktinv_bin, 32, BN_secure_new());
+    BIGNUM *t = BN_bin2bn(t_bin, 32, BN_secure_new());
+    BIGNUM *e = BN_bin2bn(hash, 32, NULL);
+    BIGNUM *r = BN_bin2bn(r_bin, 32, NULL);
+    BIGNUM *s = BN_secure_new();
+    if (ctx && d && ktinv && t && e && r && s &&
+        BN_mod_mul(d, d, t, n, ctx) == 1 &&
+        BN_mod_mul(e, e, t, n, ctx) == 1 &&
+        BN_mod_mul(s, r, d, n, ctx) == 1 &&
+        BN_mod_add(s, s, e, n, ctx) == 1 &&
+        BN_mod_mul(s, s, ktinv, n, ctx) == 1 &&
+        !BN_is_zero(s) && // Caller retries with a fresh nonce
+        BN_bn2binpad(r, sig_rs, 32) == 32 &&
+        BN_bn2binpad(s, sig_rs + 32, 32) == 32) {
+        ret = 0;
+    }
+    BN_clear_free(s);
+    BN_free(r);
+    BN_clear_free(e);
+    BN_clear_free(t);
+    BN_clear_free(ktinv);
+    BN_clear_free(d);
+    BN_CTX_free(ctx);
+    return ret;
+}
+
+// Random-nonce ECDSA only: HAL_ECDSA_DETERMINISTIC (RFC 6979) is not
+// implemented by this backend
+static int host_p256_sign(const uint8_t *private_key, const uint8_t *hash, uint8_t *sig_rs) {
+    uint8_t ktinv[32], t[32], r[32];
+    int ret = -1;
+    for (int tries = 0; tries < 4 && ret != 0; tries++) {
+        ret = host_p256_nonce(ktinv, t, r);
+        if (ret == 0) {
+            ret = host_p256_sign_nonce(private_key, hash, ktinv, t, r, sig_rs);
+        }
+    }
+    OPENSSL_cleanse(ktinv, sizeof(ktinv));
+    OPENSSL_cleanse(t, sizeof(t));
+    return ret;
+}
+
+static int host_ed25519_public_key(const uint8_t *seed, uint8_t *public_key) {
+    size_t len = 32;
+    EVP_PKEY *pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, seed, 32);
+    int ret = (pkey && EVP_PKEY_get_raw_public_key(pkey, public_key, &len) == 1) ? 0 : -1;
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+static int host_ed25519_sign(const uint8_t *seed, const uint8_t *msg, size_t msg_len, uint8_t *signature) {
+    size_t len = 64;
+    int ret = -1;
+    EVP_PKEY *pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, seed, 32);
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (pkey && md && EVP_DigestSignInit(md, NULL, NULL, NULL, pkey) == 1 &&
+        EVP_DigestSign(md, signature, &len, msg, msg_len) == 1) {
+        ret = 0;
+    }
+    EVP_MD_CTX_free(md);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+const hal_backend_t hal_backend_host = {
+    .name = "host",
+    .init = host_init,
+    .drbg_seed = host_drbg_seed,
+    .drbg_random = host_drbg_random,
+    .sha256_init = host_sha256_init,
+    .sha256_update = host_sha256_update,
+    .sha256_final = host_sha256_final,
+    .sha256_clone = host_sha256_clone,
+    .gcm_setkey = host_gcm_setkey,
+    .gcm_encrypt = host_gcm_encrypt,
+    .gcm_decrypt = host_gcm_decrypt,
+    .gcm_free = host_gcm_free,
+    .cbc_encrypt = host_cbc_encrypt,
+    .cbc_decrypt = host_cbc_decrypt,
+    .p256_public_key = host_p256_public_key,
+    .p256_verify = host_p256_verify,
+    .p256_ecdh = host_p256_ecdh,
+    .p256_keygen = host_p256_keygen,
+    .p256_check_key = host_p256_check_key,
+    .p256_sign = host_p256_sign,
+    .p256_nonce = host_p256_nonce,
+    .p256_sign_nonce = host_p256_sign_nonce,
+    .ed25519_public_key = host_ed25519_public_key,
+    .ed25519_sign = host_ed25519_sign,
+};
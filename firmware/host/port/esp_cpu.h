@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+// CLOCK_MONOTONIC nanoseconds, truncated: only differences are meaningful
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+
+// getrandom(2) in place of the hardware RNG
+void esp_fill_random(void *buf, size_t len);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// CLOCK_MONOTONIC, microseconds
+int64_t esp_timer_get_time(void);
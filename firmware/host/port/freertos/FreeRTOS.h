@@ -0,0 +1,16 @@
+#pragma once
+
+// Host stand-in for the FreeRTOS subset the firmware uses (see port.c).
+// Tasks are pthreads and one tick is one millisecond.
+#include <stdint.h>
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 0
+#define pdTRUE                  1
+#define pdPASS                  pdTRUE
+#define portMAX_DELAY           ((TickType_t)0xFFFFFFFFu)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+#define tskIDLE_PRIORITY        0
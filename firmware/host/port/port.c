@@ -0,0 +1,366 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+
+// Linux implementations of the ESP-IDF/FreeRTOS calls made by the portable
+// firmware sources, just enough to run them in firmware/host.
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t esp_timer_get_time(void) {
+    return now_ns() / 1000;
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void) {
+    return (esp_cpu_cycle_count_t)now_ns();
+}
+
+void esp_fill_random(void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = getrandom(p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            abort(); // No entropy, nothing sensible to return
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        default: return "ESP_FAIL";
+    }
+}
+
+// Mutexes
+
+struct host_mutex {
+    pthread_mutex_t m;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t sem = calloc(1, sizeof(*sem));
+    if (sem) pthread_mutex_init(&sem->m, NULL);
+    return sem;
+}
+
+static void deadline_after(struct timespec *ts, TickType_t ticks) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ticks / 1000;
+    ts->tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return pthread_mutex_lock(&sem->m) == 0 ? pdTRUE : pdFALSE;
+    }
+    struct timespec ts;
+    deadline_after(&ts, ticks);
+    return pthread_mutex_timedlock(&sem->m, &ts) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    return pthread_mutex_unlock(&sem->m) == 0 ? pdTRUE : pdFALSE;
+}
+
+// Tasks and direct-to-task notifications
+
+struct host_task {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify_count;
+    TaskFunction_t fn;
+    void *arg;
+};
+
+static __thread struct host_task *current_task = NULL;
+
+static void *task_trampoline(void *p) {
+    current_task = p;
+    current_task->fn(current_task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    struct host_task *t = calloc(1, sizeof(*t));
+    if (!t) return pdFALSE;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    t->fn = fn;
+    t->arg = arg;
+    if (handle) *handle = t;
+    if (pthread_create(&t->thread, NULL, task_trampoline, t) != 0) {
+        if (handle) *handle = NULL;
+        free(t);
+        return pdFALSE;
+    }
+    pthread_detach(t->thread);
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (long)(ticks % 1000) * 1000000,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    if (!task) return pdFALSE;
+    pthread_mutex_lock(&task->lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+    struct host_task *t = current_task;
+    if (!t) return 0; // Not a task created by xTaskCreate()
+
+    struct timespec ts;
+    if (ticks != portMAX_DELAY) deadline_after(&ts, ticks);
+
+    pthread_mutex_lock(&t->lock);
+    while (t->notify_count == 0) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        } else if (pthread_cond_timedwait(&t->cond, &t->lock, &ts) != 0) {
+            break;
+        }
+    }
+    uint32_t count = t->notify_count;
+    if (count > 0) {
+        t->notify_count = clear_on_exit ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return count;
+}
+
+// NVS
+
+#define HOST_NVS_MAX_ENTRIES    16
+#define HOST_NVS_MAX_VALUE      64
+
+typedef struct {
+    char key[16]; // NVS_KEY_NAME_MAX_SIZE
+    size_t len;
+    uint8_t value[HOST_NVS_MAX_VALUE];
+} nvs_entry_t;
+
+static nvs_entry_t nvs_entries[HOST_NVS_MAX_ENTRIES];
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static nvs_entry_t *nvs_find(const char *key, bool create) {
+    nvs_entry_t *free_entry = NULL;
+    for (int i = 0; i < HOST_NVS_MAX_ENTRIES; i++) {
+        nvs_entry_t *e = &nvs_entries[i];
+        if (e->key[0] == 0) {
+            if (!free_entry) free_entry = e;
+        } else if (strcmp(e->key, key) == 0) {
+            return e;
+        }
+    }
+    if (create && free_entry && strlen(key) < sizeof(free_entry->key)) {
+        strcpy(free_entry->key, key);
+        return free_entry;
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle) {
+    *handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out, size_t *len) {
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *e = nvs_find(key, false);
+    if (e) {
+        if (out && *len < e->len) {
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            if (out) memcpy(out, e->value, e->len);
+            *len = e->len;
+            err = ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t len) {
+    if (len > HOST_NVS_MAX_VALUE) return ESP_ERR_INVALID_SIZE;
+    esp_err_t err = ESP_ERR_NO_MEM;
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *e = nvs_find(key, true);
+    if (e) {
+        memcpy(e->value, value, len);
+        e->len = len;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out) {
+    size_t len = sizeof(*out);
+    return nvs_get_blob(handle, key, out, &len);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+// Data partitions: one RAM image holding them all, laid out as in
+// partitions.csv. With OPENFIDO_FLASH_FILE set it is loaded from that file
+// and every write and erase goes through to it.
+
+#define HOST_FLASH_SECTOR       4096
+
+static const esp_partition_t host_partitions[] = {
+    {ESP_PARTITION_TYPE_DATA, 0x40, 0x00000, 0x10000, HOST_FLASH_SECTOR, "fido_creds"},
+    {ESP_PARTITION_TYPE_DATA, 0x41, 0x10000, 0x04000, HOST_FLASH_SECTOR, "fido_ctr"},
+};
+
+#define HOST_FLASH_SIZE         0x14000
+
+static uint8_t host_flash[HOST_FLASH_SIZE];
+static int host_flash_fd = -1;
+static bool host_flash_loaded = false;
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void flash_load(void) {
+    if (host_flash_loaded) return;
+    host_flash_loaded = true;
+    memset(host_flash, 0xFF, sizeof(host_flash));
+
+    const char *path = getenv("OPENFIDO_FLASH_FILE");
+    if (!path || !*path) return;
+    host_flash_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (host_flash_fd < 0) return;
+    ssize_t n = pread(host_flash_fd, host_flash, sizeof(host_flash), 0);
+    if (n < (ssize_t)sizeof(host_flash)) {
+        // New or short file: the rest is erased
+        size_t have = n > 0 ? (size_t)n : 0;
+        memset(host_flash + have, 0xFF, sizeof(host_flash) - have);
+        if (pwrite(host_flash_fd, host_flash, sizeof(host_flash), 0) != (ssize_t)sizeof(host_flash)) {
+            close(host_flash_fd);
+            host_flash_fd = -1;
+        }
+    }
+}
+
+static esp_err_t flash_sync(size_t addr, size_t size) {
+    if (host_flash_fd < 0) return ESP_OK;
+    return pwrite(host_flash_fd, host_flash + addr, size, (off_t)addr) == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+static bool flash_range_ok(const esp_partition_t *part, size_t offset, size_t size) {
+    return part && offset <= part->size && size <= part->size - offset;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    for (size_t i = 0; i < sizeof(host_partitions) / sizeof(host_partitions[0]); i++) {
+        const esp_partition_t *p = &host_partitions[i];
+        if (type != ESP_PARTITION_TYPE_ANY && p->type != type) continue;
+        if (subtype != ESP_PARTITION_SUBTYPE_ANY && p->subtype != subtype) continue;
+        if (label && strcmp(p->label, label) != 0) continue;
+        return p;
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset, void *dst, size_t size) {
+    if (!flash_range_ok(part, offset, size)) return ESP_ERR_INVALID_SIZE;
+    pthread_mutex_lock(&flash_lock);
+    flash_load();
+    memcpy(dst, host_flash + part->address + offset, size);
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t offset, const void *src, size_t size) {
+    if (!flash_range_ok(part, offset, size)) return ESP_ERR_INVALID_SIZE;
+    pthread_mutex_lock(&flash_lock);
+    flash_load();
+    const uint8_t *s = src;
+    uint8_t *d = host_flash + part->address + offset;
+    for (size_t i = 0; i < size; i++) {
+        d[i] &= s[i]; // Programming only clears bits
+    }
+    esp_err_t err = flash_sync(part->address + offset, size);
+    pthread_mutex_unlock(&flash_lock);
+    return err;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t size) {
+    if (!flash_range_ok(part, offset, size)) return ESP_ERR_INVALID_SIZE;
+    if (offset % part->erase_size != 0 || size % part->erase_size != 0) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&flash_lock);
+    flash_load();
+    memset(host_flash + part->address + offset, 0xFF, size);
+    esp_err_t err = flash_sync(part->address + offset, size);
+    pthread_mutex_unlock(&flash_lock);
+    return err;
+}
+
+// Same convention as the ROM routine: zlib's CRC-32
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <string.h>
+#include "cbor_minimal.h"
+
+// Decoder and map index edge cases: wide heads, malformed input, nesting
+// limits and key order. Encoder: shortest heads, overflow latching and the
+// NULL-buffer sizing pass. Schema decoding: typed fields, missing/extra
+// keys, duplicate and non-CTAP2 keys, and type and length errors.
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("[-] %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void test_wide_heads(void) {
+    cbor_decoder_t dec;
+    uint64_t u;
+    int64_t i;
+
+    static const uint8_t u32[] = {0x1A, 0x12, 0x34, 0x56, 0x78};
+    cbor_decoder_init(&dec, u32, sizeof(u32));
+    CHECK(cbor_decode_uint(&dec, &u) && u == 0x12345678 && dec.offset == 5);
+
+    static const uint8_t u64[] = {0x1B, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+    cbor_decoder_init(&dec, u64, sizeof(u64));
+    CHECK(cbor_decode_uint(&dec, &u) && u == 0x0102030405060708ULL);
+
+    static const uint8_t n64[] = {0x3B, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    cbor_decoder_init(&dec, n64, sizeof(n64));
+    CHECK(cbor_decode_int(&dec, &i) && i == INT64_MIN);
+
+    // 32-bit byte string length
+    static const uint8_t b32[] = {0x5A, 0x00, 0x00, 0x00, 0x02, 0xAA, 0xBB};
+    const uint8_t *data;
+    size_t len;
+    cbor_decoder_init(&dec, b32, sizeof(b32));
+    CHECK(cbor_decode_bytes(&dec, &data, &len) && len == 2 && data == b32 + 5);
+
+    // Truncated argument and overlong string: nothing consumed
+    cbor_decoder_init(&dec, u64, 5);
+    CHECK(!cbor_decode_uint(&dec, &u) && dec.offset == 0);
+    cbor_decoder_init(&dec, b32, 6);
+    CHECK(!cbor_decode_bytes(&dec, &data, &len) && dec.offset == 0);
+
+    // Indefinite length is not supported
+    static const uint8_t indef[] = {0x9F, 0x01, 0xFF};
+    cbor_decoder_init(&dec, indef, sizeof(indef));
+    CHECK(!cbor_skip(&dec) && dec.offset == 0);
+
+    // Array count larger than the remaining bytes
+    static const uint8_t big_array[] = {0x9A, 0x10, 0x00, 0x00, 0x00, 0x01};
+    size_t count;
+    cbor_decoder_init(&dec, big_array, sizeof(big_array));
+    CHECK(!cbor_decode_array_header(&dec, &count) && dec.offset == 0);
+}
+
+static void test_depth_limit(void) {
+    uint8_t nested[CBOR_MAX_DEPTH + 3];
+    cbor_decoder_t dec;
+
+    // CBOR_MAX_DEPTH arrays around an integer: accepted
+    memset(nested, 0x81, CBOR_MAX_DEPTH);
+    nested[CBOR_MAX_DEPTH] = 0x00;
+    cbor_decoder_init(&dec, nested, CBOR_MAX_DEPTH + 1);
+    CHECK(cbor_skip(&dec) && dec.offset == CBOR_MAX_DEPTH + 1);
+
+    // One more level: rejected
+    memset(nested, 0x81, CBOR_MAX_DEPTH + 1);
+    nested[CBOR_MAX_DEPTH + 1] = 0x00;
+    cbor_decoder_init(&dec, nested, CBOR_MAX_DEPTH + 2);
+    CHECK(!cbor_skip(&dec) && dec.offset == 0);
+}
+
+static void test_index(void) {
+    cbor_decoder_t dec;
+    cbor_map_index_t idx;
+
+    // {3: [{"id": h'0102', "type": "public-key", "transports": ["usb"]}], 1: "a.b", 2: h'00'}
+    static const uint8_t req[] = {
+        0xA3,
+        0x03, 0x81, 0xA3,
+        0x62, 'i', 'd', 0x42, 0x01, 0x02,
+        0x64, 't', 'y', 'p', 'e', 0x6A, 'p', 'u', 'b', 'l', 'i', 'c', '-', 'k', 'e', 'y',
+        0x6A, 't', 'r', 'a', 'n', 's', 'p', 'o', 'r', 't', 's', 0x81, 0x63, 'u', 's', 'b',
+        0x01, 0x63, 'a', '.', 'b',
+        0x02, 0x41, 0x00,
+    };
+    cbor_decoder_init(&dec, req, sizeof(req));
+    CHECK(cbor_index_map(&dec, &idx) && idx.count == 3 && dec.offset == sizeof(req));
+
+    const cbor_map_entry_t *rp = cbor_index_find(&idx, 1);
+    CHECK(rp && rp->type == CBOR_TEXT && rp->len == 4);
+    if (rp) {
+        cbor_decoder_t v;
+        const char *text;
+        size_t len;
+        cbor_index_value(&idx, rp, &v);
+        CHECK(cbor_decode_text(&v, &text, &len) && len == 3 && memcmp(text, "a.b", 3) == 0);
+        CHECK(text == (const char *)req + 44); // Points into the request
+    }
+    const cbor_map_entry_t *list = cbor_index_find(&idx, 3);
+    CHECK(list && list->type == CBOR_ARRAY && list->offset == 2);
+    CHECK(cbor_index_find(&idx, 4) == NULL);
+
+    // Nested text-keyed map
+    if (list) {
+        cbor_decoder_t v;
+        size_t n;
+        cbor_map_index_t desc;
+        cbor_index_value(&idx, list, &v);
+        CHECK(cbor_decode_array_header(&v, &n) && n == 1);
+        CHECK(cbor_index_map(&v, &desc) && desc.count == 3);
+        const cbor_map_entry_t *id = cbor_index_find_text(&desc, "id", 2);
+        CHECK(id && id->type == CBOR_BYTES && id->len == 3);
+        CHECK(cbor_index_find_text(&desc, "i", 1) == NULL);
+    }
+
+    // Duplicate key
+    static const uint8_t dup[] = {0xA2, 0x01, 0x00, 0x01, 0x01};
+    cbor_decoder_init(&dec, dup, sizeof(dup));
+    CHECK(!cbor_index_map(&dec, &idx) && dec.offset == 0);
+
+    // Integer and text keys with the same "value" are distinct
+    static const uint8_t mixed[] = {0xA2, 0x00, 0x00, 0x60, 0x00};
+    cbor_decoder_init(&dec, mixed, sizeof(mixed));
+    CHECK(cbor_index_map(&dec, &idx) && idx.count == 2);
+
+    // Malformed value further in
+    static const uint8_t bad[] = {0xA2, 0x01, 0x00, 0x02, 0x43, 0x00};
+    cbor_decoder_init(&dec, bad, sizeof(bad));
+    CHECK(!cbor_index_map(&dec, &idx) && dec.offset == 0);
+
+    // Array keys are not CTAP2
+    static const uint8_t array_key[] = {0xA1, 0x80, 0x00};
+    cbor_decoder_init(&dec, array_key, sizeof(array_key));
+    CHECK(!cbor_index_map(&dec, &idx));
+
+    // One entry more than the index holds
+    uint8_t big[1 + 2 * (CBOR_INDEX_MAX_ENTRIES + 1)] = {0xA0 | (CBOR_INDEX_MAX_ENTRIES + 1)};
+    for (int i = 0; i <= CBOR_INDEX_MAX_ENTRIES; i++) big[1 + 2 * i] = (uint8_t)i;
+    cbor_decoder_init(&dec, big, sizeof(big));
+    CHECK(!cbor_index_map(&dec, &idx) && dec.offset == 0);
+}
+
+
+// Encodes one fixed item sequence; used for both the sizing and the real pass
+static void encode_sample(cbor_encoder_t *enc) {
+    static const uint8_t blob[3] = {0xAA, 0xBB, 0xCC};
+    cbor_encode_map_start(enc, 3);
+    cbor_encode_uint(enc, 1);
+    cbor_encode_bool(enc, true);
+    cbor_encode_text_lit(enc, "up");
+    cbor_encode_null(enc);
+    cbor_encode_int(enc, -300);
+    cbor_encode_bytes(enc, blob, sizeof(blob));
+}
+
+static void test_encoder(void) {
+    uint8_t buf[16];
+    cbor_encoder_t enc;
+
+    // Head widths at each boundary
+    static const struct {
+        uint64_t val;
+        size_t len;
+        uint8_t first;
+    } heads[] = {
+        {23, 1, 0x17}, {24, 2, 0x18}, {0xFF, 2, 0x18}, {0x100, 3, 0x19},
+        {0xFFFF, 3, 0x19}, {0x10000, 5, 0x1A}, {0xFFFFFFFF, 5, 0x1A},
+        {0x100000000ULL, 9, 0x1B}, {UINT64_MAX, 9, 0x1B},
+    };
+    for (size_t i = 0; i < sizeof(heads) / sizeof(heads[0]); i++) {
+        cbor_encoder_init(&enc, buf, sizeof(buf));
+        cbor_encode_uint(&enc, heads[i].val);
+        CHECK(!enc.error && enc.offset == heads[i].len && buf[0] == heads[i].first);
+
+        // Decodes back to the same value
+        cbor_decoder_t dec;
+        uint64_t u;
+        cbor_decoder_init(&dec, buf, enc.offset);
+        CHECK(cbor_decode_uint(&dec, &u) && u == heads[i].val);
+    }
+
+    cbor_encoder_init(&enc, buf, sizeof(buf));
+    cbor_encode_int(&enc, INT64_MIN);
+    static const uint8_t n64[] = {0x3B, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    CHECK(!enc.error && enc.offset == sizeof(n64) && memcmp(buf, n64, sizeof(n64)) == 0);
+
+    // Simple values
+    cbor_encoder_init(&enc, buf, sizeof(buf));
+    cbor_encode_bool(&enc, true);
+    cbor_encode_bool(&enc, false);
+    cbor_encode_null(&enc);
+    CHECK(!enc.error && enc.offset == 3 && buf[0] == 0xF5 && buf[1] == 0xF4 && buf[2] == 0xF6);
+    cbor_encode_simple(&enc, 24); // Reserved
+    CHECK(enc.error);
+
+    // Sizing pass matches the real encoding
+    cbor_encoder_t sizing;
+    cbor_encoder_init(&sizing, NULL, 0);
+    encode_sample(&sizing);
+    uint8_t out[32];
+    cbor_encoder_init(&enc, out, sizeof(out));
+    encode_sample(&enc);
+    CHECK(!sizing.error && !enc.error && sizing.offset == enc.offset && enc.offset == 14);
+
+    // Exactly enough room, then one byte short: the error latches, nothing
+    // is written past the end, and offset still reports the size needed
+    cbor_encoder_init(&enc, out, sizing.offset);
+    encode_sample(&enc);
+    CHECK(!enc.error);
+    memset(out, 0x5A, sizeof(out));
+    cbor_encoder_init(&enc, out, sizing.offset - 1);
+    encode_sample(&enc);
+    CHECK(enc.error && enc.offset == sizing.offset && out[sizing.offset - 1] == 0x5A);
+    cbor_encode_uint(&enc, 0); // Still failed
+    CHECK(enc.error);
+
+    // In-place byte string
+    cbor_encoder_init(&enc, buf, sizeof(buf));
+    uint8_t *p = cbor_encode_bytes_reserve(&enc, 4);
+    CHECK(p == buf + 1 && buf[0] == 0x44 && enc.offset == 5);
+    CHECK(cbor_encode_bytes_reserve(&enc, 20) == NULL && enc.error);
+}
+
+typedef struct {
+    cbor_item_t hash;
+    int64_t alg;
+    uint64_t count;
+    bool flag;
+    cbor_item_t list;
+    cbor_item_t name;
+} sample_req_t;
+
+static const cbor_field_t sample_schema[] = {
+    CBOR_FIELD(1, CBOR_BYTES, true, sample_req_t, hash, 4),
+    CBOR_FIELD(2, CBOR_FIELD_INT, true, sample_req_t, alg, 0),
+    CBOR_FIELD(3, CBOR_UINT, false, sample_req_t, count, 0),
+    CBOR_FIELD(4, CBOR_ARRAY, false, sample_req_t, list, 2),
+    CBOR_TEXT_FIELD("up", CBOR_FIELD_BOOL, false, sample_req_t, flag, 0),
+    CBOR_TEXT_FIELD("uv", CBOR_TEXT, false, sample_req_t, name, 0),
+};
+
+#define SAMPLE_FIELDS (sizeof(sample_schema) / sizeof(sample_schema[0]))
+
+static cbor_schema_result_t decode_sample(const uint8_t *buf, size_t len, sample_req_t *req, uint32_t *present) {
+    cbor_decoder_t dec;
+    memset(req, 0, sizeof(*req));
+    cbor_decoder_init(&dec, buf, len);
+    cbor_schema_result_t res = cbor_decode_schema(&dec, sample_schema, SAMPLE_FIELDS, req, present);
+    CHECK(dec.offset == (res == CBOR_SCHEMA_OK ? len : 0));
+    return res;
+}
+
+static void test_schema(void) {
+    sample_req_t req;
+    uint32_t present;
+
+    // {"up": true, 9: {1: 2}, 4: [1, [2]], 2: -7, 1: h'01020304'}: any key
+    // order, unknown key skipped, optional 3 and "uv" absent
+    static const uint8_t ok[] = {
+        0xA5,
+        0x62, 'u', 'p', 0xF5,
+        0x09, 0xA1, 0x01, 0x02,
+        0x04, 0x82, 0x01, 0x81, 0x02,
+        0x02, 0x26,
+        0x01, 0x44, 0x01, 0x02, 0x03, 0x04,
+    };
+    CHECK(decode_sample(ok, sizeof(ok), &req, &present) == CBOR_SCHEMA_OK);
+    CHECK(present == 0x1B);
+    CHECK(req.hash.data == ok + 18 && req.hash.len == 4);
+    CHECK(req.alg == -7 && req.flag && req.name.data == NULL);
+    CHECK(req.list.data == ok + 10 && req.list.len == 4 && req.list.count == 2);
+    if (req.list.data) {
+        cbor_decoder_t v;
+        size_t n;
+        uint64_t u;
+        cbor_item_decoder(&req.list, &v);
+        CHECK(cbor_decode_array_header(&v, &n) && n == 2 && cbor_decode_uint(&v, &u) && u == 1);
+    }
+
+    // "uv" shares a length and first byte with "up": no false match
+    static const uint8_t uv[] = {0xA3, 0x01, 0x40, 0x02, 0x00, 0x62, 'u', 'v', 0x61, 'x'};
+    CHECK(decode_sample(uv, sizeof(uv), &req, &present) == CBOR_SCHEMA_OK);
+    CHECK(present == 0x23 && !req.flag && req.name.len == 1);
+
+    static const uint8_t missing[] = {0xA1, 0x01, 0x40};
+    CHECK(decode_sample(missing, sizeof(missing), &req, NULL) == CBOR_SCHEMA_MISSING);
+
+    static const uint8_t wrong_type[] = {0xA2, 0x01, 0x60, 0x02, 0x00};
+    CHECK(decode_sample(wrong_type, sizeof(wrong_type), &req, NULL) == CBOR_SCHEMA_TYPE);
+
+    // A uint field does not take a negative integer; a bool is only true/false
+    static const uint8_t neg_count[] = {0xA3, 0x01, 0x40, 0x02, 0x00, 0x03, 0x20};
+    CHECK(decode_sample(neg_count, sizeof(neg_count), &req, NULL) == CBOR_SCHEMA_TYPE);
+    static const uint8_t null_flag[] = {0xA3, 0x01, 0x40, 0x02, 0x00, 0x62, 'u', 'p', 0xF6};
+    CHECK(decode_sample(null_flag, sizeof(null_flag), &req, NULL) == CBOR_SCHEMA_TYPE);
+
+    static const uint8_t too_long[] = {0xA2, 0x01, 0x45, 1, 2, 3, 4, 5, 0x02, 0x00};
+    CHECK(decode_sample(too_long, sizeof(too_long), &req, NULL) == CBOR_SCHEMA_LENGTH);
+    static const uint8_t long_list[] = {0xA3, 0x01, 0x40, 0x02, 0x00, 0x04, 0x83, 0x01, 0x02, 0x03};
+    CHECK(decode_sample(long_list, sizeof(long_list), &req, NULL) == CBOR_SCHEMA_LENGTH);
+
+    static const uint8_t dup[] = {0xA3, 0x01, 0x40, 0x02, 0x00, 0x01, 0x40};
+    CHECK(decode_sample(dup, sizeof(dup), &req, NULL) == CBOR_SCHEMA_MALFORMED);
+
+    // Malformed array value and malformed unknown value
+    static const uint8_t bad_list[] = {0xA3, 0x01, 0x40, 0x02, 0x00, 0x04, 0x82, 0x01};
+    CHECK(decode_sample(bad_list, sizeof(bad_list), &req, NULL) == CBOR_SCHEMA_MALFORMED);
+    static const uint8_t bad_extra[] = {0xA3, 0x01, 0x40, 0x02, 0x00, 0x05, 0x5F};
+    CHECK(decode_sample(bad_extra, sizeof(bad_extra), &req, NULL) == CBOR_SCHEMA_MALFORMED);
+
+    // Array keys are not CTAP2
+    static const uint8_t array_key[] = {0xA3, 0x01, 0x40, 0x02, 0x00, 0x80, 0x00};
+    CHECK(decode_sample(array_key, sizeof(array_key), &req, NULL) == CBOR_SCHEMA_MALFORMED);
+}
+
+int main(void) {
+    test_wide_heads();
+    test_depth_limit();
+    test_index();
+    test_encoder();
+    test_schema();
+    if (failures == 0) {
+        printf("[+] cbor: all checks passed\n");
+    }
+    return failures ? 1 : 0;
+}
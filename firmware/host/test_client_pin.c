@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <string.h>
+#include "crypto_hal.h"
+#include "ctap2.h"
+#include "client_pin.h"
+
+// clientPIN protocol 1 with the test as the platform: HMAC-SHA-256 against
+// RFC 4231, setPIN, getPINToken and a pinAuth the token verifies, retries
+// spent on a wrong PIN and given back on a right one, and the per-boot
+// block after CLIENT_PIN_MAX_CONSECUTIVE misses.
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("[-] %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const uint8_t zero_iv[16] = {0};
+
+// The platform side of a key agreement: its own key and the shared secret
+typedef struct {
+    uint8_t pub[65];
+    uint8_t secret[32];
+} platform_t;
+
+static void platform_agree(platform_t *p) {
+    uint8_t priv[32];
+    uint8_t auth_key[65];
+    uint8_t x[32];
+    CHECK(hal_ecc_generate_keypair(priv, p->pub) == 0);
+    CHECK(client_pin_key_agreement(auth_key) == CTAP2_OK);
+    CHECK(hal_ecdh_p256(priv, auth_key, x) == 0);
+    hal_sha256(x, sizeof(x), p->secret);
+}
+
+static void pin_auth(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t msg_len, uint8_t out[16]) {
+    uint8_t mac[32];
+    hal_hmac_sha256(key, key_len, msg, msg_len, mac);
+    memcpy(out, mac, 16);
+}
+
+static void encrypt_pin_hash(const platform_t *p, const char *pin, uint8_t enc[16]) {
+    uint8_t hash[32];
+    hal_sha256((const uint8_t *)pin, strlen(pin), hash);
+    hal_aes_cbc_encrypt(p->secret, zero_iv, hash, 16, enc);
+}
+
+static uint8_t get_token(const char *pin, uint8_t token[32]) {
+    platform_t p;
+    uint8_t hash_enc[16];
+    uint8_t token_enc[32];
+    platform_agree(&p);
+    encrypt_pin_hash(&p, pin, hash_enc);
+    uint8_t status = client_pin_get_token(p.pub, hash_enc, sizeof(hash_enc), token_enc);
+    if (status == CTAP2_OK) hal_aes_cbc_decrypt(p.secret, zero_iv, token_enc, 32, token);
+    return status;
+}
+
+static void test_hmac(void) {
+    // RFC 4231 test case 2
+    static const uint8_t expected[32] = {
+        0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+        0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43,
+    };
+    const char *msg = "what do ya want for nothing?";
+    uint8_t mac[32];
+    CHECK(hal_hmac_sha256((const uint8_t *)"Jefe", 4, (const uint8_t *)msg, strlen(msg), mac) == 0);
+    CHECK(memcmp(mac, expected, 32) == 0);
+}
+
+static void test_set_and_token(void) {
+    CHECK(!client_pin_is_set());
+    CHECK(client_pin_retries() == CLIENT_PIN_MAX_RETRIES);
+    uint8_t token[32];
+    CHECK(get_token("1234", token) == CTAP2_ERR_PIN_NOT_SET);
+
+    // Too short, then a wrong pinAuth, then right
+    platform_t p;
+    uint8_t padded[64] = {0};
+    uint8_t new_pin_enc[64];
+    uint8_t auth[16];
+    platform_agree(&p);
+    memcpy(padded, "123", 3);
+    hal_aes_cbc_encrypt(p.secret, zero_iv, padded, 64, new_pin_enc);
+    pin_auth(p.secret, 32, new_pin_enc, 64, auth);
+    CHECK(client_pin_set(p.pub, auth, 16, new_pin_enc, 64) == CTAP2_ERR_PIN_POLICY_VIOLATION);
+    memcpy(padded, "1234", 4);
+    hal_aes_cbc_encrypt(p.secret, zero_iv, padded, 64, new_pin_enc);
+    CHECK(client_pin_set(p.pub, auth, 16, new_pin_enc, 64) == CTAP2_ERR_PIN_AUTH_INVALID);
+    pin_auth(p.secret, 32, new_pin_enc, 64, auth);
+    CHECK(client_pin_set(p.pub, auth, 16, new_pin_enc, 64) == CTAP2_OK);
+    CHECK(client_pin_is_set());
+    CHECK(client_pin_set(p.pub, auth, 16, new_pin_enc, 64) == CTAP2_ERR_PIN_AUTH_INVALID);
+
+    // An off-curve platform key
+    uint8_t bad_key[65];
+    memcpy(bad_key, p.pub, 65);
+    bad_key[64] ^= 1;
+    uint8_t hash_enc[16] = {0};
+    uint8_t token_enc[32];
+    CHECK(client_pin_get_token(bad_key, hash_enc, 16, token_enc) == CTAP2_ERR_INVALID_PARAMETER);
+    CHECK(client_pin_retries() == CLIENT_PIN_MAX_RETRIES);
+
+    // The token authorizes a message, and nothing else
+    uint8_t client_data_hash[32];
+    memset(client_data_hash, 0xA5, sizeof(client_data_hash));
+    CHECK(get_token("1234", token) == CTAP2_OK);
+    pin_auth(token, 32, client_data_hash, 32, auth);
+    CHECK(client_pin_verify(client_data_hash, 32, auth, 16) == CTAP2_OK);
+    CHECK(client_pin_verify(client_data_hash, 32, auth, 15) == CTAP2_ERR_PIN_AUTH_INVALID);
+    client_data_hash[0] ^= 1;
+    CHECK(client_pin_verify(client_data_hash, 32, auth, 16) == CTAP2_ERR_PIN_AUTH_INVALID);
+}
+
+static void test_retries(void) {
+    uint8_t token[32];
+    CHECK(get_token("0000", token) == CTAP2_ERR_PIN_INVALID);
+    CHECK(client_pin_retries() == CLIENT_PIN_MAX_RETRIES - 1);
+    CHECK(get_token("1234", token) == CTAP2_OK);
+    CHECK(client_pin_retries() == CLIENT_PIN_MAX_RETRIES);
+
+    // changePIN needs the current one, then the old token is dead
+    uint8_t old_token[32];
+    memcpy(old_token, token, 32);
+    platform_t p;
+    uint8_t padded[64] = {0};
+    uint8_t msg[64 + 16];
+    uint8_t auth[16];
+    platform_agree(&p);
+    memcpy(padded, "567890", 6);
+    hal_aes_cbc_encrypt(p.secret, zero_iv, padded, 64, msg);
+    encrypt_pin_hash(&p, "1234", &msg[64]);
+    pin_auth(p.secret, 32, msg, sizeof(msg), auth);
+    CHECK(client_pin_change(p.pub, auth, 16, msg, 64, &msg[64], 16) == CTAP2_OK);
+    uint8_t cdh[32] = {0};
+    pin_auth(old_token, 32, cdh, 32, auth);
+    CHECK(client_pin_verify(cdh, 32, auth, 16) == CTAP2_ERR_PIN_AUTH_INVALID);
+    CHECK(get_token("1234", token) == CTAP2_ERR_PIN_INVALID);
+    CHECK(get_token("567890", token) == CTAP2_OK);
+
+    // Misses in a row block entry for this boot, even with the right PIN
+    for (int i = 0; i < CLIENT_PIN_MAX_CONSECUTIVE - 1; i++) {
+        CHECK(get_token("0000", token) == CTAP2_ERR_PIN_INVALID);
+    }
+    CHECK(get_token("0000", token) == CTAP2_ERR_PIN_AUTH_BLOCKED);
+    CHECK(client_pin_retries() == CLIENT_PIN_MAX_RETRIES - CLIENT_PIN_MAX_CONSECUTIVE);
+    CHECK(get_token("567890", token) == CTAP2_ERR_PIN_AUTH_BLOCKED);
+    CHECK(client_pin_retries() == CLIENT_PIN_MAX_RETRIES - CLIENT_PIN_MAX_CONSECUTIVE);
+}
+
+int main(void) {
+    if (hal_crypto_init() != 0) {
+        printf("[-] hal_crypto_init failed\n");
+        return 1;
+    }
+    client_pin_init();
+    test_hmac();
+    test_set_and_token();
+    test_retries();
+    if (failures == 0) {
+        printf("[+] client_pin: all checks passed\n");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "counter_store.h"
+
+// Counter journal on the host partition image: values never repeat across
+// restarts, reservations are written off the request path, the ring wraps
+// with erases done ahead, per-credential counters survive eviction, and a
+// torn record or an interrupted snapshot loses nothing that was handed out.
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("[-] %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+#define SECTOR_SIZE 4096
+#define RECORD_SIZE 16
+
+static const esp_partition_t *part;
+
+static void wipe(void) {
+    esp_partition_erase_range(part, 0, part->size);
+}
+
+static void test_fresh_and_batched(void) {
+    wipe();
+    CHECK(counter_store_init() == ESP_OK);
+    counter_store_stats_t st;
+
+    // Like the worker: commit after each response, upkeep now and then
+    uint32_t last = 0;
+    bool consecutive = true;
+    for (int i = 0; i < 50000; i++) {
+        uint32_t v = counter_store_next(COUNTER_GLOBAL);
+        consecutive = consecutive && v == last + 1;
+        last = v;
+        counter_store_commit();
+        if (i % 500 == 0) counter_store_maintain();
+    }
+    CHECK(consecutive && last == 50000);
+    counter_store_get_stats(&st);
+    CHECK(st.sync_commits == 0);
+    CHECK(st.sync_erases == 0);
+    CHECK(st.snapshots > 4); // Around the ring more than once
+    CHECK(st.records_written < 50000 / COUNTER_STORE_RESERVE + 8 * st.snapshots);
+
+    // Back to back with no commit: one in COUNTER_STORE_RESERVE waits
+    counter_store_get_stats(&st);
+    uint32_t sync_before = st.sync_commits;
+    for (int i = 0; i < 10 * COUNTER_STORE_RESERVE; i++) {
+        uint32_t v = counter_store_next(COUNTER_GLOBAL);
+        consecutive = consecutive && v == last + 1;
+        last = v;
+    }
+    counter_store_get_stats(&st);
+    CHECK(consecutive);
+    CHECK(st.sync_commits - sync_before <= 10);
+}
+
+static void test_restarts(void) {
+    wipe();
+    CHECK(counter_store_init() == ESP_OK);
+
+    // Restart at every point of the reservation cycle, committed or not
+    uint32_t last = 0;
+    bool increasing = true;
+    for (int round = 0; round < 200; round++) {
+        for (int i = 0; i < round % 45; i++) {
+            uint32_t v = counter_store_next(COUNTER_GLOBAL);
+            increasing = increasing && v > last;
+            last = v;
+            if (round % 3 == 0) counter_store_commit();
+        }
+        if (round % 7 == 0) counter_store_maintain();
+        CHECK(counter_store_init() == ESP_OK);
+    }
+    CHECK(increasing);
+    uint32_t v = counter_store_next(COUNTER_GLOBAL);
+    CHECK(v > last && v <= last + 2 * COUNTER_STORE_RESERVE + 1);
+
+    // A floor carried over from elsewhere, kept across a restart
+    CHECK(counter_store_raise(COUNTER_GLOBAL, 100000) == ESP_OK);
+    CHECK(counter_store_next(COUNTER_GLOBAL) == 100001);
+    CHECK(counter_store_raise(COUNTER_GLOBAL, 5) == ESP_OK); // Lower: no effect
+    CHECK(counter_store_init() == ESP_OK);
+    CHECK(counter_store_next(COUNTER_GLOBAL) > 100001);
+}
+
+static void test_per_credential(void) {
+    wipe();
+    CHECK(counter_store_init() == ESP_OK);
+
+    // More credentials than the table holds, so some are evicted and come back
+    enum { CREDS = COUNTER_STORE_MAX_CREDS + 8 };
+    uint32_t ids[CREDS];
+    uint32_t last[CREDS] = {0};
+    for (int c = 0; c < CREDS; c++) {
+        uint8_t cred_id[16];
+        memset(cred_id, c + 1, sizeof(cred_id));
+        ids[c] = counter_store_cred_id(cred_id, sizeof(cred_id));
+        CHECK(ids[c] != COUNTER_GLOBAL);
+    }
+
+    bool increasing = true;
+    bool above_global = true;
+    uint32_t global = 0;
+    for (int i = 0; i < 6000; i++) {
+        int c = (i * 7 + i / 13) % CREDS;
+        uint32_t v = counter_store_next(ids[c]);
+        increasing = increasing && v > last[c];
+        above_global = above_global && v > global;
+        last[c] = v;
+        if (i % 5 == 0) global = counter_store_next(COUNTER_GLOBAL); // U2F in between
+        if (i % 3 != 0) counter_store_commit();
+        if (i % 50 == 0) counter_store_maintain();
+        if (i % 997 == 0) CHECK(counter_store_init() == ESP_OK);
+    }
+    CHECK(increasing);
+    CHECK(above_global);
+}
+
+// Offset of the first erased record after the last programmed one in the
+// sector with the highest sequence number
+static long head_offset(long *snapshot_end) {
+    uint32_t best_seq = 0;
+    long best = -1;
+    for (size_t s = 0; s < part->size / SECTOR_SIZE; s++) {
+        uint32_t hdr[4];
+        esp_partition_read(part, s * SECTOR_SIZE, hdr, sizeof(hdr));
+        if (hdr[0] == 0x31524346 && hdr[1] >= best_seq) {
+            best_seq = hdr[1];
+            best = (long)s;
+        }
+    }
+    if (best < 0) return -1;
+    long end = best * SECTOR_SIZE + RECORD_SIZE;
+    *snapshot_end = -1;
+    for (int i = 1; i < SECTOR_SIZE / RECORD_SIZE; i++) {
+        uint32_t rec[4];
+        long off = best * SECTOR_SIZE + i * RECORD_SIZE;
+        esp_partition_read(part, (size_t)off, rec, sizeof(rec));
+        if (rec[0] == 0xFFFFFFFE && *snapshot_end < 0) *snapshot_end = off;
+        if (rec[0] != 0xFFFFFFFF || rec[1] != 0xFFFFFFFF) end = off + RECORD_SIZE;
+    }
+    return end;
+}
+
+static void test_power_loss(void) {
+    wipe();
+    CHECK(counter_store_init() == ESP_OK);
+    uint32_t last = 0;
+    for (int i = 0; i < 100; i++) {
+        last = counter_store_next(COUNTER_GLOBAL);
+        counter_store_commit();
+    }
+
+    // A ceiling record cut short: ignored, and writing carries on past it
+    long snapshot_end;
+    long head = head_offset(&snapshot_end);
+    CHECK(head > 0);
+    if (head > 0) {
+        static const uint8_t torn[8] = {0x00, 0x00, 0x00, 0x00, 0x12, 0x34};
+        esp_partition_write(part, (size_t)head, torn, sizeof(torn));
+    }
+    CHECK(counter_store_init() == ESP_OK);
+    uint32_t v = counter_store_next(COUNTER_GLOBAL);
+    CHECK(v > last);
+    last = v;
+    counter_store_commit();
+    long snapshot_end2;
+    CHECK(head_offset(&snapshot_end2) > head + RECORD_SIZE);
+
+    // Run the ring over to a new sector, then cut its snapshot short: the
+    // global record and the end marker torn, so only the previous sector
+    // knows the ceiling
+    counter_store_stats_t st;
+    counter_store_get_stats(&st);
+    uint32_t snapshots = st.snapshots;
+    while (st.snapshots == snapshots) {
+        last = counter_store_next(COUNTER_GLOBAL);
+        counter_store_commit();
+        counter_store_get_stats(&st);
+    }
+    head_offset(&snapshot_end);
+    CHECK(snapshot_end > 0);
+    if (snapshot_end > 0) {
+        uint8_t zero = 0;
+        long sector = snapshot_end / SECTOR_SIZE * SECTOR_SIZE;
+        esp_partition_write(part, (size_t)sector + RECORD_SIZE + 4, &zero, 1); // COUNTER_GLOBAL comes first
+        esp_partition_write(part, (size_t)snapshot_end + 4, &zero, 1);
+    }
+    CHECK(counter_store_init() == ESP_OK);
+    CHECK(counter_store_next(COUNTER_GLOBAL) > last);
+}
+
+int main(void) {
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, COUNTER_STORE_PARTITION);
+    if (!part) {
+        printf("[-] no %s partition\n", COUNTER_STORE_PARTITION);
+        return 1;
+    }
+    test_fresh_and_batched();
+    test_restarts();
+    test_per_credential();
+    test_power_loss();
+    if (failures == 0) {
+        printf("[+] counter_store: all checks passed\n");
+    }
+    return failures ? 1 : 0;
+}
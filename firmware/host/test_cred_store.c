@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "cred_store.h"
+
+// Resident credential log on the host partition image: replacement and
+// delete, replay after a restart, compaction under churn with and without
+// idle-time upkeep, the capacity limit, torn or corrupted records,
+// walking one RP's credentials newest first, and cursor enumeration by RP.
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("[-] %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+#define CRED_ID_LEN 40
+
+static const esp_partition_t *part;
+
+static void wipe(void) {
+    esp_partition_erase_range(part, 0, part->size);
+}
+
+static void make_cred(cred_record_t *rec, uint8_t rp, uint8_t user, uint32_t serial) {
+    memset(rec, 0, sizeof(*rec));
+    memset(rec->rp_id_hash, rp, 32);
+    rec->cred_id_len = CRED_ID_LEN;
+    for (int i = 0; i < CRED_ID_LEN; i++) {
+        rec->cred_id[i] = (uint8_t)(serial >> (8 * (i % 4))) ^ (uint8_t)(i * 31) ^ rp;
+    }
+    rec->user_id_len = 8;
+    memset(rec->user_id, user, 8);
+    rec->rp_id_len = (uint8_t)snprintf(rec->rp_id, sizeof(rec->rp_id), "rp%u.example", rp);
+}
+
+static bool has_cred(uint8_t rp, const cred_record_t *want) {
+    cred_record_t out[CRED_STORE_MAX_CREDS];
+    uint8_t hash[32];
+    memset(hash, rp, 32);
+    size_t n = cred_store_find(hash, out, CRED_STORE_MAX_CREDS);
+    for (size_t i = 0; i < n; i++) {
+        if (out[i].cred_id_len == want->cred_id_len && memcmp(out[i].cred_id, want->cred_id, want->cred_id_len) == 0) {
+            return out[i].user_id_len == want->user_id_len &&
+                   memcmp(out[i].user_id, want->user_id, want->user_id_len) == 0;
+        }
+    }
+    return false;
+}
+
+// Partition offset of a stored credential ID, or -1
+static long find_in_flash(const cred_record_t *rec) {
+    static uint8_t image[0x10000];
+    esp_partition_read(part, 0, image, part->size);
+    for (size_t off = 0; off + rec->cred_id_len <= part->size; off++) {
+        if (memcmp(&image[off], rec->cred_id, rec->cred_id_len) == 0) return (long)off;
+    }
+    return -1;
+}
+
+static void test_basic(void) {
+    wipe();
+    CHECK(cred_store_init() == ESP_OK);
+    CHECK(cred_store_count() == 0);
+
+    cred_record_t a1, a2, b1, a1_new;
+    make_cred(&a1, 0xA0, 1, 1);
+    make_cred(&a2, 0xA0, 2, 2);
+    make_cred(&b1, 0xB0, 1, 3);
+    CHECK(cred_store_put(&a1) == ESP_OK);
+    CHECK(cred_store_put(&a2) == ESP_OK);
+    CHECK(cred_store_put(&b1) == ESP_OK);
+    CHECK(cred_store_count() == 3);
+
+    // Newest first, and max only limits what is copied
+    cred_record_t out[2];
+    uint8_t hash[32];
+    memset(hash, 0xA0, 32);
+    CHECK(cred_store_find(hash, out, 2) == 2);
+    CHECK(memcmp(out[0].cred_id, a2.cred_id, CRED_ID_LEN) == 0 && out[0].created > out[1].created);
+    CHECK(out[0].rp_id_len == strlen("rp160.example") && memcmp(out[0].rp_id, "rp160.example", out[0].rp_id_len) == 0);
+    CHECK(cred_store_find(hash, out, 1) == 2);
+    CHECK(memcmp(out[0].cred_id, a2.cred_id, CRED_ID_LEN) == 0);
+
+    // One at a time from there, as GetNextAssertion walks them
+    cred_record_t next;
+    CHECK(cred_store_find_before(hash, out[0].created, &next));
+    CHECK(memcmp(next.cred_id, a1.cred_id, CRED_ID_LEN) == 0);
+    CHECK(!cred_store_find_before(hash, next.created, &next));
+    memset(hash, 0xC0, 32);
+    CHECK(cred_store_find(hash, out, 2) == 0);
+    CHECK(!cred_store_find_before(hash, UINT32_MAX, &next));
+
+    // Same RP and user: replaced
+    make_cred(&a1_new, 0xA0, 1, 4);
+    CHECK(cred_store_put(&a1_new) == ESP_OK);
+    CHECK(cred_store_count() == 3);
+    CHECK(has_cred(0xA0, &a1_new) && !has_cred(0xA0, &a1));
+
+    CHECK(cred_store_delete(a2.cred_id, CRED_ID_LEN) == ESP_OK);
+    CHECK(cred_store_delete(a2.cred_id, CRED_ID_LEN) == ESP_ERR_NOT_FOUND);
+    CHECK(cred_store_delete(a1.cred_id, CRED_ID_LEN) == ESP_ERR_NOT_FOUND);
+    CHECK(cred_store_count() == 2);
+
+    // Restart: the same state from the log
+    CHECK(cred_store_init() == ESP_OK);
+    CHECK(cred_store_count() == 2);
+    CHECK(has_cred(0xA0, &a1_new) && has_cred(0xB0, &b1));
+    CHECK(!has_cred(0xA0, &a1) && !has_cred(0xA0, &a2));
+}
+
+// Many more writes than the partition holds: compaction keeps it going
+static void churn(bool idle_upkeep) {
+    wipe();
+    CHECK(cred_store_init() == ESP_OK);
+
+    enum { USERS = 12, ROUNDS = 600 };
+    cred_record_t latest[USERS];
+    uint32_t serial = 100;
+    bool ok = true;
+    for (int r = 0; r < ROUNDS && ok; r++) {
+        int u = r % USERS;
+        make_cred(&latest[u], (uint8_t)(0x10 + u % 3), (uint8_t)u, serial++);
+        ok = cred_store_put(&latest[u]) == ESP_OK;
+        if (idle_upkeep) {
+            while (cred_store_maintain()) {
+            }
+        }
+        if (r % 97 == 0) ok = ok && cred_store_init() == ESP_OK; // Restart now and then
+    }
+    CHECK(ok);
+    CHECK(cred_store_count() == USERS);
+
+    // One deleted late, then everything checked after a restart
+    CHECK(cred_store_delete(latest[5].cred_id, CRED_ID_LEN) == ESP_OK);
+    CHECK(cred_store_init() == ESP_OK);
+    CHECK(cred_store_count() == USERS - 1);
+    for (int u = 0; u < USERS; u++) {
+        CHECK(has_cred((uint8_t)(0x10 + u % 3), &latest[u]) == (u != 5));
+    }
+}
+
+static void test_capacity(void) {
+    wipe();
+    CHECK(cred_store_init() == ESP_OK);
+
+    cred_record_t rec;
+    for (int i = 0; i < CRED_STORE_MAX_CREDS; i++) {
+        make_cred(&rec, 0x20, (uint8_t)i, 1000 + i);
+        CHECK(cred_store_put(&rec) == ESP_OK);
+    }
+    make_cred(&rec, 0x20, 0xFF, 2000);
+    CHECK(cred_store_put(&rec) == ESP_ERR_NO_MEM);
+
+    // Replacing one still fits, and a delete makes room
+    make_cred(&rec, 0x20, 0, 2001);
+    CHECK(cred_store_put(&rec) == ESP_OK);
+    CHECK(cred_store_delete(rec.cred_id, CRED_ID_LEN) == ESP_OK);
+    make_cred(&rec, 0x20, 0xFF, 2002);
+    CHECK(cred_store_put(&rec) == ESP_OK);
+    CHECK(cred_store_count() == CRED_STORE_MAX_CREDS);
+}
+
+static void test_torn_and_corrupt(void) {
+    wipe();
+    CHECK(cred_store_init() == ESP_OK);
+
+    cred_record_t a, b, c;
+    make_cred(&a, 0x30, 1, 3001);
+    make_cred(&b, 0x30, 2, 3002);
+    CHECK(cred_store_put(&a) == ESP_OK);
+    CHECK(cred_store_put(&b) == ESP_OK);
+
+    // A bit cleared inside b (as by a program cut short): b is dropped on
+    // replay, a is untouched
+    long off = find_in_flash(&b);
+    CHECK(off >= 0);
+    if (off >= 0) {
+        uint8_t zero = 0;
+        esp_partition_write(part, (size_t)off, &zero, 1);
+    }
+
+    // A record that only got its first bytes into the next slot
+    long slot = off >= 0 ? (off / 256 + 1) * 256 : -1;
+    if (slot >= 0) {
+        static const uint8_t partial[16] = {0x46, 0x52, 0x45, 0x43, 0x12, 0x34};
+        esp_partition_write(part, (size_t)slot, partial, sizeof(partial));
+    }
+
+    CHECK(cred_store_init() == ESP_OK);
+    CHECK(cred_store_count() == 1);
+    CHECK(has_cred(0x30, &a) && !has_cred(0x30, &b));
+
+    // New records go past the damaged slots and replay normally
+    make_cred(&c, 0x30, 3, 3003);
+    CHECK(cred_store_put(&c) == ESP_OK);
+    long c_off = find_in_flash(&c);
+    CHECK(slot >= 0 && c_off > slot);
+    CHECK(cred_store_init() == ESP_OK);
+    CHECK(cred_store_count() == 2);
+    CHECK(has_cred(0x30, &a) && has_cred(0x30, &c));
+
+    // A sector half erased when power went: treated as stale and reclaimed
+    wipe();
+    uint8_t junk[64];
+    memset(junk, 0x5A, sizeof(junk));
+    esp_partition_write(part, 4096 + 2048, junk, sizeof(junk));
+    CHECK(cred_store_init() == ESP_OK);
+    CHECK(cred_store_maintain());
+    uint8_t check[64];
+    esp_partition_read(part, 4096 + 2048, check, sizeof(check));
+    CHECK(check[0] == 0xFF && check[63] == 0xFF);
+}
+
+// Every RP once, every credential of an RP once, with compaction moving
+// records between the steps
+static void test_cursors(void) {
+    wipe();
+    CHECK(cred_store_init() == ESP_OK);
+
+    enum { RPS = 5, PER_RP = 4 };
+    cred_record_t rec;
+    uint32_t serial = 5000;
+    for (int u = 0; u < PER_RP; u++) {
+        for (int rp = 0; rp < RPS; rp++) {
+            make_cred(&rec, (uint8_t)(0x40 + rp), (uint8_t)u, serial++);
+            CHECK(cred_store_put(&rec) == ESP_OK);
+        }
+    }
+    // Churn on one RP, so its records end up spread out and compacted
+    for (int i = 0; i < 200; i++) {
+        make_cred(&rec, 0x40, (uint8_t)(i % PER_RP), serial++);
+        CHECK(cred_store_put(&rec) == ESP_OK);
+    }
+    CHECK(cred_store_rp_count() == RPS);
+
+    cred_cursor_t cursor = CRED_STORE_CURSOR_INIT;
+    unsigned seen_rps = 0;
+    int steps = 0;
+    while (cred_store_next_rp(&cursor, &rec)) {
+        int rp = rec.rp_id_hash[0] - 0x40;
+        CHECK(rp >= 0 && rp < RPS && !(seen_rps & (1u << rp)));
+        seen_rps |= 1u << rp;
+        steps++;
+        while (cred_store_maintain()) {
+        }
+    }
+    CHECK(steps == RPS && seen_rps == (1u << RPS) - 1);
+    CHECK(!cred_store_next_rp(&cursor, &rec));
+
+    uint8_t hash[32];
+    memset(hash, 0x40, 32);
+    cursor = (cred_cursor_t)CRED_STORE_CURSOR_INIT;
+    unsigned seen_users = 0;
+    steps = 0;
+    while (cred_store_next_cred(&cursor, hash, &rec)) {
+        CHECK(rec.rp_id_hash[0] == 0x40 && !(seen_users & (1u << rec.user_id[0])));
+        seen_users |= 1u << rec.user_id[0];
+        steps++;
+        while (cred_store_maintain()) {
+        }
+    }
+    CHECK(steps == PER_RP && seen_users == (1u << PER_RP) - 1);
+
+    // An RP whose last credential is deleted is no longer listed
+    memset(hash, 0x41, 32);
+    cred_record_t out[PER_RP];
+    size_t n = cred_store_find(hash, out, PER_RP);
+    CHECK(n == PER_RP);
+    for (size_t i = 0; i < n; i++) {
+        CHECK(cred_store_delete(out[i].cred_id, out[i].cred_id_len) == ESP_OK);
+    }
+    CHECK(cred_store_rp_count() == RPS - 1);
+    cursor = (cred_cursor_t)CRED_STORE_CURSOR_INIT;
+    CHECK(!cred_store_next_cred(&cursor, hash, &rec));
+
+    // RPs that share an index bucket stay apart, and one leaving the
+    // bucket does not take the others with it
+    for (int rp = 0x50; rp <= 0x70; rp += 0x10) {
+        make_cred(&rec, (uint8_t)rp, 0, serial++);
+        CHECK(cred_store_put(&rec) == ESP_OK);
+    }
+    CHECK(cred_store_rp_count() == RPS + 2);
+    memset(hash, 0x60, 32);
+    CHECK(cred_store_find(hash, out, PER_RP) == 1 && out[0].rp_id_hash[0] == 0x60);
+    CHECK(cred_store_delete(out[0].cred_id, out[0].cred_id_len) == ESP_OK);
+    CHECK(cred_store_find(hash, out, PER_RP) == 0);
+    memset(hash, 0x40, 32);
+    CHECK(cred_store_find(hash, out, PER_RP) == PER_RP);
+    memset(hash, 0x70, 32);
+    CHECK(cred_store_find(hash, out, PER_RP) == 1);
+    CHECK(cred_store_init() == ESP_OK);
+    CHECK(cred_store_rp_count() == RPS + 1);
+}
+
+int main(void) {
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CRED_STORE_PARTITION);
+    if (!part) {
+        printf("[-] no %s partition\n", CRED_STORE_PARTITION);
+        return 1;
+    }
+    test_basic();
+    churn(false);
+    churn(true);
+    test_capacity();
+    test_torn_and_corrupt();
+    test_cursors();
+    if (failures == 0) {
+        printf("[+] cred_store: all checks passed\n");
+    }
+    return failures ? 1 : 0;
+}
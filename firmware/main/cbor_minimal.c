@@ -5,33 +5,50 @@
 
 void cbor_encoder_init(cbor_encoder_t *enc, uint8_t *buf, size_t size) {
     enc->buf = buf;
-    enc->size = size;
+    enc->size = buf ? size : SIZE_MAX;
     enc->offset = 0;
+    enc->error = false;
 }
 
-static void encode_head(cbor_encoder_t *enc, uint8_t major, uint64_t val) {
-    if (enc->offset >= enc->size) return;
+// Room for n more bytes: a pointer to write them to, or NULL when sizing or
+// once the buffer has overflowed. The offset advances either way.
+static uint8_t *reserve(cbor_encoder_t *enc, size_t n) {
+    uint8_t *p = NULL;
+    if (!enc->error && n <= enc->size - enc->offset) {
+        if (enc->buf) p = enc->buf + enc->offset;
+    } else {
+        enc->error = true;
+    }
+    enc->offset = n <= SIZE_MAX - enc->offset ? enc->offset + n : SIZE_MAX;
+    return p;
+}
 
+// Shortest head for the argument, as CTAP2 canonical CBOR requires
+static void encode_head(cbor_encoder_t *enc, uint8_t major, uint64_t val) {
+    uint8_t info;
+    size_t n;
     if (val < 24) {
-        enc->buf[enc->offset++] = major | (uint8_t)val;
+        info = (uint8_t)val;
+        n = 0;
     } else if (val <= 0xFF) {
-        if (enc->offset + 2 > enc->size) return;
-        enc->buf[enc->offset++] = major | 24;
-        enc->buf[enc->offset++] = (uint8_t)val;
+        info = 24;
+        n = 1;
     } else if (val <= 0xFFFF) {
-        if (enc->offset + 3 > enc->size) return;
-        enc->buf[enc->offset++] = major | 25;
-        enc->buf[enc->offset++] = (uint8_t)(val >> 8);
-        enc->buf[enc->offset++] = (uint8_t)val;
+        info = 25;
+        n = 2;
     } else if (val <= 0xFFFFFFFF) {
-        if (enc->offset + 5 > enc->size) return;
-        enc->buf[enc->offset++] = major | 26;
-        enc->buf[enc->offset++] = (uint8_t)(val >> 24);
-        enc->buf[enc->offset++] = (uint8_t)(val >> 16);
-        enc->buf[enc->offset++] = (uint8_t)(val >> 8);
-        enc->buf[enc->offset++] = (uint8_t)val;
+        info = 26;
+        n = 4;
     } else {
-        // 64-bit not implemented for minimal
+        info = 27;
+        n = 8;
+    }
+
+    uint8_t *p = reserve(enc, 1 + n);
+    if (!p) return;
+    p[0] = major | info;
+    for (size_t i = 0; i < n; i++) {
+        p[n - i] = (uint8_t)(val >> (8 * i));
     }
 }
 
@@ -47,21 +64,27 @@ void cbor_encode_int(cbor_encoder_t *enc, int64_t val) {
     }
 }
 
+static void encode_string(cbor_encoder_t *enc, uint8_t major, const void *data, size_t len) {
+    encode_head(enc, major, len);
+    uint8_t *p = reserve(enc, len);
+    if (p && len) memcpy(p, data, len);
+}
+
 void cbor_encode_bytes(cbor_encoder_t *enc, const uint8_t *data, size_t len) {
+    encode_string(enc, CBOR_BYTES, data, len);
+}
+
+uint8_t *cbor_encode_bytes_reserve(cbor_encoder_t *enc, size_t len) {
     encode_head(enc, CBOR_BYTES, len);
-    if (enc->offset + len <= enc->size) {
-        memcpy(enc->buf + enc->offset, data, len);
-        enc->offset += len;
-    }
+    return reserve(enc, len);
+}
+
+void cbor_encode_text_n(cbor_encoder_t *enc, const char *text, size_t len) {
+    encode_string(enc, CBOR_TEXT, text, len);
 }
 
 void cbor_encode_text(cbor_encoder_t *enc, const char *text) {
-    size_t len = strlen(text);
-    encode_head(enc, CBOR_TEXT, len);
-    if (enc->offset + len <= enc->size) {
-        memcpy(enc->buf + enc->offset, text, len);
-        enc->offset += len;
-    }
+    encode_string(enc, CBOR_TEXT, text, strlen(text));
 }
 
 void cbor_encode_map_start(cbor_encoder_t *enc, size_t len) {
@@ -72,6 +95,22 @@ void cbor_encode_array_start(cbor_encoder_t *enc, size_t len) {
     encode_head(enc, CBOR_ARRAY, len);
 }
 
+void cbor_encode_simple(cbor_encoder_t *enc, uint8_t val) {
+    if (val >= 24 && val < 32) {
+        enc->error = true; // Reserved, not well-formed
+        return;
+    }
+    encode_head(enc, CBOR_SIMPLE, val);
+}
+
+void cbor_encode_bool(cbor_encoder_t *enc, bool val) {
+    cbor_encode_simple(enc, val ? CBOR_SIMPLE_TRUE : CBOR_SIMPLE_FALSE);
+}
+
+void cbor_encode_null(cbor_encoder_t *enc) {
+    cbor_encode_simple(enc, CBOR_SIMPLE_NULL);
+}
+
 // --- Decoder ---
 
 void cbor_decoder_init(cbor_decoder_t *dec, const uint8_t *buf, size_t size) {
@@ -80,117 +119,97 @@ void cbor_decoder_init(cbor_decoder_t *dec, const uint8_t *buf, size_t size) {
     dec->offset = 0;
 }
 
-// Simplistic decoder helpers
 static uint8_t peek(cbor_decoder_t *dec) {
     if (dec->offset >= dec->size) return 0xFF;
     return dec->buf[dec->offset];
 }
 
-static uint8_t read_byte(cbor_decoder_t *dec) {
-    if (dec->offset >= dec->size) return 0;
-    return dec->buf[dec->offset++];
-}
-
-bool cbor_decode_uint(cbor_decoder_t *dec, uint64_t *val) {
-    uint8_t head = read_byte(dec);
-    uint8_t major = head & 0xE0;
-    uint8_t info = head & 0x1F;
-    
-    if (major != CBOR_UINT) return false;
-    
+// Argument of an item head (length, count or value), bounds-checked.
+// 1, 2, 4 and 8-byte arguments (additional info 24..27) are all accepted.
+static bool read_arg(cbor_decoder_t *dec, uint8_t info, uint64_t *val) {
     if (info < 24) {
         *val = info;
-    } else if (info == 24) {
-        *val = read_byte(dec);
-    } else if (info == 25) {
-        *val = ((uint64_t)read_byte(dec) << 8) | read_byte(dec);
-    } else {
-        return false; // Not supporting > 16 bit for minimal decoder yet
+        return true;
     }
+    if (info > 27) return false; // Reserved or indefinite length
+
+    size_t n = (size_t)1 << (info - 24);
+    if (n > dec->size - dec->offset) return false;
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) {
+        v = (v << 8) | dec->buf[dec->offset++];
+    }
+    *val = v;
     return true;
 }
 
-bool cbor_decode_bytes(cbor_decoder_t *dec, const uint8_t **data, size_t *len) {
-    uint8_t head = read_byte(dec);
-    uint8_t major = head & 0xE0;
-    uint8_t info = head & 0x1F;
-    
-    if (major != CBOR_BYTES) return false;
-    
-    size_t l = 0;
-    if (info < 24) {
-        l = info;
-    } else if (info == 24) {
-        l = read_byte(dec);
-    } else if (info == 25) {
-        l = ((size_t)read_byte(dec) << 8) | read_byte(dec);
-    }
-    
-    if (dec->offset + l > dec->size) return false;
-    
+// Head of the expected major type. On failure nothing is consumed.
+static bool read_head(cbor_decoder_t *dec, uint8_t major, uint64_t *arg) {
+    if (dec->offset >= dec->size || (dec->buf[dec->offset] & 0xE0) != major) return false;
+    size_t start = dec->offset;
+    uint8_t info = dec->buf[dec->offset++] & 0x1F;
+    if (!read_arg(dec, info, arg)) {
+        dec->offset = start;
+        return false;
+    }
+    return true;
+}
+
+bool cbor_decode_uint(cbor_decoder_t *dec, uint64_t *val) {
+    return read_head(dec, CBOR_UINT, val);
+}
+
+// Byte or text string: a pointer into the buffer, nothing is copied
+static bool read_string(cbor_decoder_t *dec, uint8_t major, const uint8_t **data, size_t *len) {
+    size_t start = dec->offset;
+    uint64_t l;
+    if (!read_head(dec, major, &l)) return false;
+    if (l > dec->size - dec->offset) {
+        dec->offset = start;
+        return false;
+    }
     *data = dec->buf + dec->offset;
-    *len = l;
-    dec->offset += l;
+    *len = (size_t)l;
+    dec->offset += (size_t)l;
     return true;
 }
 
+bool cbor_decode_bytes(cbor_decoder_t *dec, const uint8_t **data, size_t *len) {
+    return read_string(dec, CBOR_BYTES, data, len);
+}
+
 bool cbor_decode_text(cbor_decoder_t *dec, const char **text, size_t *len) {
-    uint8_t head = read_byte(dec);
-    uint8_t major = head & 0xE0;
-    uint8_t info = head & 0x1F;
-    
-    if (major != CBOR_TEXT) return false;
-    
-    size_t l = 0;
-    if (info < 24) {
-        l = info;
-    } else if (info == 24) {
-        l = read_byte(dec);
-    } else if (info == 25) {
-        l = ((size_t)read_byte(dec) << 8) | read_byte(dec);
-    }
-    
-    if (dec->offset + l > dec->size) return false;
-    
-    *text = (const char *)(dec->buf + dec->offset);
-    *len = l;
-    dec->offset += l;
-    return true;
+    return read_string(dec, CBOR_TEXT, (const uint8_t **)text, len);
 }
 
-bool cbor_decode_map_header(cbor_decoder_t *dec, size_t *size) {
-    uint8_t head = peek(dec);
-    uint8_t major = head & 0xE0;
-    uint8_t info = head & 0x1F;
-    
-    if (major != CBOR_MAP) return false;
-    read_byte(dec); // Consume head
-    
-    if (info < 24) {
-        *size = info;
-    } else if (info == 24) {
-        *size = read_byte(dec);
-    } else {
-        return false; // Simplified
+// Array or map header. Every item takes at least one byte, so a count
+// beyond what is left in the buffer is rejected up front.
+static bool read_container(cbor_decoder_t *dec, uint8_t major, size_t *size) {
+    size_t start = dec->offset;
+    uint64_t n;
+    if (!read_head(dec, major, &n)) return false;
+    uint64_t min_bytes = (major == CBOR_MAP) ? n * 2 : n;
+    if (n > SIZE_MAX / 2 || min_bytes > dec->size - dec->offset) {
+        dec->offset = start;
+        return false;
     }
+    *size = (size_t)n;
     return true;
 }
 
+bool cbor_decode_map_header(cbor_decoder_t *dec, size_t *size) {
+    return read_container(dec, CBOR_MAP, size);
+}
+
 bool cbor_decode_array_header(cbor_decoder_t *dec, size_t *size) {
+    return read_container(dec, CBOR_ARRAY, size);
+}
+
+bool cbor_decode_bool(cbor_decoder_t *dec, bool *val) {
     uint8_t head = peek(dec);
-    uint8_t major = head & 0xE0;
-    uint8_t info = head & 0x1F;
-    
-    if (major != CBOR_ARRAY) return false;
-    read_byte(dec); // Consume head
-    
-    if (info < 24) {
-        *size = info;
-    } else if (info == 24) {
-        *size = read_byte(dec);
-    } else {
-        return false; // Simplified
-    }
+    if (head != (CBOR_SIMPLE | CBOR_SIMPLE_TRUE) && head != (CBOR_SIMPLE | CBOR_SIMPLE_FALSE)) return false;
+    *val = (head == (CBOR_SIMPLE | CBOR_SIMPLE_TRUE));
+    dec->offset++;
     return true;
 }
 
@@ -199,3 +218,199 @@ int cbor_peek_major_type(cbor_decoder_t *dec) {
     if (head == 0xFF) return -1;
     return head & 0xE0;
 }
+
+bool cbor_decode_int(cbor_decoder_t *dec, int64_t *val) {
+    if (dec->offset >= dec->size) return false;
+    uint8_t major = dec->buf[dec->offset] & 0xE0;
+    if (major != CBOR_UINT && major != CBOR_NEGINT) return false;
+
+    size_t start = dec->offset;
+    uint64_t arg;
+    if (!read_head(dec, major, &arg)) return false;
+    if (arg > INT64_MAX) {
+        dec->offset = start;
+        return false;
+    }
+    *val = (major == CBOR_UINT) ? (int64_t)arg : -1 - (int64_t)arg;
+    return true;
+}
+
+static bool skip_item(cbor_decoder_t *dec, int depth) {
+    if (depth > CBOR_MAX_DEPTH || dec->offset >= dec->size) return false;
+
+    uint8_t head = dec->buf[dec->offset++];
+    uint8_t major = head & 0xE0;
+    uint64_t arg;
+    if (!read_arg(dec, head & 0x1F, &arg)) return false;
+
+    switch (major) {
+        case CBOR_UINT:
+        case CBOR_NEGINT:
+        case CBOR_SIMPLE:
+            return true;
+        case CBOR_BYTES:
+        case CBOR_TEXT:
+            if (arg > dec->size - dec->offset) return false;
+            dec->offset += arg;
+            return true;
+        case CBOR_ARRAY:
+        case CBOR_MAP: {
+            // Each item is at least one byte
+            if (arg > dec->size - dec->offset) return false;
+            uint64_t items = (major == CBOR_MAP) ? arg * 2 : arg;
+            for (uint64_t i = 0; i < items; i++) {
+                if (!skip_item(dec, depth + 1)) return false;
+            }
+            return true;
+        }
+        default: // CBOR_TAG
+            return skip_item(dec, depth + 1);
+    }
+}
+
+bool cbor_skip(cbor_decoder_t *dec) {
+    size_t start = dec->offset;
+    if (!skip_item(dec, 0)) {
+        dec->offset = start;
+        return false;
+    }
+    return true;
+}
+
+bool cbor_index_map(cbor_decoder_t *dec, cbor_map_index_t *index) {
+    size_t start = dec->offset;
+    size_t count;
+    index->count = 0;
+    index->buf = dec->buf;
+    if (!cbor_decode_map_header(dec, &count) || count > CBOR_INDEX_MAX_ENTRIES) goto fail;
+
+    for (size_t i = 0; i < count; i++) {
+        cbor_map_entry_t *e = &index->entries[i];
+        int major = cbor_peek_major_type(dec);
+        if (major == CBOR_UINT || major == CBOR_NEGINT) {
+            if (!cbor_decode_int(dec, &e->key)) goto fail;
+            e->key_text = NULL;
+            e->key_len = 0;
+        } else if (major == CBOR_TEXT) {
+            if (!cbor_decode_text(dec, &e->key_text, &e->key_len)) goto fail;
+            e->key = 0;
+        } else {
+            goto fail; // CTAP2 only uses integer and text keys
+        }
+
+        // Duplicate keys are not well-formed CTAP2
+        for (size_t j = 0; j < i; j++) {
+            const cbor_map_entry_t *p = &index->entries[j];
+            bool same = (p->key_text == NULL)
+                            ? (e->key_text == NULL && p->key == e->key)
+                            : (e->key_text != NULL && p->key_len == e->key_len &&
+                               memcmp(p->key_text, e->key_text, e->key_len) == 0);
+            if (same) goto fail;
+        }
+
+        e->offset = dec->offset;
+        e->type = (uint8_t)cbor_peek_major_type(dec);
+        if (!skip_item(dec, 1)) goto fail;
+        e->len = dec->offset - e->offset;
+        index->count++;
+    }
+    return true;
+
+fail:
+    index->count = 0;
+    dec->offset = start;
+    return false;
+}
+
+const cbor_map_entry_t *cbor_index_find(const cbor_map_index_t *index, int64_t key) {
+    for (size_t i = 0; i < index->count; i++) {
+        const cbor_map_entry_t *e = &index->entries[i];
+        if (e->key_text == NULL && e->key == key) return e;
+    }
+    return NULL;
+}
+
+const cbor_map_entry_t *cbor_index_find_text(const cbor_map_index_t *index, const char *key, size_t key_len) {
+    for (size_t i = 0; i < index->count; i++) {
+        const cbor_map_entry_t *e = &index->entries[i];
+        if (e->key_text && e->key_len == key_len && memcmp(e->key_text, key, key_len) == 0) return e;
+    }
+    return NULL;
+}
+
+void cbor_index_value(const cbor_map_index_t *index, const cbor_map_entry_t *entry, cbor_decoder_t *dec) {
+    cbor_decoder_init(dec, index->buf + entry->offset, entry->len);
+}
+
+static cbor_schema_result_t decode_field(cbor_decoder_t *dec, const cbor_field_t *f, uint8_t *out) {
+    int major = cbor_peek_major_type(dec);
+    switch (f->type) {
+        case CBOR_UINT:
+            if (major != CBOR_UINT) return CBOR_SCHEMA_TYPE;
+            return cbor_decode_uint(dec, (uint64_t *)(out + f->offset)) ? CBOR_SCHEMA_OK : CBOR_SCHEMA_MALFORMED;
+        case CBOR_FIELD_INT:
+            if (major != CBOR_UINT && major != CBOR_NEGINT) return CBOR_SCHEMA_TYPE;
+            return cbor_decode_int(dec, (int64_t *)(out + f->offset)) ? CBOR_SCHEMA_OK : CBOR_SCHEMA_MALFORMED;
+        case CBOR_FIELD_BOOL:
+            if (major != CBOR_SIMPLE) return CBOR_SCHEMA_TYPE;
+            return cbor_decode_bool(dec, (bool *)(out + f->offset)) ? CBOR_SCHEMA_OK : CBOR_SCHEMA_TYPE;
+        default:
+            break;
+    }
+
+    if (major != f->type) return CBOR_SCHEMA_TYPE;
+    cbor_item_t *item = (cbor_item_t *)(out + f->offset);
+    if (f->type == CBOR_BYTES || f->type == CBOR_TEXT) {
+        if (!read_string(dec, f->type, &item->data, &item->len)) return CBOR_SCHEMA_MALFORMED;
+        item->count = item->len;
+    } else {
+        // dec spans exactly this value, which indexing already skipped whole
+        size_t count;
+        if (!read_container(dec, f->type, &count)) return CBOR_SCHEMA_MALFORMED;
+        item->data = dec->buf;
+        item->len = dec->size;
+        item->count = count;
+    }
+    if (f->max_len && item->count > f->max_len) return CBOR_SCHEMA_LENGTH;
+    return CBOR_SCHEMA_OK;
+}
+
+cbor_schema_result_t cbor_decode_schema(cbor_decoder_t *dec, const cbor_field_t *fields, size_t field_count,
+                                        void *out, uint32_t *present) {
+    size_t start = dec->offset;
+    cbor_map_index_t index;
+    uint32_t found = 0;
+    cbor_schema_result_t res = CBOR_SCHEMA_MALFORMED;
+    if (field_count > CBOR_SCHEMA_MAX_FIELDS || !cbor_index_map(dec, &index)) goto fail;
+
+    // Fields read their values straight from the index; keys the schema
+    // does not name were checked well-formed and are otherwise ignored
+    for (size_t i = 0; i < field_count; i++) {
+        const cbor_field_t *f = &fields[i];
+        const cbor_map_entry_t *e = f->key_text ? cbor_index_find_text(&index, f->key_text, f->key_len)
+                                                : cbor_index_find(&index, f->key);
+        if (!e) continue;
+        cbor_decoder_t value;
+        cbor_index_value(&index, e, &value);
+        res = decode_field(&value, f, out);
+        if (res != CBOR_SCHEMA_OK) goto fail;
+        found |= 1u << i;
+    }
+
+    for (size_t i = 0; i < field_count; i++) {
+        if (fields[i].required && !(found & (1u << i))) {
+            res = CBOR_SCHEMA_MISSING;
+            goto fail;
+        }
+    }
+    if (present) *present = found;
+    return CBOR_SCHEMA_OK;
+
+fail:
+    dec->offset = start;
+    return res;
+}
+
+void cbor_item_decoder(const cbor_item_t *item, cbor_decoder_t *dec) {
+    cbor_decoder_init(dec, item->data, item->len);
+}
@@ -11,21 +11,42 @@
 #define CBOR_TEXT   0x60
 #define CBOR_ARRAY  0x80
 #define CBOR_MAP    0xA0
+#define CBOR_TAG    0xC0
+#define CBOR_SIMPLE 0xE0
 
-// Encoder
+#define CBOR_MAX_DEPTH  8 // Nesting limit for cbor_skip
+
+// Encoder. Writes past the end are not performed and latch enc->error;
+// offset keeps counting, so after a failed pass it is the size that was
+// needed. With a NULL buffer nothing is written at all: a sizing pass that
+// leaves the exact encoded length in offset.
 typedef struct {
     uint8_t *buf;
     size_t size;
     size_t offset;
+    bool error;
 } cbor_encoder_t;
 
+#define CBOR_SIMPLE_FALSE   20
+#define CBOR_SIMPLE_TRUE    21
+#define CBOR_SIMPLE_NULL    22
+
 void cbor_encoder_init(cbor_encoder_t *enc, uint8_t *buf, size_t size);
 void cbor_encode_uint(cbor_encoder_t *enc, uint64_t val);
 void cbor_encode_int(cbor_encoder_t *enc, int64_t val);
 void cbor_encode_bytes(cbor_encoder_t *enc, const uint8_t *data, size_t len);
-void cbor_encode_text(cbor_encoder_t *enc, const char *text);
+// Byte string head plus len bytes left for the caller to fill in place.
+// NULL when sizing or on overflow.
+uint8_t *cbor_encode_bytes_reserve(cbor_encoder_t *enc, size_t len);
+void cbor_encode_text_n(cbor_encoder_t *enc, const char *text, size_t len);
+void cbor_encode_text(cbor_encoder_t *enc, const char *text); // strlen() at runtime
+// String literal, length taken at compile time
+#define cbor_encode_text_lit(enc, lit) cbor_encode_text_n((enc), "" lit, sizeof(lit) - 1)
 void cbor_encode_map_start(cbor_encoder_t *enc, size_t len);
 void cbor_encode_array_start(cbor_encoder_t *enc, size_t len);
+void cbor_encode_simple(cbor_encoder_t *enc, uint8_t val);
+void cbor_encode_bool(cbor_encoder_t *enc, bool val);
+void cbor_encode_null(cbor_encoder_t *enc);
 
 // Decoder (Simplified for FIDO2 flat maps)
 typedef struct {
@@ -36,8 +57,93 @@ typedef struct {
 
 void cbor_decoder_init(cbor_decoder_t *dec, const uint8_t *buf, size_t size);
 bool cbor_decode_uint(cbor_decoder_t *dec, uint64_t *val);
+// Unsigned or negative integer that fits in int64_t (COSE algorithm identifiers etc.)
+bool cbor_decode_int(cbor_decoder_t *dec, int64_t *val);
 bool cbor_decode_bytes(cbor_decoder_t *dec, const uint8_t **data, size_t *len);
 bool cbor_decode_text(cbor_decoder_t *dec, const char **text, size_t *len);
 bool cbor_decode_map_header(cbor_decoder_t *dec, size_t *size);
 bool cbor_decode_array_header(cbor_decoder_t *dec, size_t *size);
+bool cbor_decode_bool(cbor_decoder_t *dec, bool *val);
 int cbor_peek_major_type(cbor_decoder_t *dec);
+// Skip one complete data item, including nested arrays/maps (definite length
+// only, at most CBOR_MAX_DEPTH levels). On failure nothing is consumed.
+bool cbor_skip(cbor_decoder_t *dec);
+
+// Map index: one pass over a map records where each value sits, so a
+// handler can read its fields in any order, straight from the request
+// buffer. Every value is fully skipped (checked well-formed) while indexing.
+#define CBOR_INDEX_MAX_ENTRIES  16
+
+typedef struct {
+    int64_t key;            // Integer key (key_text == NULL)
+    const char *key_text;   // Text key, not NUL-terminated
+    size_t key_len;
+    size_t offset;          // Value: head offset in the indexed buffer
+    size_t len;             // Value: encoded length, head included
+    uint8_t type;           // Value: major type (CBOR_UINT, CBOR_MAP...)
+} cbor_map_entry_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t count;
+    cbor_map_entry_t entries[CBOR_INDEX_MAX_ENTRIES];
+} cbor_map_index_t;
+
+// Index the map at the decoder position and move past it. Fails (consuming
+// nothing) on malformed CBOR, keys that are not integers or text, duplicate
+// keys, or more than CBOR_INDEX_MAX_ENTRIES entries.
+bool cbor_index_map(cbor_decoder_t *dec, cbor_map_index_t *index);
+const cbor_map_entry_t *cbor_index_find(const cbor_map_index_t *index, int64_t key);
+const cbor_map_entry_t *cbor_index_find_text(const cbor_map_index_t *index, const char *key, size_t key_len);
+// A decoder over exactly one indexed value
+void cbor_index_value(const cbor_map_index_t *index, const cbor_map_entry_t *entry, cbor_decoder_t *dec);
+
+// Schema decoding: a table of expected map fields is looked up in the map's
+// index, filling a typed request struct. Each field names its key (integer
+// or text), the type it must have, whether it is required, where its value
+// goes and how long it may be. Unknown keys are skipped; a repeated key, or
+// more than CBOR_INDEX_MAX_ENTRIES keys, is malformed.
+#define CBOR_FIELD_INT      0x01 // Pseudo type: CBOR_UINT or CBOR_NEGINT
+#define CBOR_FIELD_BOOL     0x02 // Pseudo type: simple true/false
+#define CBOR_SCHEMA_MAX_FIELDS  32
+
+// Destination of CBOR_BYTES/TEXT/ARRAY/MAP fields, pointing into the input.
+// Strings: the contents, count == len. Arrays and maps: the whole encoded
+// value, head included (already checked well-formed), and its item count
+// (pairs for maps). data stays NULL if the field was absent.
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t count;
+} cbor_item_t;
+
+typedef struct {
+    int64_t key;            // Integer key (key_text == NULL)
+    const char *key_text;   // Text key
+    uint8_t key_len;
+    uint8_t type;           // CBOR_UINT (uint64_t), CBOR_FIELD_INT (int64_t),
+                            // CBOR_FIELD_BOOL (bool), otherwise cbor_item_t
+    bool required;
+    uint16_t offset;        // Destination in the output struct
+    uint16_t max_len;       // Strings: bytes, arrays/maps: items, 0 = no limit
+} cbor_field_t;
+
+#define CBOR_FIELD(key, type, required, st, member, max_len) \
+    {(key), NULL, 0, (type), (required), offsetof(st, member), (max_len)}
+#define CBOR_TEXT_FIELD(name, type, required, st, member, max_len) \
+    {0, "" name, sizeof(name) - 1, (type), (required), offsetof(st, member), (max_len)}
+
+typedef enum {
+    CBOR_SCHEMA_OK = 0,
+    CBOR_SCHEMA_MALFORMED,  // Not well-formed, or a duplicate key
+    CBOR_SCHEMA_MISSING,    // A required field is absent
+    CBOR_SCHEMA_TYPE,       // A known field has the wrong type
+    CBOR_SCHEMA_LENGTH,     // A known field exceeds its max_len
+} cbor_schema_result_t;
+
+// Decode the map at the decoder position into out. present (optional) gets
+// one bit per schema field that was found. Consumes nothing on failure.
+cbor_schema_result_t cbor_decode_schema(cbor_decoder_t *dec, const cbor_field_t *fields, size_t field_count,
+                                        void *out, uint32_t *present);
+// A decoder over an array/map field, positioned on its head
+void cbor_item_decoder(const cbor_item_t *item, cbor_decoder_t *dec);
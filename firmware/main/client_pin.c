@@ -0,0 +1,225 @@
+#include "client_pin.h"
+#include "ctap2.h"
+#include "crypto_hal.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include <string.h>
+
+static const char *TAG = "CLIENT_PIN";
+
+#define PIN_HASH_SIZE       16
+#define PADDED_PIN_SIZE     64
+
+static bool pin_set = false;
+static uint8_t pin_hash[PIN_HASH_SIZE];     // LEFT(SHA-256(PIN), 16)
+static uint8_t retries = CLIENT_PIN_MAX_RETRIES;
+static uint8_t consecutive = 0;             // Mismatches since boot or the last match
+static uint8_t pin_token[CLIENT_PIN_TOKEN_SIZE];
+
+// Key agreement key, replaced after every mismatch
+static bool ka_ready = false;
+static uint8_t ka_priv[32];
+static uint8_t ka_pub[65];
+
+static const uint8_t zero_iv[16] = {0};
+
+void client_pin_init(void) {
+    nvs_handle_t handle;
+    if (nvs_open("storage", NVS_READONLY, &handle) == ESP_OK) {
+        size_t len = PIN_HASH_SIZE;
+        pin_set = nvs_get_blob(handle, "pin_hash", pin_hash, &len) == ESP_OK && len == PIN_HASH_SIZE;
+        uint32_t stored;
+        if (nvs_get_u32(handle, "pin_retries", &stored) == ESP_OK && stored <= CLIENT_PIN_MAX_RETRIES) {
+            retries = (uint8_t)stored;
+        }
+        nvs_close(handle);
+    }
+    hal_rng_generate(pin_token, sizeof(pin_token));
+    ESP_LOGI(TAG, "PIN %s, %u retries", pin_set ? "set" : "not set", retries);
+}
+
+bool client_pin_is_set(void) {
+    return pin_set;
+}
+
+uint8_t client_pin_retries(void) {
+    return retries;
+}
+
+// Written before the outcome is reported, so pulling the plug mid-attempt
+// still costs a retry
+static uint8_t save_state(void) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, "pin_hash", pin_hash, PIN_HASH_SIZE);
+        if (err == ESP_OK) err = nvs_set_u32(handle, "pin_retries", retries);
+        if (err == ESP_OK) err = nvs_commit(handle);
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) saving PIN state", esp_err_to_name(err));
+        return CTAP2_ERR_OTHER;
+    }
+    return CTAP2_OK;
+}
+
+static uint8_t ensure_key_agreement(void) {
+    if (!ka_ready) {
+        if (hal_ecc_take_keypair(ka_priv, ka_pub) != 0) return CTAP2_ERR_OTHER;
+        ka_ready = true;
+    }
+    return CTAP2_OK;
+}
+
+uint8_t client_pin_key_agreement(uint8_t public_key[65]) {
+    uint8_t status = ensure_key_agreement();
+    if (status == CTAP2_OK) memcpy(public_key, ka_pub, 65);
+    return status;
+}
+
+// sharedSecret = SHA-256(x of ECDH(key agreement key, platform key))
+static uint8_t shared_secret(const uint8_t *platform_key, uint8_t secret[32]) {
+    uint8_t status = ensure_key_agreement();
+    if (status != CTAP2_OK) return status;
+    uint8_t x[32];
+    if (hal_ecdh_p256(ka_priv, platform_key, x) != 0) return CTAP2_ERR_INVALID_PARAMETER;
+    hal_sha256(x, sizeof(x), secret);
+    memset(x, 0, sizeof(x));
+    return CTAP2_OK;
+}
+
+// LEFT(HMAC-SHA-256(key, msg), 16) == pin_auth, without an early exit
+static bool auth_matches(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t msg_len,
+                         const uint8_t *pin_auth, size_t pin_auth_len) {
+    if (pin_auth_len != CLIENT_PIN_AUTH_SIZE) return false;
+    uint8_t mac[32];
+    if (hal_hmac_sha256(key, key_len, msg, msg_len, mac) != 0) return false;
+    uint8_t diff = 0;
+    for (int i = 0; i < CLIENT_PIN_AUTH_SIZE; i++) {
+        diff |= mac[i] ^ pin_auth[i];
+    }
+    memset(mac, 0, sizeof(mac));
+    return diff == 0;
+}
+
+// Entering PIN after PIN: blocked for good once retries run out, until the
+// next power cycle after CLIENT_PIN_MAX_CONSECUTIVE misses in a row
+static uint8_t check_blocked(void) {
+    if (retries == 0) return CTAP2_ERR_PIN_BLOCKED;
+    if (consecutive >= CLIENT_PIN_MAX_CONSECUTIVE) return CTAP2_ERR_PIN_AUTH_BLOCKED;
+    return CTAP2_OK;
+}
+
+// pinHashEnc against the stored hash. The retry is spent before comparing
+// and given back on a match.
+static uint8_t check_pin_hash(const uint8_t *secret, const uint8_t *pin_hash_enc, size_t pin_hash_enc_len) {
+    if (pin_hash_enc_len != PIN_HASH_SIZE) return CTAP2_ERR_INVALID_PARAMETER;
+    retries--;
+    uint8_t status = save_state();
+    if (status != CTAP2_OK) return status;
+
+    uint8_t hash[PIN_HASH_SIZE];
+    if (hal_aes_cbc_decrypt(secret, zero_iv, pin_hash_enc, PIN_HASH_SIZE, hash) != 0) return CTAP2_ERR_OTHER;
+    uint8_t diff = 0;
+    for (int i = 0; i < PIN_HASH_SIZE; i++) {
+        diff |= hash[i] ^ pin_hash[i];
+    }
+    memset(hash, 0, sizeof(hash));
+
+    if (diff != 0) {
+        consecutive++;
+        ka_ready = false;
+        memset(ka_priv, 0, sizeof(ka_priv));
+        status = check_blocked();
+        return status != CTAP2_OK ? status : CTAP2_ERR_PIN_INVALID;
+    }
+    consecutive = 0;
+    retries = CLIENT_PIN_MAX_RETRIES;
+    return save_state();
+}
+
+// newPinEnc: the PIN, zero padded to 64 bytes. Setting it also ends every
+// pinToken handed out before.
+static uint8_t store_new_pin(const uint8_t *secret, const uint8_t *new_pin_enc, size_t new_pin_enc_len) {
+    if (new_pin_enc_len != PADDED_PIN_SIZE) return CTAP2_ERR_PIN_POLICY_VIOLATION;
+    uint8_t padded[PADDED_PIN_SIZE];
+    if (hal_aes_cbc_decrypt(secret, zero_iv, new_pin_enc, PADDED_PIN_SIZE, padded) != 0) return CTAP2_ERR_OTHER;
+    size_t len = 0;
+    while (len < PADDED_PIN_SIZE && padded[len] != 0) len++;
+    uint8_t status = CTAP2_ERR_PIN_POLICY_VIOLATION;
+    if (len >= CLIENT_PIN_MIN_LENGTH && len < PADDED_PIN_SIZE) {
+        uint8_t digest[32];
+        hal_sha256(padded, len, digest);
+        memcpy(pin_hash, digest, PIN_HASH_SIZE);
+        memset(digest, 0, sizeof(digest));
+        retries = CLIENT_PIN_MAX_RETRIES;
+        status = save_state();
+        if (status == CTAP2_OK) {
+            pin_set = true;
+            hal_rng_generate(pin_token, sizeof(pin_token));
+        }
+    }
+    memset(padded, 0, sizeof(padded));
+    return status;
+}
+
+uint8_t client_pin_set(const uint8_t *platform_key, const uint8_t *pin_auth, size_t pin_auth_len,
+                       const uint8_t *new_pin_enc, size_t new_pin_enc_len) {
+    if (pin_set) return CTAP2_ERR_PIN_AUTH_INVALID;
+    uint8_t secret[32];
+    uint8_t status = shared_secret(platform_key, secret);
+    if (status == CTAP2_OK && !auth_matches(secret, 32, new_pin_enc, new_pin_enc_len, pin_auth, pin_auth_len)) {
+        status = CTAP2_ERR_PIN_AUTH_INVALID;
+    }
+    if (status == CTAP2_OK) status = store_new_pin(secret, new_pin_enc, new_pin_enc_len);
+    memset(secret, 0, sizeof(secret));
+    return status;
+}
+
+uint8_t client_pin_change(const uint8_t *platform_key, const uint8_t *pin_auth, size_t pin_auth_len,
+                          const uint8_t *new_pin_enc, size_t new_pin_enc_len,
+                          const uint8_t *pin_hash_enc, size_t pin_hash_enc_len) {
+    if (!pin_set) return CTAP2_ERR_PIN_NOT_SET;
+    uint8_t status = check_blocked();
+    if (status != CTAP2_OK) return status;
+    if (new_pin_enc_len != PADDED_PIN_SIZE || pin_hash_enc_len != PIN_HASH_SIZE) {
+        return CTAP2_ERR_INVALID_PARAMETER;
+    }
+
+    // pinAuth covers newPinEnc || pinHashEnc
+    uint8_t msg[PADDED_PIN_SIZE + PIN_HASH_SIZE];
+    memcpy(msg, new_pin_enc, PADDED_PIN_SIZE);
+    memcpy(&msg[PADDED_PIN_SIZE], pin_hash_enc, PIN_HASH_SIZE);
+    uint8_t secret[32];
+    status = shared_secret(platform_key, secret);
+    if (status == CTAP2_OK && !auth_matches(secret, 32, msg, sizeof(msg), pin_auth, pin_auth_len)) {
+        status = CTAP2_ERR_PIN_AUTH_INVALID;
+    }
+    if (status == CTAP2_OK) status = check_pin_hash(secret, pin_hash_enc, pin_hash_enc_len);
+    if (status == CTAP2_OK) status = store_new_pin(secret, new_pin_enc, new_pin_enc_len);
+    memset(secret, 0, sizeof(secret));
+    return status;
+}
+
+uint8_t client_pin_get_token(const uint8_t *platform_key, const uint8_t *pin_hash_enc, size_t pin_hash_enc_len,
+                             uint8_t token_enc[CLIENT_PIN_TOKEN_SIZE]) {
+    if (!pin_set) return CTAP2_ERR_PIN_NOT_SET;
+    uint8_t status = check_blocked();
+    if (status != CTAP2_OK) return status;
+    uint8_t secret[32];
+    status = shared_secret(platform_key, secret);
+    if (status == CTAP2_OK) status = check_pin_hash(secret, pin_hash_enc, pin_hash_enc_len);
+    if (status == CTAP2_OK &&
+        hal_aes_cbc_encrypt(secret, zero_iv, pin_token, CLIENT_PIN_TOKEN_SIZE, token_enc) != 0) {
+        status = CTAP2_ERR_OTHER;
+    }
+    memset(secret, 0, sizeof(secret));
+    return status;
+}
+
+uint8_t client_pin_verify(const uint8_t *msg, size_t msg_len, const uint8_t *pin_auth, size_t pin_auth_len) {
+    if (!pin_set) return CTAP2_ERR_PIN_NOT_SET;
+    return auth_matches(pin_token, sizeof(pin_token), msg, msg_len, pin_auth, pin_auth_len)
+               ? CTAP2_OK : CTAP2_ERR_PIN_AUTH_INVALID;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// authenticatorClientPIN, PIN protocol 1 (CTAP 2.0): the platform agrees a
+// shared secret with the authenticator's key agreement key (ECDH P-256,
+// SHA-256 of the x coordinate), sends the PIN and its hash AES-256-CBC
+// encrypted under it with a zero IV, and gets back a pinToken. Commands it
+// authorizes carry LEFT(HMAC-SHA-256(pinToken, message), 16).
+//
+// The PIN itself is never stored: NVS keeps LEFT(SHA-256(PIN), 16) and the
+// retries left. The pinToken is random per boot.
+//
+// Functions return CTAP2 status codes. Only the protocol worker task calls
+// them.
+#define CLIENT_PIN_PROTOCOL         1
+#define CLIENT_PIN_MAX_RETRIES      8
+// Consecutive mismatches that block PIN entry until the next power cycle
+#define CLIENT_PIN_MAX_CONSECUTIVE  3
+#define CLIENT_PIN_MIN_LENGTH       4
+#define CLIENT_PIN_AUTH_SIZE        16
+#define CLIENT_PIN_TOKEN_SIZE       32
+
+// COSE algorithm the key agreement key is labelled with (ECDH-ES+HKDF-256)
+#define CLIENT_PIN_COSE_ALG         (-25)
+
+// Load the PIN state from NVS and draw this boot's pinToken
+void client_pin_init(void);
+
+bool client_pin_is_set(void);
+uint8_t client_pin_retries(void);
+
+// The key agreement public key (0x04 | X | Y), generated on first use
+uint8_t client_pin_key_agreement(uint8_t public_key[65]);
+
+// setPIN: platform_key is the platform's key agreement key (0x04 | X | Y),
+// pin_auth covers new_pin_enc
+uint8_t client_pin_set(const uint8_t *platform_key, const uint8_t *pin_auth, size_t pin_auth_len,
+                       const uint8_t *new_pin_enc, size_t new_pin_enc_len);
+
+// changePIN: pin_auth covers new_pin_enc || pin_hash_enc
+uint8_t client_pin_change(const uint8_t *platform_key, const uint8_t *pin_auth, size_t pin_auth_len,
+                          const uint8_t *new_pin_enc, size_t new_pin_enc_len,
+                          const uint8_t *pin_hash_enc, size_t pin_hash_enc_len);
+
+// getPINToken: the pinToken, encrypted for the platform
+uint8_t client_pin_get_token(const uint8_t *platform_key, const uint8_t *pin_hash_enc, size_t pin_hash_enc_len,
+                             uint8_t token_enc[CLIENT_PIN_TOKEN_SIZE]);
+
+// Check a pinAuth over msg against the current pinToken
+uint8_t client_pin_verify(const uint8_t *msg, size_t msg_len, const uint8_t *pin_auth, size_t pin_auth_len);
@@ -0,0 +1,371 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "counter_store.h"
+
+static const char *TAG = "COUNTER_STORE";
+
+// Journal layout: 4 KB sectors of 16-byte records. Record 0 is the sector
+// header; a sector opens with a snapshot of every counter followed by a
+// SNAPSHOT_END record, then takes ceiling updates until full. Replay takes
+// the highest ceiling seen per counter, so it does not depend on order and
+// a torn record (bad CRC) only loses a ceiling that was never relied on.
+#define SECTOR_SIZE         4096
+#define RECORD_SIZE         16
+#define RECORDS             (SECTOR_SIZE / RECORD_SIZE)
+#define MAX_SECTORS         16
+
+#define SECTOR_MAGIC        0x31524346 // "FCR1"
+#define SNAPSHOT_END        0xFFFFFFFE // Record id: the snapshot before it is complete
+#define ERASED_WORD         0xFFFFFFFF
+
+typedef struct __attribute__((packed)) {
+    uint32_t id;            // Counter, or SECTOR_MAGIC in the header
+    uint32_t value;         // Ceiling, or the sector sequence number in the header
+    uint32_t reserved;
+    uint32_t crc;           // Over the first 12 bytes
+} journal_record_t;
+
+_Static_assert(sizeof(journal_record_t) == RECORD_SIZE, "record size");
+
+typedef enum {
+    SECTOR_FREE = 0,        // Erased
+    SECTOR_LIVE,            // Holds records still needed
+    SECTOR_STALE,           // Retired by a later snapshot, or garbage
+} sector_state_t;
+
+typedef struct {
+    bool used;
+    uint32_t id;
+    uint32_t value;         // Last value handed out
+    uint32_t durable;       // Ceiling on flash: nothing above it was handed out
+    uint32_t target;        // Ceiling to write next; pending while above durable
+    uint32_t last_used;
+} counter_t;
+
+static const esp_partition_t *part = NULL;
+static size_t sector_count = 0;
+static sector_state_t sector_state[MAX_SECTORS];
+static uint32_t sector_seq[MAX_SECTORS];
+static uint32_t max_seq = 0;
+static int head_sector = -1;
+static int head_record = RECORDS;
+
+static counter_t counters[1 + COUNTER_STORE_MAX_CREDS]; // [0] is COUNTER_GLOBAL
+static uint32_t use_clock = 0;
+static counter_store_stats_t stats;
+
+static uint32_t record_crc(const journal_record_t *r) {
+    return esp_rom_crc32_le(0, (const uint8_t *)r, offsetof(journal_record_t, crc));
+}
+
+static bool record_erased(const journal_record_t *r) {
+    return r->id == ERASED_WORD && r->value == ERASED_WORD && r->reserved == ERASED_WORD && r->crc == ERASED_WORD;
+}
+
+static uint32_t max3(uint32_t a, uint32_t b, uint32_t c) {
+    uint32_t m = a > b ? a : b;
+    return m > c ? m : c;
+}
+
+// --- Counters ---
+
+static counter_t *find_counter(uint32_t id) {
+    if (id == COUNTER_GLOBAL) return &counters[0];
+    for (int i = 1; i <= COUNTER_STORE_MAX_CREDS; i++) {
+        if (counters[i].used && counters[i].id == id) return &counters[i];
+    }
+    return NULL;
+}
+
+// A free entry, or the least recently used one folded into the global
+// counter: anything it handed out is then below the global ceiling
+static counter_t *alloc_counter(uint32_t id) {
+    counter_t *g = &counters[0];
+    counter_t *c = NULL;
+    for (int i = 1; i <= COUNTER_STORE_MAX_CREDS; i++) {
+        if (!counters[i].used) {
+            c = &counters[i];
+            break;
+        }
+        if (!c || counters[i].last_used < c->last_used) c = &counters[i];
+    }
+    if (c->used) {
+        uint32_t top = max3(c->value, c->durable, c->target);
+        if (top > g->target) g->target = top;
+    }
+
+    // Starts where a previous life of this counter could have reached at most
+    uint32_t start = max3(g->value, g->durable, g->target);
+    memset(c, 0, sizeof(*c));
+    c->used = true;
+    c->id = id;
+    c->value = c->durable = c->target = start;
+    return c;
+}
+
+// Replay: the highest ceiling wins. Counters the table has no room for
+// go into the global one.
+static void merge_ceiling(uint32_t id, uint32_t ceiling) {
+    counter_t *c = find_counter(id);
+    if (!c) {
+        for (int i = 1; i <= COUNTER_STORE_MAX_CREDS && !c; i++) {
+            if (!counters[i].used) {
+                c = &counters[i];
+                c->used = true;
+                c->id = id;
+            }
+        }
+        if (!c) c = &counters[0];
+    }
+    if (ceiling > c->durable) c->value = c->durable = c->target = ceiling;
+}
+
+// --- Journal ---
+
+static esp_err_t erase_sector(int s) {
+    esp_err_t err = esp_partition_erase_range(part, (size_t)s * SECTOR_SIZE, SECTOR_SIZE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Erase of sector %d failed: %s", s, esp_err_to_name(err));
+        return err;
+    }
+    sector_state[s] = SECTOR_FREE;
+    stats.sectors_erased++;
+    return ESP_OK;
+}
+
+static esp_err_t write_raw(uint32_t id, uint32_t value) {
+    journal_record_t r = {.id = id, .value = value, .reserved = ERASED_WORD};
+    r.crc = record_crc(&r);
+    size_t offset = (size_t)head_sector * SECTOR_SIZE + (size_t)head_record * RECORD_SIZE;
+    head_record++; // A failed write still leaves the record programmed
+    esp_err_t err = esp_partition_write(part, offset, &r, sizeof(r));
+    if (err == ESP_OK) stats.records_written++;
+    return err;
+}
+
+static int ring_next(void) {
+    return head_sector < 0 ? 0 : (head_sector + 1) % (int)sector_count;
+}
+
+// Move to the next sector of the ring and snapshot every counter into it.
+// Sectors before it are only retired once the snapshot is complete.
+static esp_err_t open_sector(void) {
+    // Past any sector still needed, should earlier snapshots have been cut short
+    int s = ring_next();
+    for (size_t n = 0; sector_state[s] == SECTOR_LIVE; n++) {
+        if (n == sector_count) return ESP_ERR_NO_MEM;
+        s = (s + 1) % (int)sector_count;
+    }
+    if (sector_state[s] != SECTOR_FREE) {
+        stats.sync_erases++;
+        esp_err_t err = erase_sector(s);
+        if (err != ESP_OK) return err;
+    }
+
+    head_sector = s;
+    head_record = 0;
+    sector_state[s] = SECTOR_LIVE;
+    sector_seq[s] = ++max_seq;
+    esp_err_t err = write_raw(SECTOR_MAGIC, sector_seq[s]);
+    for (int i = 0; i <= COUNTER_STORE_MAX_CREDS && err == ESP_OK; i++) {
+        counter_t *c = &counters[i];
+        if (!c->used) continue;
+        uint32_t ceiling = c->target > c->durable ? c->target : c->durable;
+        err = write_raw(c->id, ceiling);
+        if (err == ESP_OK) c->durable = ceiling;
+    }
+    if (err == ESP_OK) err = write_raw(SNAPSHOT_END, sector_seq[s]);
+    if (err != ESP_OK) {
+        sector_state[s] = SECTOR_STALE; // Older sectors still hold everything
+        head_record = RECORDS;
+        return err;
+    }
+
+    stats.snapshots++;
+    for (size_t t = 0; t < sector_count; t++) {
+        if ((int)t != s && sector_state[t] == SECTOR_LIVE) sector_state[t] = SECTOR_STALE;
+    }
+    return ESP_OK;
+}
+
+// Put a counter's target ceiling on flash
+static esp_err_t write_ceiling(counter_t *c) {
+    if (head_sector < 0 || head_record >= RECORDS) {
+        esp_err_t err = open_sector(); // The snapshot covers c as well
+        if (err != ESP_OK) return err;
+    }
+    if (c->target <= c->durable) return ESP_OK;
+    esp_err_t err = write_raw(c->id, c->target);
+    if (err == ESP_OK) c->durable = c->target;
+    return err;
+}
+
+static void reserve_ahead(counter_t *c, uint32_t from) {
+    uint32_t want = from > UINT32_MAX - COUNTER_STORE_RESERVE ? UINT32_MAX : from + COUNTER_STORE_RESERVE;
+    if (want > c->target) c->target = want;
+}
+
+// --- API ---
+
+esp_err_t counter_store_init(void) {
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, COUNTER_STORE_PARTITION);
+    if (!part) {
+        ESP_LOGE(TAG, "No '%s' partition", COUNTER_STORE_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    sector_count = part->size / SECTOR_SIZE;
+    if (sector_count > MAX_SECTORS) sector_count = MAX_SECTORS;
+    if (sector_count < 3) { // The sector being opened, the one it replaces, and the head
+        ESP_LOGE(TAG, "Partition too small (%u sectors)", (unsigned)sector_count);
+        part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memset(counters, 0, sizeof(counters));
+    counters[0].used = true;
+    counters[0].id = COUNTER_GLOBAL;
+    memset(&stats, 0, sizeof(stats));
+    max_seq = 0;
+    head_sector = -1;
+    head_record = RECORDS;
+
+    // Headers first: the newest sector with a complete snapshot is the base,
+    // anything older is stale
+    journal_record_t r;
+    uint32_t base_seq = 0;
+    for (size_t s = 0; s < sector_count; s++) {
+        sector_state[s] = SECTOR_STALE;
+        if (esp_partition_read(part, s * SECTOR_SIZE, &r, sizeof(r)) != ESP_OK) continue;
+        if (r.id == SECTOR_MAGIC && r.crc == record_crc(&r)) {
+            sector_state[s] = SECTOR_LIVE;
+            sector_seq[s] = r.value;
+            if (r.value > max_seq) max_seq = r.value;
+            for (int i = 1; i < RECORDS; i++) {
+                if (esp_partition_read(part, s * SECTOR_SIZE + i * RECORD_SIZE, &r, sizeof(r)) != ESP_OK) break;
+                if (r.id == SNAPSHOT_END && r.crc == record_crc(&r)) {
+                    if (sector_seq[s] > base_seq) base_seq = sector_seq[s];
+                    break;
+                }
+            }
+        } else if (record_erased(&r)) {
+            // Erased throughout, or an erase that was cut short
+            bool erased = true;
+            for (int i = 1; erased && i < RECORDS; i++) {
+                erased = esp_partition_read(part, s * SECTOR_SIZE + i * RECORD_SIZE, &r, sizeof(r)) == ESP_OK &&
+                         record_erased(&r);
+            }
+            if (erased) sector_state[s] = SECTOR_FREE;
+        }
+    }
+
+    // Replay the base and anything newer
+    bool head_complete = false;
+    for (size_t s = 0; s < sector_count; s++) {
+        if (sector_state[s] != SECTOR_LIVE) continue;
+        if (sector_seq[s] < base_seq) {
+            sector_state[s] = SECTOR_STALE;
+            continue;
+        }
+        int end = 1;
+        bool complete = false;
+        for (int i = 1; i < RECORDS; i++) {
+            if (esp_partition_read(part, s * SECTOR_SIZE + i * RECORD_SIZE, &r, sizeof(r)) != ESP_OK) break;
+            if (record_erased(&r)) continue;
+            end = i + 1;
+            if (r.crc != record_crc(&r)) continue;
+            if (r.id == SNAPSHOT_END) {
+                complete = true;
+            } else {
+                merge_ceiling(r.id, r.value);
+            }
+        }
+        if (sector_seq[s] == max_seq) {
+            head_sector = (int)s;
+            head_record = end;
+            head_complete = complete;
+        }
+    }
+
+    // A fresh journal, or a snapshot cut short: start a new sector now
+    if (!head_complete) {
+        if (head_sector < 0) head_sector = (int)sector_count - 1; // Ring starts at 0
+        esp_err_t err = open_sector();
+        if (err != ESP_OK) {
+            part = NULL;
+            return err;
+        }
+    }
+
+    // The first authentication after boot should not wait for a write either
+    reserve_ahead(&counters[0], counters[0].durable);
+    counter_store_commit();
+
+    ESP_LOGI(TAG, "Global counter %lu, sector %d record %d", (unsigned long)counters[0].value, head_sector,
+             head_record);
+    return ESP_OK;
+}
+
+uint32_t counter_store_next(uint32_t id) {
+    if (!part) return 0;
+    counter_t *c = find_counter(id);
+    if (!c) c = alloc_counter(id);
+
+    // Never below the global counter, so a credential also used over U2F
+    // keeps counting up
+    uint32_t base = c->value;
+    if (id != COUNTER_GLOBAL && counters[0].value > base) base = counters[0].value;
+    if (base == UINT32_MAX) return 0;
+
+    // Reservation used up before a commit: this request waits for the write
+    if (base >= c->durable) {
+        reserve_ahead(c, base);
+        stats.sync_commits++;
+        if (write_ceiling(c) != ESP_OK) return 0;
+    }
+    c->value = base + 1;
+    c->last_used = ++use_clock;
+    if (c->durable - c->value <= COUNTER_STORE_LOW_WATER) reserve_ahead(c, c->durable);
+    return c->value;
+}
+
+esp_err_t counter_store_raise(uint32_t id, uint32_t value) {
+    if (!part) return ESP_ERR_INVALID_STATE;
+    counter_t *c = find_counter(id);
+    if (!c) c = alloc_counter(id);
+    if (value <= c->value) return ESP_OK;
+    c->value = value;
+    if (value > c->target) c->target = value;
+    return write_ceiling(c);
+}
+
+uint32_t counter_store_cred_id(const uint8_t *cred_id, size_t len) {
+    uint32_t id = esp_rom_crc32_le(0, cred_id, len);
+    // A collision only makes two credentials share a counter
+    return (id == COUNTER_GLOBAL || id >= SNAPSHOT_END) ? 1 : id;
+}
+
+bool counter_store_commit(void) {
+    if (!part) return false;
+    bool wrote = false;
+    for (int i = 0; i <= COUNTER_STORE_MAX_CREDS; i++) {
+        counter_t *c = &counters[i];
+        if (!c->used || c->target <= c->durable) continue;
+        if (write_ceiling(c) != ESP_OK) break;
+        stats.async_commits++;
+        wrote = true;
+    }
+    return wrote;
+}
+
+bool counter_store_maintain(void) {
+    if (!part) return false;
+    int s = ring_next();
+    if (s == head_sector || sector_state[s] != SECTOR_STALE) return false;
+    return erase_sector(s) == ESP_OK;
+}
+
+void counter_store_get_stats(counter_store_stats_t *out) {
+    *out = stats;
+}
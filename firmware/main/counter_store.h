@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Signature counters, journaled on their own flash partition. A counter
+// only hands out values below a ceiling already on flash; the next ceiling
+// is reserved ahead and written by counter_store_commit() after the
+// response, so an authentication normally does no flash write at all.
+// After a restart each counter resumes from its ceiling, skipping whatever
+// was reserved but not used, so no value is ever given out twice.
+//
+// Records are 16 bytes, appended around a ring of sectors. Opening a
+// sector starts it with a snapshot of every counter, which retires the
+// sectors before it; counter_store_maintain() erases the next one ahead.
+//
+// Only the protocol worker task uses the store; it has no lock of its own.
+#define COUNTER_STORE_PARTITION     "fido_ctr"
+
+// The U2F counter. Per-credential counters never fall below it.
+#define COUNTER_GLOBAL              0
+
+// Per-credential counters kept; the least recently used one is folded into
+// the global counter to make room
+#ifndef COUNTER_STORE_MAX_CREDS
+#define COUNTER_STORE_MAX_CREDS     32
+#endif
+
+// Values reserved per ceiling record, and how close to the ceiling the next
+// reservation is queued
+#ifndef COUNTER_STORE_RESERVE
+#define COUNTER_STORE_RESERVE       32
+#endif
+#define COUNTER_STORE_LOW_WATER     (COUNTER_STORE_RESERVE / 2)
+
+typedef struct {
+    uint32_t records_written;   // Ceiling records, snapshots included
+    uint32_t sync_commits;      // Written while a request waited
+    uint32_t async_commits;     // Written by counter_store_commit()
+    uint32_t snapshots;         // Sectors opened
+    uint32_t sectors_erased;
+    uint32_t sync_erases;       // Erases a request had to wait for
+} counter_store_stats_t;
+
+// Mount the partition and resume every counter from its ceiling
+esp_err_t counter_store_init(void);
+
+// Next value of a counter, 0 if no ceiling could be written for it
+uint32_t counter_store_next(uint32_t id);
+
+// Make sure a counter never returns value or less (e.g. one carried over
+// from NVS). Written before this returns.
+esp_err_t counter_store_raise(uint32_t id, uint32_t value);
+
+// Counter ID for a credential, never COUNTER_GLOBAL
+uint32_t counter_store_cred_id(const uint8_t *cred_id, size_t len);
+
+// Write the reservations queued by counter_store_next(). Cheap; call it
+// once the response has gone out. True if it wrote anything.
+bool counter_store_commit(void);
+
+// Idle-time upkeep: erase the sector the ring moves into next. True if it
+// did anything.
+bool counter_store_maintain(void);
+
+void counter_store_get_stats(counter_store_stats_t *stats);
@@ -0,0 +1,551 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "cred_store.h"
+
+static const char *TAG = "CRED_STORE";
+
+// Log layout: the partition is a ring of 4 KB sectors. Slot 0 of a sector
+// is its header (sequence number, so sectors replay oldest first); slots
+// 1..15 hold one record each, written once, in order. A record whose CRC
+// does not match (torn write) is skipped; a sector whose header is not
+// valid is erased before reuse.
+#define SECTOR_SIZE         4096
+#define SLOT_SIZE           256
+#define SLOTS               (SECTOR_SIZE / SLOT_SIZE)
+#define MAX_SECTORS         32
+#define INDEX_BUCKETS       16
+
+#define SECTOR_MAGIC        0x31534346 // "FCS1"
+#define RECORD_MAGIC        0x43455246 // "FREC"
+#define TOMBSTONE_MAGIC     0x424D4F54 // "TOMB": deletes the record with the same credential ID
+#define ERASED_WORD         0xFFFFFFFF
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t crc;           // Over the rest of the slot
+    uint32_t created;
+    uint8_t rp_id_hash[32];
+    uint8_t cred_id_len;
+    uint8_t user_id_len;
+    uint8_t rp_id_len;
+    uint8_t reserved;
+    uint8_t cred_id[U2F_KH_MAX_SIZE];
+    uint8_t user_id[CRED_STORE_USER_ID_MAX];
+    char rp_id[CRED_STORE_RP_ID_MAX];
+    uint8_t pad[SLOT_SIZE - 48 - U2F_KH_MAX_SIZE - CRED_STORE_USER_ID_MAX - CRED_STORE_RP_ID_MAX];
+} flash_record_t;
+
+_Static_assert(sizeof(flash_record_t) == SLOT_SIZE, "record must fill one slot");
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t crc;           // Over seq
+    uint32_t seq;
+} sector_header_t;
+
+typedef enum {
+    SECTOR_FREE = 0,        // Erased, ready to open
+    SECTOR_USED,
+    SECTOR_DIRTY,           // Garbage or compacted, to be erased
+} sector_state_t;
+
+// RAM index. Each RP with a live credential has an entry holding its full
+// rpIdHash, found through a hash bucket, and a chain of its credentials.
+// Finding or counting RPs and ordering an RP's credentials need no flash
+// reads. The credential and user tags are prefilters; a match is confirmed
+// against the record in flash.
+typedef struct {
+    uint8_t rp_id_hash[32];
+    uint16_t creds;         // Live credentials, 0 = entry unused
+    int16_t first;          // Its first credential
+    int16_t next;           // Next RP in the bucket
+} rp_entry_t;
+
+typedef struct {
+    bool used;
+    int16_t rp;
+    uint32_t cred_tag;      // CRC of the credential ID
+    uint32_t user_tag;      // CRC of the user ID
+    uint32_t created;
+    uint16_t loc;           // sector * SLOTS + slot
+    int16_t next;           // Next credential of the same RP
+} index_entry_t;
+
+static const esp_partition_t *part = NULL;
+static size_t sector_count = 0;
+static sector_state_t sector_state[MAX_SECTORS];
+static uint32_t sector_seq[MAX_SECTORS];
+static size_t free_sectors = 0;
+static uint32_t max_seq = 0;
+static uint32_t max_created = 0;
+static int head_sector = -1; // Sector being appended to, -1 before the first write
+static int head_slot = SLOTS;
+
+static index_entry_t entries[CRED_STORE_MAX_CREDS];
+static rp_entry_t rps[CRED_STORE_MAX_CREDS]; // Never more RPs than credentials
+static int16_t buckets[INDEX_BUCKETS];
+static size_t live_count = 0;
+static size_t rp_count = 0;
+
+static uint32_t crc_of(const void *data, size_t len) {
+    return esp_rom_crc32_le(0, data, len);
+}
+
+static int bucket_of(const uint8_t *rp_id_hash) {
+    return rp_id_hash[0] % INDEX_BUCKETS; // Already a hash
+}
+
+static bool all_erased(const uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+static size_t slot_offset(uint16_t loc) {
+    return (size_t)loc * SLOT_SIZE;
+}
+
+// A checked record, or false for an erased, torn or foreign slot
+static bool read_record(uint16_t loc, flash_record_t *r) {
+    if (esp_partition_read(part, slot_offset(loc), r, sizeof(*r)) != ESP_OK) return false;
+    if (r->magic != RECORD_MAGIC && r->magic != TOMBSTONE_MAGIC) return false;
+    if (r->crc != crc_of((const uint8_t *)r + 8, sizeof(*r) - 8)) return false;
+    return r->cred_id_len <= U2F_KH_MAX_SIZE && r->user_id_len <= CRED_STORE_USER_ID_MAX &&
+           r->rp_id_len <= CRED_STORE_RP_ID_MAX;
+}
+
+static void to_cred_record(const flash_record_t *r, cred_record_t *out) {
+    memcpy(out->rp_id_hash, r->rp_id_hash, 32);
+    memcpy(out->cred_id, r->cred_id, r->cred_id_len);
+    out->cred_id_len = r->cred_id_len;
+    memcpy(out->user_id, r->user_id, r->user_id_len);
+    out->user_id_len = r->user_id_len;
+    memcpy(out->rp_id, r->rp_id, r->rp_id_len);
+    out->rp_id_len = r->rp_id_len;
+    out->created = r->created;
+}
+
+// --- Index ---
+
+static void index_reset(void) {
+    memset(entries, 0, sizeof(entries));
+    memset(rps, 0, sizeof(rps));
+    for (int i = 0; i < INDEX_BUCKETS; i++) buckets[i] = -1;
+    live_count = 0;
+    rp_count = 0;
+}
+
+static int rp_find(const uint8_t *rp_id_hash) {
+    for (int16_t i = buckets[bucket_of(rp_id_hash)]; i >= 0; i = rps[i].next) {
+        if (memcmp(rps[i].rp_id_hash, rp_id_hash, 32) == 0) return i;
+    }
+    return -1;
+}
+
+static int rp_get(const uint8_t *rp_id_hash) {
+    int i = rp_find(rp_id_hash);
+    if (i >= 0) return i;
+    for (i = 0; i < CRED_STORE_MAX_CREDS; i++) {
+        rp_entry_t *rp = &rps[i];
+        if (rp->creds > 0) continue;
+        memcpy(rp->rp_id_hash, rp_id_hash, 32);
+        rp->first = -1;
+        int b = bucket_of(rp_id_hash);
+        rp->next = buckets[b];
+        buckets[b] = (int16_t)i;
+        rp_count++;
+        return i;
+    }
+    return -1;
+}
+
+static int index_add(const flash_record_t *r, uint16_t loc) {
+    for (int i = 0; i < CRED_STORE_MAX_CREDS; i++) {
+        index_entry_t *e = &entries[i];
+        if (e->used) continue;
+        int rp = rp_get(r->rp_id_hash);
+        if (rp < 0) return -1;
+        e->used = true;
+        e->rp = (int16_t)rp;
+        e->cred_tag = crc_of(r->cred_id, r->cred_id_len);
+        e->user_tag = crc_of(r->user_id, r->user_id_len);
+        e->created = r->created;
+        e->loc = loc;
+        e->next = rps[rp].first;
+        rps[rp].first = (int16_t)i;
+        rps[rp].creds++;
+        live_count++;
+        return i;
+    }
+    return -1;
+}
+
+static void index_remove(int i) {
+    rp_entry_t *rp = &rps[entries[i].rp];
+    int16_t *link = &rp->first;
+    while (*link >= 0 && *link != i) link = &entries[*link].next;
+    if (*link == i) *link = entries[i].next;
+    entries[i].used = false;
+    live_count--;
+
+    if (--rp->creds == 0) {
+        link = &buckets[bucket_of(rp->rp_id_hash)];
+        while (*link >= 0 && *link != entries[i].rp) link = &rps[*link].next;
+        if (*link == entries[i].rp) *link = rp->next;
+        rp_count--;
+    }
+}
+
+static int index_find_cred(const uint8_t *cred_id, size_t len) {
+    uint32_t tag = crc_of(cred_id, len);
+    flash_record_t r;
+    for (int i = 0; i < CRED_STORE_MAX_CREDS; i++) {
+        if (!entries[i].used || entries[i].cred_tag != tag) continue;
+        if (read_record(entries[i].loc, &r) && r.cred_id_len == len && memcmp(r.cred_id, cred_id, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int index_find_user(const uint8_t *rp_id_hash, const uint8_t *user_id, size_t len) {
+    int rp = rp_find(rp_id_hash);
+    if (rp < 0) return -1;
+    uint32_t tag = crc_of(user_id, len);
+    flash_record_t r;
+    for (int16_t i = rps[rp].first; i >= 0; i = entries[i].next) {
+        if (entries[i].user_tag != tag || !read_record(entries[i].loc, &r)) continue;
+        if (r.user_id_len == len && memcmp(r.user_id, user_id, len) == 0) return i;
+    }
+    return -1;
+}
+
+static int index_find_loc(uint16_t loc) {
+    for (int i = 0; i < CRED_STORE_MAX_CREDS; i++) {
+        if (entries[i].used && entries[i].loc == loc) return i;
+    }
+    return -1;
+}
+
+// Replay one record: later records win, tombstones remove
+static void apply(const flash_record_t *r, uint16_t loc) {
+    int i = index_find_cred(r->cred_id, r->cred_id_len);
+    if (i >= 0) index_remove(i);
+    if (r->created > max_created) max_created = r->created;
+    if (r->magic == TOMBSTONE_MAGIC) return;
+
+    i = index_find_user(r->rp_id_hash, r->user_id, r->user_id_len);
+    if (i >= 0) index_remove(i);
+    if (index_add(r, loc) < 0) {
+        ESP_LOGE(TAG, "Index full, credential at slot %u not loaded", loc);
+    }
+}
+
+// --- Sectors ---
+
+static esp_err_t erase_sector(int s) {
+    esp_err_t err = esp_partition_erase_range(part, (size_t)s * SECTOR_SIZE, SECTOR_SIZE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Erase of sector %d failed: %s", s, esp_err_to_name(err));
+        return err;
+    }
+    if (sector_state[s] != SECTOR_FREE) free_sectors++;
+    sector_state[s] = SECTOR_FREE;
+    return ESP_OK;
+}
+
+static esp_err_t open_sector(void) {
+    for (size_t s = 0; s < sector_count; s++) {
+        if (sector_state[s] != SECTOR_FREE) continue;
+        sector_header_t h = {.magic = SECTOR_MAGIC, .seq = max_seq + 1};
+        h.crc = crc_of(&h.seq, sizeof(h.seq));
+        esp_err_t err = esp_partition_write(part, s * SECTOR_SIZE, &h, sizeof(h));
+        // Even a failed header write has used up the erased sector
+        sector_state[s] = (err == ESP_OK) ? SECTOR_USED : SECTOR_DIRTY;
+        free_sectors--;
+        if (err != ESP_OK) return err;
+        sector_seq[s] = ++max_seq;
+        head_sector = (int)s;
+        head_slot = 1;
+        return ESP_OK;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+// Program one record at the head. Returns the slot it went to.
+static esp_err_t append(flash_record_t *r, uint16_t *loc) {
+    if (head_sector < 0 || head_slot >= SLOTS) {
+        esp_err_t err = open_sector();
+        if (err != ESP_OK) return err;
+    }
+    r->crc = crc_of((const uint8_t *)r + 8, sizeof(*r) - 8);
+    *loc = (uint16_t)(head_sector * SLOTS + head_slot);
+    head_slot++; // A failed write still leaves the slot programmed
+    return esp_partition_write(part, slot_offset(*loc), r, sizeof(*r));
+}
+
+static int oldest_sector(void) {
+    int oldest = -1;
+    for (size_t s = 0; s < sector_count; s++) {
+        if (sector_state[s] != SECTOR_USED || (int)s == head_sector) continue;
+        if (oldest < 0 || sector_seq[s] < sector_seq[oldest]) oldest = (int)s;
+    }
+    return oldest;
+}
+
+// Copy the oldest sector's live records to the head, then erase it. Dead
+// records and tombstones are dropped: anything a tombstone could still
+// refer to is in this sector or was compacted away before it.
+static bool compact_one(void) {
+    int victim = oldest_sector();
+    if (victim < 0) return false;
+
+    flash_record_t r;
+    for (int slot = 1; slot < SLOTS; slot++) {
+        uint16_t loc = (uint16_t)(victim * SLOTS + slot);
+        int i = index_find_loc(loc);
+        if (i < 0 || !read_record(loc, &r)) continue;
+        // Room at the head, without dipping into a sector this frees
+        if ((head_sector < 0 || head_slot >= SLOTS) && free_sectors == 0) return false;
+        uint16_t new_loc;
+        if (append(&r, &new_loc) != ESP_OK) return false;
+        entries[i].loc = new_loc;
+    }
+
+    sector_state[victim] = SECTOR_DIRTY;
+    return erase_sector(victim) == ESP_OK;
+}
+
+bool cred_store_maintain(void) {
+    if (!part) return false;
+    for (size_t s = 0; s < sector_count; s++) {
+        if (sector_state[s] == SECTOR_DIRTY) return erase_sector((int)s) == ESP_OK;
+    }
+    if (free_sectors < CRED_STORE_RESERVE_SECTORS) return compact_one();
+    return false;
+}
+
+// Space for one more record, compacting now if the idle-time upkeep has
+// not kept up
+static esp_err_t make_room(void) {
+    for (size_t n = 0; n <= sector_count; n++) {
+        if ((head_sector >= 0 && head_slot < SLOTS) || free_sectors > 0) return ESP_OK;
+        if (!cred_store_maintain()) break;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+// --- API ---
+
+esp_err_t cred_store_init(void) {
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CRED_STORE_PARTITION);
+    if (!part) {
+        ESP_LOGE(TAG, "No '%s' partition", CRED_STORE_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    sector_count = part->size / SECTOR_SIZE;
+    if (sector_count > MAX_SECTORS) sector_count = MAX_SECTORS;
+    if (sector_count < CRED_STORE_RESERVE_SECTORS + 2) {
+        ESP_LOGE(TAG, "Partition too small (%u sectors)", (unsigned)sector_count);
+        part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    index_reset();
+    free_sectors = 0;
+    max_seq = 0;
+    max_created = 0;
+    head_sector = -1;
+    head_slot = SLOTS;
+
+    // Classify sectors. One that reads erased in its header slot must be
+    // erased throughout (an interrupted erase can leave either half).
+    uint8_t buf[SLOT_SIZE];
+    for (size_t s = 0; s < sector_count; s++) {
+        sector_header_t h;
+        sector_state[s] = SECTOR_DIRTY;
+        if (esp_partition_read(part, s * SECTOR_SIZE, &h, sizeof(h)) != ESP_OK) continue;
+        if (h.magic == SECTOR_MAGIC && h.crc == crc_of(&h.seq, sizeof(h.seq))) {
+            sector_state[s] = SECTOR_USED;
+            sector_seq[s] = h.seq;
+            if (h.seq > max_seq) max_seq = h.seq;
+        } else if (h.magic == ERASED_WORD) {
+            bool erased = true;
+            for (size_t off = 0; erased && off < SECTOR_SIZE; off += SLOT_SIZE) {
+                erased = esp_partition_read(part, s * SECTOR_SIZE + off, buf, sizeof(buf)) == ESP_OK &&
+                         all_erased(buf, sizeof(buf));
+            }
+            if (erased) {
+                sector_state[s] = SECTOR_FREE;
+                free_sectors++;
+            }
+        }
+    }
+
+    // Replay in sequence order
+    uint32_t last_seq = 0;
+    for (;;) {
+        int next = -1;
+        for (size_t s = 0; s < sector_count; s++) {
+            if (sector_state[s] != SECTOR_USED || sector_seq[s] <= last_seq) continue;
+            if (next < 0 || sector_seq[s] < sector_seq[next]) next = (int)s;
+        }
+        if (next < 0) break;
+        last_seq = sector_seq[next];
+
+        int used_slots = 1;
+        for (int slot = 1; slot < SLOTS; slot++) {
+            uint16_t loc = (uint16_t)(next * SLOTS + slot);
+            flash_record_t *r = (flash_record_t *)buf;
+            if (esp_partition_read(part, slot_offset(loc), buf, sizeof(buf)) != ESP_OK) continue;
+            if (all_erased(buf, sizeof(buf))) continue;
+            used_slots = slot + 1;
+            if (read_record(loc, r)) apply(r, loc);
+        }
+        head_sector = next;
+        head_slot = used_slots;
+    }
+
+    ESP_LOGI(TAG, "%u credentials, %u/%u sectors free", (unsigned)live_count, (unsigned)free_sectors,
+             (unsigned)sector_count);
+    return ESP_OK;
+}
+
+esp_err_t cred_store_put(cred_record_t *rec) {
+    if (!part) return ESP_ERR_INVALID_STATE;
+    if (rec->cred_id_len > U2F_KH_MAX_SIZE || rec->user_id_len > CRED_STORE_USER_ID_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int replaced = index_find_user(rec->rp_id_hash, rec->user_id, rec->user_id_len);
+    if (replaced < 0 && live_count >= CRED_STORE_MAX_CREDS) return ESP_ERR_NO_MEM;
+    esp_err_t err = make_room();
+    if (err != ESP_OK) return err;
+
+    flash_record_t r;
+    memset(&r, 0xFF, sizeof(r)); // Unused bytes stay erased
+    r.magic = RECORD_MAGIC;
+    r.created = max_created + 1;
+    memcpy(r.rp_id_hash, rec->rp_id_hash, 32);
+    r.cred_id_len = rec->cred_id_len;
+    memcpy(r.cred_id, rec->cred_id, rec->cred_id_len);
+    r.user_id_len = rec->user_id_len;
+    memcpy(r.user_id, rec->user_id, rec->user_id_len);
+    r.rp_id_len = rec->rp_id_len > CRED_STORE_RP_ID_MAX ? CRED_STORE_RP_ID_MAX : rec->rp_id_len;
+    memcpy(r.rp_id, rec->rp_id, r.rp_id_len);
+
+    uint16_t loc;
+    err = append(&r, &loc);
+    if (err != ESP_OK) return err;
+    max_created = r.created;
+    rec->created = r.created;
+
+    if (replaced >= 0) index_remove(replaced);
+    index_add(&r, loc);
+    return ESP_OK;
+}
+
+// The RP's newest credential created before `below`, -1 if none
+static int pick_before(int rp, uint32_t below) {
+    int pick = -1;
+    for (int16_t i = rps[rp].first; i >= 0; i = entries[i].next) {
+        if (entries[i].created < below && (pick < 0 || entries[i].created > entries[pick].created)) pick = i;
+    }
+    return pick;
+}
+
+size_t cred_store_find(const uint8_t *rp_id_hash, cred_record_t *out, size_t max) {
+    if (!part) return 0;
+    int rp = rp_find(rp_id_hash);
+    if (rp < 0) return 0;
+
+    // Newest first, picked by creation order in RAM: only the records
+    // copied out are read
+    size_t found = rps[rp].creds;
+    uint32_t below = UINT32_MAX;
+    flash_record_t r;
+    for (size_t n = 0; n < max;) {
+        int pick = pick_before(rp, below);
+        if (pick < 0) break;
+        below = entries[pick].created;
+        if (read_record(entries[pick].loc, &r)) {
+            to_cred_record(&r, &out[n++]);
+        } else {
+            found--;
+        }
+    }
+    return found;
+}
+
+bool cred_store_find_before(const uint8_t *rp_id_hash, uint32_t before, cred_record_t *out) {
+    int rp = part ? rp_find(rp_id_hash) : -1;
+    if (rp < 0) return false;
+    flash_record_t r;
+    for (int pick = pick_before(rp, before); pick >= 0; pick = pick_before(rp, entries[pick].created)) {
+        if (read_record(entries[pick].loc, &r)) {
+            to_cred_record(&r, out);
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t cred_store_delete(const uint8_t *cred_id, size_t cred_id_len) {
+    if (!part) return ESP_ERR_INVALID_STATE;
+    int i = index_find_cred(cred_id, cred_id_len);
+    if (i < 0) return ESP_ERR_NOT_FOUND;
+    esp_err_t err = make_room();
+    if (err != ESP_OK) return err;
+
+    flash_record_t r;
+    memset(&r, 0xFF, sizeof(r));
+    r.magic = TOMBSTONE_MAGIC;
+    r.created = entries[i].created;
+    memset(r.rp_id_hash, 0, sizeof(r.rp_id_hash));
+    r.cred_id_len = (uint8_t)cred_id_len;
+    memcpy(r.cred_id, cred_id, cred_id_len);
+    r.user_id_len = 0;
+    r.rp_id_len = 0;
+
+    uint16_t loc;
+    err = append(&r, &loc);
+    if (err != ESP_OK) return err;
+    index_remove(i);
+    return ESP_OK;
+}
+
+size_t cred_store_count(void) {
+    return live_count;
+}
+
+size_t cred_store_rp_count(void) {
+    return part ? rp_count : 0;
+}
+
+bool cred_store_next_rp(cred_cursor_t *cursor, cred_record_t *out) {
+    flash_record_t r;
+    while (part && cursor->pos < CRED_STORE_MAX_CREDS) {
+        int i = cursor->pos++;
+        if (rps[i].creds > 0 && read_record(entries[rps[i].first].loc, &r)) {
+            to_cred_record(&r, out);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cred_store_next_cred(cred_cursor_t *cursor, const uint8_t *rp_id_hash, cred_record_t *out) {
+    int rp = part ? rp_find(rp_id_hash) : -1;
+    flash_record_t r;
+    while (rp >= 0 && cursor->pos < CRED_STORE_MAX_CREDS) {
+        int i = cursor->pos++;
+        if (entries[i].used && entries[i].rp == rp && read_record(entries[i].loc, &r)) {
+            to_cred_record(&r, out);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "u2f.h"
+
+// Resident (discoverable) credentials, in an append-only log on their own
+// flash partition. Records are never rewritten: a replacement or a delete
+// appends, and compaction copies the live records of the oldest sector
+// forward before erasing it. A RAM index built at boot holds every RP's
+// rpIdHash and its credentials' creation order: finding an RP is a hash
+// bucket lookup and counting RPs is constant time, with no flash reads. Only
+// the records handed out are read, plus any whose user ID tag collides when
+// a put looks for the credential it replaces.
+//
+// The credential ID is the wrapped key handle, so nothing secret is stored.
+// Only the protocol worker task uses the store; it has no lock of its own.
+#define CRED_STORE_PARTITION        "fido_creds"
+
+#ifndef CRED_STORE_MAX_CREDS
+#define CRED_STORE_MAX_CREDS        64
+#endif
+#define CRED_STORE_USER_ID_MAX      64 // CTAP2 user handle limit
+#define CRED_STORE_RP_ID_MAX        64 // Longer rpIds are kept truncated, for display only
+
+// Erased sectors kept in hand so that a new credential never waits for an
+// erase; cred_store_maintain() tops them up when the device is idle
+#ifndef CRED_STORE_RESERVE_SECTORS
+#define CRED_STORE_RESERVE_SECTORS  2
+#endif
+
+typedef struct {
+    uint8_t rp_id_hash[32];
+    uint8_t cred_id[U2F_KH_MAX_SIZE];
+    uint8_t cred_id_len;
+    uint8_t user_id[CRED_STORE_USER_ID_MAX];
+    uint8_t user_id_len;
+    char rp_id[CRED_STORE_RP_ID_MAX];
+    uint8_t rp_id_len;
+    uint32_t created; // Creation order, newest highest (set by cred_store_put)
+} cred_record_t;
+
+// Mount the partition and rebuild the index from the log
+esp_err_t cred_store_init(void);
+
+// Store a credential, replacing any for the same rpIdHash and user ID.
+// Durable when this returns ESP_OK; ESP_ERR_NO_MEM when the store is full.
+esp_err_t cred_store_put(cred_record_t *rec);
+
+// Credentials for one rpIdHash, newest first. Returns how many there are;
+// at most max are copied to out, and only those are read from flash.
+size_t cred_store_find(const uint8_t *rp_id_hash, cred_record_t *out, size_t max);
+
+// The newest of the RP's credentials created before `before` (a created
+// value from an earlier find), for walking them one read at a time
+bool cred_store_find_before(const uint8_t *rp_id_hash, uint32_t before, cred_record_t *out);
+
+// ESP_ERR_NOT_FOUND if no live credential has this ID
+esp_err_t cred_store_delete(const uint8_t *cred_id, size_t cred_id_len);
+
+size_t cred_store_count(void);
+
+// Enumeration position, starting from CRED_STORE_CURSOR_INIT. Valid until
+// the next put or delete; compaction does not move it. Used by
+// authenticatorCredentialManagement to page through RPs and credentials.
+typedef struct {
+    int16_t pos;
+} cred_cursor_t;
+
+#define CRED_STORE_CURSOR_INIT  {0}
+
+// Number of distinct rpIdHashes with a credential
+size_t cred_store_rp_count(void);
+
+// One credential of each RP in turn. False when there are no more.
+bool cred_store_next_rp(cred_cursor_t *cursor, cred_record_t *out);
+
+// The RP's credentials in turn. False when there are no more.
+bool cred_store_next_cred(cred_cursor_t *cursor, const uint8_t *rp_id_hash, cred_record_t *out);
+
+// Idle-time upkeep: erase one stale sector, or compact the oldest one
+// while fewer than CRED_STORE_RESERVE_SECTORS are free. True if it did
+// anything (call again).
+bool cred_store_maintain(void);
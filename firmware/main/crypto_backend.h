@@ -0,0 +1,104 @@
+#ifndef CRYPTO_BACKEND_H
+#define CRYPTO_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "crypto_hal.h"
+
+// Primitive operations behind crypto_hal.h, one table per implementation.
+// HAL_BACKEND picks the table crypto_hal uses; hal_backend_selftest() runs
+// the same known-answer vectors through any table.
+#define HAL_BACKEND_MBEDTLS         1 // mbedTLS, accelerated as sdkconfig says
+#define HAL_BACKEND_HOST            2 // OpenSSL, for Linux builds (firmware/host)
+
+#ifndef HAL_BACKEND
+#define HAL_BACKEND                 HAL_BACKEND_MBEDTLS
+#endif
+
+// Returned by gcm_decrypt for a tag mismatch, whatever the backend
+// (same value as MBEDTLS_ERR_GCM_AUTH_FAILED)
+#define HAL_BACKEND_ERR_AUTH        (-0x0012)
+#define HAL_BACKEND_ERR_BAD_INPUT   (-0x0014) // MBEDTLS_ERR_GCM_BAD_INPUT
+
+// Expanded AES-256-GCM key, sized for the largest backend context (checked at build time)
+typedef struct {
+    uint64_t opaque[80];
+} hal_gcm_ctx_t;
+
+typedef struct {
+    const char *name;
+    int (*init)(void); // Once, before any other operation (repeat calls are no-ops)
+
+    // DRBG behind hal_rng_generate(): seeded once from the platform entropy
+    // source, then drawn from under crypto_hal's lock
+    int (*drbg_seed)(const uint8_t *pers, size_t pers_len);
+    int (*drbg_random)(uint8_t *buf, size_t len);
+
+    // SHA-256, incremental. final() releases the context.
+    int (*sha256_init)(hal_sha256_ctx_t *ctx);
+    int (*sha256_update)(hal_sha256_ctx_t *ctx, const uint8_t *data, size_t len);
+    int (*sha256_final)(hal_sha256_ctx_t *ctx, uint8_t output[32]);
+    void (*sha256_clone)(hal_sha256_ctx_t *dst, const hal_sha256_ctx_t *src);
+
+    // AES-256-GCM with an expanded key. The context carries per-operation
+    // state, callers serialise use of one context.
+    int (*gcm_setkey)(hal_gcm_ctx_t *ctx, const uint8_t *key);
+    int (*gcm_encrypt)(hal_gcm_ctx_t *ctx, const uint8_t *iv, size_t iv_len,
+                       const uint8_t *aad, size_t aad_len,
+                       const uint8_t *input, size_t length,
+                       uint8_t *output, uint8_t *tag, size_t tag_len);
+    int (*gcm_decrypt)(hal_gcm_ctx_t *ctx, const uint8_t *iv, size_t iv_len,
+                       const uint8_t *aad, size_t aad_len,
+                       const uint8_t *input, size_t length,
+                       uint8_t *output, const uint8_t *tag, size_t tag_len);
+    void (*gcm_free)(hal_gcm_ctx_t *ctx);
+
+    // AES-256-CBC without padding, length a multiple of 16. One-shot: only
+    // used for the short clientPIN messages.
+    int (*cbc_encrypt)(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length, uint8_t *output);
+    int (*cbc_decrypt)(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length, uint8_t *output);
+
+    // P-256: uncompressed public key of a scalar (fixed-base multiplication)
+    // and ECDSA verification of r||s over a 32-byte hash (0 = valid)
+    int (*p256_public_key)(const uint8_t *private_key, uint8_t *public_key);
+    int (*p256_verify)(const uint8_t *public_key, const uint8_t *hash, const uint8_t *sig_rs);
+    // ECDH: x of private_key times an uncompressed peer key, which must be
+    // a point on the curve
+    int (*p256_ecdh)(const uint8_t *private_key, const uint8_t *peer_public_key, uint8_t *shared_x);
+
+    // P-256 signing. Scalars are 32-byte big-endian and randomness comes
+    // from hal_rng_generate(). p256_nonce() does the k*G scalar
+    // multiplication ahead of time and draws a blinding factor t, giving
+    // (k*t)^-1, t and r. p256_sign_nonce() is then
+    // s = (e*t + r*(d*t)) * (k*t)^-1 mod n, a few modular multiplications
+    // with d and k only ever handled blinded, and fails (caller retries) if
+    // s is zero.
+    int (*p256_keygen)(uint8_t *private_key, uint8_t *public_key);
+    int (*p256_check_key)(const uint8_t *private_key); // 0 if 1 <= d < n
+    int (*p256_sign)(const uint8_t *private_key, const uint8_t *hash, uint8_t *sig_rs);
+    int (*p256_nonce)(uint8_t *ktinv, uint8_t *t, uint8_t *r);
+    int (*p256_sign_nonce)(const uint8_t *private_key, const uint8_t *hash,
+                           const uint8_t *ktinv, const uint8_t *t, const uint8_t *r, uint8_t *sig_rs);
+
+    // Ed25519 from a 32-byte seed
+    int (*ed25519_public_key)(const uint8_t *seed, uint8_t *public_key);
+    int (*ed25519_sign)(const uint8_t *seed, const uint8_t *msg, size_t msg_len, uint8_t *signature);
+} hal_backend_t;
+
+extern const hal_backend_t hal_backend_mbedtls;
+extern const hal_backend_t hal_backend_host;
+
+// The table selected by HAL_BACKEND
+#if HAL_BACKEND == HAL_BACKEND_MBEDTLS
+#define HAL_BACKEND_TABLE           hal_backend_mbedtls
+#elif HAL_BACKEND == HAL_BACKEND_HOST
+#define HAL_BACKEND_TABLE           hal_backend_host
+#else
+#error "Unknown HAL_BACKEND"
+#endif
+
+// Known-answer tests (crypto_selftest.c). Returns 0, or -1 with *failed
+// naming the first vector that did not match.
+int hal_backend_selftest(const hal_backend_t *b, const char **failed);
+
+#endif // CRYPTO_BACKEND_H
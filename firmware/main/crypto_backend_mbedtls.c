@@ -0,0 +1,441 @@
+#include <string.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_system.h"
+#include "crypto_backend.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/ecdsa.h"
+#include "mbedtls/ecdh.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/gcm.h"
+#include "sodium.h"
+
+// mbedTLS backend. Ed25519 comes from libsodium (mbedTLS has none).
+// Acceleration is an sdkconfig choice, not a separate table: with
+// CONFIG_MBEDTLS_HARDWARE_{AES,GCM,SHA,MPI} ESP-IDF swaps the AES/GCM, SHA
+// and bignum entry points used here for the DMA AES/SHA and MPI drivers.
+// firmware/sdkconfig.software turns them off for a pure software build.
+
+_Static_assert(sizeof(mbedtls_sha256_context) <= sizeof(hal_sha256_ctx_t), "hal_sha256_ctx_t too small");
+_Static_assert(sizeof(mbedtls_gcm_context) <= sizeof(hal_gcm_ctx_t), "hal_gcm_ctx_t too small");
+
+// Process-wide DRBG, seeded once from the hardware TRNG (mbedtls_entropy_func
+// uses it on ESP32) and reseeded every HAL_DRBG_RESEED_INTERVAL requests.
+static mbedtls_entropy_context entropy;
+static mbedtls_ctr_drbg_context ctr_drbg;
+
+// SECP256R1 for signing, loaded once and only read afterwards. With
+// CONFIG_MBEDTLS_ECP_FIXED_POINT_OPTIM the comb table for G is static data.
+static mbedtls_ecp_group p256;
+static bool p256_loaded = false;
+
+static int hal_mbedtls_init(void) {
+    if (sodium_init() < 0) return -1;
+    if (p256_loaded) return 0;
+
+    mbedtls_ecp_group_init(&p256);
+    int ret = mbedtls_ecp_group_load(&p256, MBEDTLS_ECP_DP_SECP256R1);
+    if (ret != 0) {
+        mbedtls_ecp_group_free(&p256);
+        return ret;
+    }
+    p256_loaded = true;
+    return 0;
+}
+
+static int hal_mbedtls_drbg_seed(const uint8_t *pers, size_t pers_len) {
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&ctr_drbg);
+    int ret = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, pers, pers_len);
+    if (ret != 0) return ret;
+    mbedtls_ctr_drbg_set_reseed_interval(&ctr_drbg, HAL_DRBG_RESEED_INTERVAL);
+    return 0;
+}
+
+static int hal_mbedtls_drbg_random(uint8_t *buf, size_t len) {
+    while (len > 0) {
+        size_t n = len > MBEDTLS_CTR_DRBG_MAX_REQUEST ? MBEDTLS_CTR_DRBG_MAX_REQUEST : len;
+        int ret = mbedtls_ctr_drbg_random(&ctr_drbg, buf, n);
+        if (ret != 0) return ret;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int hal_mbedtls_sha256_init(hal_sha256_ctx_t *ctx) {
+    mbedtls_sha256_context *c = (mbedtls_sha256_context *)ctx->opaque;
+    mbedtls_sha256_init(c);
+    return mbedtls_sha256_starts(c, 0); // 0 = SHA-256 (not 224)
+}
+
+static int hal_mbedtls_sha256_update(hal_sha256_ctx_t *ctx, const uint8_t *data, size_t len) {
+    return mbedtls_sha256_update((mbedtls_sha256_context *)ctx->opaque, data, len);
+}
+
+static int hal_mbedtls_sha256_final(hal_sha256_ctx_t *ctx, uint8_t output[32]) {
+    mbedtls_sha256_context *c = (mbedtls_sha256_context *)ctx->opaque;
+    int ret = mbedtls_sha256_finish(c, output);
+    mbedtls_sha256_free(c);
+    return ret;
+}
+
+static void hal_mbedtls_sha256_clone(hal_sha256_ctx_t *dst, const hal_sha256_ctx_t *src) {
+    mbedtls_sha256_context *d = (mbedtls_sha256_context *)dst->opaque;
+    mbedtls_sha256_init(d);
+    mbedtls_sha256_clone(d, (const mbedtls_sha256_context *)src->opaque);
+}
+
+static int hal_mbedtls_gcm_setkey(hal_gcm_ctx_t *ctx, const uint8_t *key) {
+    mbedtls_gcm_context *c = (mbedtls_gcm_context *)ctx->opaque;
+    mbedtls_gcm_init(c);
+    int ret = mbedtls_gcm_setkey(c, MBEDTLS_CIPHER_ID_AES, key, 256);
+    if (ret != 0) mbedtls_gcm_free(c);
+    return ret;
+}
+
+static int hal_mbedtls_gcm_encrypt(hal_gcm_ctx_t *ctx, const uint8_t *iv, size_t iv_len,
+                                   const uint8_t *aad, size_t aad_len,
+                                   const uint8_t *input, size_t length,
+                                   uint8_t *output, uint8_t *tag, size_t tag_len) {
+    return mbedtls_gcm_crypt_and_tag((mbedtls_gcm_context *)ctx->opaque, MBEDTLS_GCM_ENCRYPT, length,
+                                     iv, iv_len, aad, aad_len,
+                                     input, output, tag_len, tag);
+}
+
+static int hal_mbedtls_gcm_decrypt(hal_gcm_ctx_t *ctx, const uint8_t *iv, size_t iv_len,
+                                   const uint8_t *aad, size_t aad_len,
+                                   const uint8_t *input, size_t length,
+                                   uint8_t *output, const uint8_t *tag, size_t tag_len) {
+    return mbedtls_gcm_auth_decrypt((mbedtls_gcm_context *)ctx->opaque, length,
+                                    iv, iv_len, aad, aad_len,
+                                    tag, tag_len,
+                                    input, output);
+}
+
+static void hal_mbedtls_gcm_free(hal_gcm_ctx_t *ctx) {
+    mbedtls_gcm_free((mbedtls_gcm_context *)ctx->opaque);
+}
+
+// CBC advances the IV it is given, so it works on a copy
+static int cbc_crypt(int mode, const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length,
+                     uint8_t *output) {
+    mbedtls_aes_context aes;
+    uint8_t iv_copy[16];
+    memcpy(iv_copy, iv, sizeof(iv_copy));
+    mbedtls_aes_init(&aes);
+    int ret = mode == MBEDTLS_AES_ENCRYPT ? mbedtls_aes_setkey_enc(&aes, key, 256)
+                                          : mbedtls_aes_setkey_dec(&aes, key, 256);
+    if (ret == 0) {
+        ret = mbedtls_aes_crypt_cbc(&aes, mode, length, iv_copy, input, output);
+    }
+    mbedtls_aes_free(&aes);
+    return ret;
+}
+
+static int hal_mbedtls_cbc_encrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length,
+                                   uint8_t *output) {
+    return cbc_crypt(MBEDTLS_AES_ENCRYPT, key, iv, input, length, output);
+}
+
+static int hal_mbedtls_cbc_decrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length,
+                                   uint8_t *output) {
+    return cbc_crypt(MBEDTLS_AES_DECRYPT, key, iv, input, length, output);
+}
+
+// f_rng adapter for point blinding, straight from the hardware RNG
+static int esp_rng_cb(void *ctx, unsigned char *buf, size_t len) {
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+// Not on a hot path, and usable before init() (self-test), so the group is
+// loaded per call
+static int hal_mbedtls_p256_public_key(const uint8_t *private_key, uint8_t *public_key) {
+    mbedtls_ecp_group grp;
+    mbedtls_mpi d;
+    mbedtls_ecp_point Q;
+    size_t olen;
+    int ret;
+
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_mpi_init(&d);
+    mbedtls_ecp_point_init(&Q);
+
+    ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+    if (ret != 0) goto exit;
+    ret = mbedtls_mpi_read_binary(&d, private_key, 32);
+    if (ret != 0) goto exit;
+    ret = mbedtls_ecp_mul(&grp, &Q, &d, &grp.G, esp_rng_cb, NULL);
+    if (ret != 0) goto exit;
+    ret = mbedtls_ecp_point_write_binary(&grp, &Q, MBEDTLS_ECP_PF_UNCOMPRESSED, &olen, public_key, 65);
+
+exit:
+    mbedtls_ecp_point_free(&Q);
+    mbedtls_mpi_free(&d);
+    mbedtls_ecp_group_free(&grp);
+    return ret;
+}
+
+static int hal_mbedtls_p256_verify(const uint8_t *public_key, const uint8_t *hash, const uint8_t *sig_rs) {
+    mbedtls_ecp_group grp;
+    mbedtls_ecp_point Q;
+    mbedtls_mpi r, s;
+    int ret;
+
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_ecp_point_init(&Q);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+
+    ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+    if (ret != 0) goto exit;
+    ret = mbedtls_ecp_point_read_binary(&grp, &Q, public_key, 65);
+    if (ret != 0) goto exit;
+    ret = mbedtls_mpi_read_binary(&r, sig_rs, 32);
+    if (ret != 0) goto exit;
+    ret = mbedtls_mpi_read_binary(&s, sig_rs + 32, 32);
+    if (ret != 0) goto exit;
+    ret = mbedtls_ecdsa_verify(&grp, hash, 32, &Q, &r, &s);
+
+exit:
+    mbedtls_mpi_free(&s);
+    mbedtls_mpi_free(&r);
+    mbedtls_ecp_point_free(&Q);
+    mbedtls_ecp_group_free(&grp);
+    return ret;
+}
+
+// f_rng adapter for keygen, nonces and blinding: crypto_hal's pool and DRBG
+static int hal_rng_cb(void *ctx, unsigned char *buf, size_t len) {
+    return hal_rng_generate(buf, len);
+}
+
+static int hal_mbedtls_p256_keygen(uint8_t *private_key, uint8_t *public_key) {
+    mbedtls_mpi d;
+    mbedtls_ecp_point Q;
+    size_t olen;
+    int ret;
+
+    mbedtls_mpi_init(&d);
+    mbedtls_ecp_point_init(&Q);
+
+    ret = mbedtls_ecp_gen_keypair(&p256, &d, &Q, hal_rng_cb, NULL);
+    if (ret != 0) goto exit;
+    ret = mbedtls_mpi_write_binary(&d, private_key, 32);
+    if (ret != 0) goto exit;
+    // 65 bytes: 0x04 + X + Y
+    ret = mbedtls_ecp_point_write_binary(&p256, &Q, MBEDTLS_ECP_PF_UNCOMPRESSED, &olen, public_key, 65);
+
+exit:
+    mbedtls_mpi_free(&d);
+    mbedtls_ecp_point_free(&Q);
+    return ret;
+}
+
+static int hal_mbedtls_p256_ecdh(const uint8_t *private_key, const uint8_t *peer_public_key, uint8_t *shared_x) {
+    mbedtls_mpi d, z;
+    mbedtls_ecp_point Q;
+    int ret;
+
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&z);
+    mbedtls_ecp_point_init(&Q);
+
+    if ((ret = mbedtls_mpi_read_binary(&d, private_key, 32)) != 0) goto exit;
+    if ((ret = mbedtls_ecp_point_read_binary(&p256, &Q, peer_public_key, 65)) != 0) goto exit;
+    if ((ret = mbedtls_ecp_check_pubkey(&p256, &Q)) != 0) goto exit;
+    if ((ret = mbedtls_ecdh_compute_shared(&p256, &z, &Q, &d, hal_rng_cb, NULL)) != 0) goto exit;
+    ret = mbedtls_mpi_write_binary(&z, shared_x, 32);
+
+exit:
+    mbedtls_mpi_free(&d);
+    mbedtls_mpi_free(&z);
+    mbedtls_ecp_point_free(&Q);
+    return ret;
+}
+
+static int hal_mbedtls_p256_check_key(const uint8_t *private_key) {
+    mbedtls_mpi d;
+    mbedtls_mpi_init(&d);
+    int ret = mbedtls_mpi_read_binary(&d, private_key, 32);
+    if (ret == 0) {
+        ret = mbedtls_ecp_check_privkey(&p256, &d);
+    }
+    mbedtls_mpi_free(&d);
+    return ret;
+}
+
+static int write_rs(const mbedtls_mpi *r, const mbedtls_mpi *s, uint8_t *sig_rs) {
+    int ret = mbedtls_mpi_write_binary(r, sig_rs, 32);
+    if (ret == 0) {
+        ret = mbedtls_mpi_write_binary(s, sig_rs + 32, 32);
+    }
+    return ret;
+}
+
+static int hal_mbedtls_p256_sign(const uint8_t *private_key, const uint8_t *hash, uint8_t *sig_rs) {
+    mbedtls_mpi d, r, s;
+    int ret;
+
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+
+    if ((ret = mbedtls_mpi_read_binary(&d, private_key, 32)) != 0) goto exit;
+#if HAL_ECDSA_DETERMINISTIC
+    // RFC 6979 nonce, the RNG is only used for blinding
+    ret = mbedtls_ecdsa_sign_det_ext(&p256, &r, &s, &d, hash, 32, MBEDTLS_MD_SHA256, hal_rng_cb, NULL);
+#else
+    ret = mbedtls_ecdsa_sign(&p256, &r, &s, &d, hash, 32, hal_rng_cb, NULL);
+#endif
+    if (ret != 0) goto exit;
+    ret = write_rs(&r, &s, sig_rs);
+
+exit:
+    mbedtls_mpi_free(&d);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+    return ret;
+}
+
+// One nonce: the k*G scalar multiplication, off the request path, and a
+// blinding factor t so that k^-1 is only ever computed and kept as (k*t)^-1,
+// as mbedtls_ecdsa_sign() does. k itself is not kept.
+static int hal_mbedtls_p256_nonce(uint8_t *ktinv_out, uint8_t *t_out, uint8_t *r_out) {
+    mbedtls_mpi k, t, ktinv, r;
+    mbedtls_ecp_point R;
+    uint8_t point[65];
+    size_t olen;
+    int ret;
+
+    mbedtls_mpi_init(&k);
+    mbedtls_mpi_init(&t);
+    mbedtls_mpi_init(&ktinv);
+    mbedtls_mpi_init(&r);
+    mbedtls_ecp_point_init(&R);
+
+    do {
+        if ((ret = mbedtls_ecp_gen_privkey(&p256, &k, hal_rng_cb, NULL)) != 0) goto exit;
+        if ((ret = mbedtls_ecp_mul(&p256, &R, &k, &p256.G, hal_rng_cb, NULL)) != 0) goto exit;
+        // R.X is private in mbedTLS 3: take x from the encoded point
+        if ((ret = mbedtls_ecp_point_write_binary(&p256, &R, MBEDTLS_ECP_PF_UNCOMPRESSED, &olen,
+                                                  point, sizeof(point))) != 0) goto exit;
+        if ((ret = mbedtls_mpi_read_binary(&r, point + 1, 32)) != 0) goto exit;
+        if ((ret = mbedtls_mpi_mod_mpi(&r, &r, &p256.N)) != 0) goto exit;
+    } while (mbedtls_mpi_cmp_int(&r, 0) == 0);
+
+    if ((ret = mbedtls_ecp_gen_privkey(&p256, &t, hal_rng_cb, NULL)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_mul_mpi(&k, &k, &t)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_mod_mpi(&k, &k, &p256.N)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_inv_mod(&ktinv, &k, &p256.N)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_write_binary(&ktinv, ktinv_out, 32)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_write_binary(&t, t_out, 32)) != 0) goto exit;
+    ret = mbedtls_mpi_write_binary(&r, r_out, 32);
+
+exit:
+    // mbedtls_mpi_free() zeroes the limbs
+    mbedtls_mpi_free(&k);
+    mbedtls_mpi_free(&t);
+    mbedtls_mpi_free(&ktinv);
+    mbedtls_mpi_free(&r);
+    mbedtls_ecp_point_free(&R);
+    return ret;
+}
+
+// s = (e*t + r*(d*t)) * (k*t)^-1 = k^-1 * (e + r*d) mod n, a few
+// multiplications with no scalar multiplication. d is multiplied by t
+// before it meets anything else, so no product of d with a known value is
+// ever formed.
+static int hal_mbedtls_p256_sign_nonce(const uint8_t *private_key, const uint8_t *hash,
+                                       const uint8_t *ktinv_bin, const uint8_t *t_bin, const uint8_t *r_bin,
+                                       uint8_t *sig_rs) {
+    mbedtls_mpi d, e, ktinv, t, r, s;
+    int ret;
+
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&e);
+    mbedtls_mpi_init(&ktinv);
+    mbedtls_mpi_init(&t);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+
+    // A 256-bit hash needs no truncation for P-256
+    if ((ret = mbedtls_mpi_read_binary(&d, private_key, 32)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_read_binary(&e, hash, 32)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_read_binary(&ktinv, ktinv_bin, 32)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_read_binary(&t, t_bin, 32)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_read_binary(&r, r_bin, 32)) != 0) goto exit;
+
+    if ((ret = mbedtls_mpi_mul_mpi(&d, &d, &t)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_mod_mpi(&d, &d, &p256.N)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_mul_mpi(&e, &e, &t)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_mul_mpi(&s, &r, &d)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_add_mpi(&s, &s, &e)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_mod_mpi(&s, &s, &p256.N)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_mul_mpi(&s, &s, &ktinv)) != 0) goto exit;
+    if ((ret = mbedtls_mpi_mod_mpi(&s, &s, &p256.N)) != 0) goto exit;
+    if (mbedtls_mpi_cmp_int(&s, 0) == 0) {
+        ret = MBEDTLS_ERR_ECP_RANDOM_FAILED; // Caller retries with a fresh nonce
+        goto exit;
+    }
+    ret = write_rs(&r, &s, sig_rs);
+
+exit:
+    mbedtls_mpi_free(&d);
+    mbedtls_mpi_free(&e);
+    mbedtls_mpi_free(&ktinv);
+    mbedtls_mpi_free(&t);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+    return ret;
+}
+
+static int hal_mbedtls_ed25519_public_key(const uint8_t *seed, uint8_t *public_key) {
+    uint8_t sk[crypto_sign_SECRETKEYBYTES];
+    int ret = crypto_sign_seed_keypair(public_key, sk, seed);
+    sodium_memzero(sk, sizeof(sk));
+    return ret;
+}
+
+// Credential IDs only carry the seed, so the expanded key (and the public
+// key it embeds) is re-derived here rather than trusted from outside
+static int hal_mbedtls_ed25519_sign(const uint8_t *seed, const uint8_t *msg, size_t msg_len, uint8_t *signature) {
+    uint8_t pk[crypto_sign_PUBLICKEYBYTES];
+    uint8_t sk[crypto_sign_SECRETKEYBYTES];
+    int ret = crypto_sign_seed_keypair(pk, sk, seed);
+    if (ret == 0) {
+        ret = crypto_sign_detached(signature, NULL, msg, msg_len, sk);
+    }
+    sodium_memzero(sk, sizeof(sk));
+    return ret;
+}
+
+const hal_backend_t hal_backend_mbedtls = {
+    .name = "mbedtls",
+    .init = hal_mbedtls_init,
+    .drbg_seed = hal_mbedtls_drbg_seed,
+    .drbg_random = hal_mbedtls_drbg_random,
+    .sha256_init = hal_mbedtls_sha256_init,
+    .sha256_update = hal_mbedtls_sha256_update,
+    .sha256_final = hal_mbedtls_sha256_final,
+    .sha256_clone = hal_mbedtls_sha256_clone,
+    .gcm_setkey = hal_mbedtls_gcm_setkey,
+    .gcm_encrypt = hal_mbedtls_gcm_encrypt,
+    .gcm_decrypt = hal_mbedtls_gcm_decrypt,
+    .gcm_free = hal_mbedtls_gcm_free,
+    .cbc_encrypt = hal_mbedtls_cbc_encrypt,
+    .cbc_decrypt = hal_mbedtls_cbc_decrypt,
+    .p256_public_key = hal_mbedtls_p256_public_key,
+    .p256_verify = hal_mbedtls_p256_verify,
+    .p256_ecdh = hal_mbedtls_p256_ecdh,
+    .p256_keygen = hal_mbedtls_p256_keygen,
+    .p256_check_key = hal_mbedtls_p256_check_key,
+    .p256_sign = hal_mbedtls_p256_sign,
+    .p256_nonce = hal_mbedtls_p256_nonce,
+    .p256_sign_nonce = hal_mbedtls_p256_sign_nonce,
+    .ed25519_public_key = hal_mbedtls_ed25519_public_key,
+    .ed25519_sign = hal_mbedtls_ed25519_sign,
+};
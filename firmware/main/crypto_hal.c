@@ -1,127 +1,528 @@
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
-#include "mbedtls/entropy.h"
-#include "mbedtls/ctr_drbg.h"
-#include "mbedtls/ecdsa.h"
-#include "mbedtls/sha256.h"
-#include "mbedtls/gcm.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "crypto_hal.h"
+#include "crypto_backend.h"
 
 static const char *TAG = "CRYPTO_HAL";
 
-// Hardware Random Number Generator Wrapper
+// The DRBG itself lives in the backend (drbg_seed/drbg_random)
+static SemaphoreHandle_t rng_lock = NULL; // Guards the DRBG and the pool
+
+// Expanded AES-256-GCM keys (hal_gcm_key_create)
+struct hal_gcm_key {
+    bool used;
+    hal_gcm_ctx_t ctx;
+    SemaphoreHandle_t lock; // The context carries per-operation state
+};
+static struct hal_gcm_key gcm_keys[HAL_GCM_MAX_KEYS];
+
+// Private scalars range-checked once (hal_ecc_key_create)
+struct hal_ecc_key {
+    bool used;
+    uint8_t d[32];
+};
+static struct hal_ecc_key ecc_keys[HAL_ECC_MAX_KEYS];
+
+// Precomputed ECDSA nonces: r = (k*G).x mod n, a blinding factor t and
+// (k*t)^-1 mod n. k itself is not kept. Each entry is wiped as it is taken,
+// so it signs exactly once.
+typedef struct {
+    bool ready;
+    uint8_t ktinv[32];
+    uint8_t t[32];
+    uint8_t r[32];
+} nonce_entry_t;
+static nonce_entry_t nonce_pool[HAL_NONCE_POOL_SIZE];
+
+// Pre-generated credential keypairs. The private half is held AES-GCM wrapped
+// under pool_key, a random key that only ever exists in RAM, with the public
+// key as AAD. Each entry is wiped as it is taken, so it is handed out once.
+typedef struct {
+    bool ready;
+    uint8_t iv[12];
+    uint8_t wrapped[32];
+    uint8_t tag[16];
+    uint8_t pub[65];
+} keypair_entry_t;
+static keypair_entry_t keypair_pool[HAL_KEYPAIR_POOL_SIZE];
+static hal_gcm_key_t *pool_key = NULL;
+
+static SemaphoreHandle_t pool_lock = NULL; // Guards nonce_pool and keypair_pool
+
+// Refills the pools below every other task, so any USB or protocol work
+// preempts it straight away
+static TaskHandle_t precompute_task = NULL;
+static void precompute_main(void *arg);
+
+// Prefilled output, consumed from the top down
+static uint8_t rng_pool[HAL_RNG_POOL_SIZE];
+static size_t rng_pool_avail = 0;
+
+// Not optimised away like a memset() on a dead buffer
+static void wipe(void *buf, size_t len) {
+    volatile uint8_t *p = buf;
+    while (len--) *p++ = 0;
+}
+
+// Caller holds rng_lock
+static int drbg_fill_locked(uint8_t *buf, size_t len) {
+    int ret = HAL_BACKEND_TABLE.drbg_random(buf, len);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "DRBG Failed: -0x%04X", -ret);
+    }
+    return ret;
+}
+
+int hal_crypto_init(void) {
+    if (rng_lock) return 0;
+
+    // Loads the P-256 group among other things
+    int ret = HAL_BACKEND_TABLE.init();
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Backend '%s' Init Failed", HAL_BACKEND_TABLE.name);
+        return ret;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    static const char pers[] = "OpenFIDO-ESP";
+    ret = HAL_BACKEND_TABLE.drbg_seed((const uint8_t *)pers, sizeof(pers) - 1);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "DRBG Seed Failed: -0x%04X", -ret);
+        return ret;
+    }
+    // Seeding used to be paid on every keygen/sign, log what it costs once
+    ESP_LOGI(TAG, "DRBG seeded in %lld us", (long long)(esp_timer_get_time() - start_us));
+
+    rng_lock = xSemaphoreCreateMutex();
+    hal_rng_refill();
+#ifdef HAL_SELFTEST_AT_BOOT
+    // Same vectors as firmware/host, through the table this build runs on
+    // (with or without the accelerators, as sdkconfig set them)
+    const char *failed;
+    if (hal_backend_selftest(&HAL_BACKEND_TABLE, &failed) != 0) {
+        ESP_LOGE(TAG, "Backend '%s' self-test failed: %s", HAL_BACKEND_TABLE.name, failed);
+    } else {
+        ESP_LOGI(TAG, "Backend '%s' self-test passed", HAL_BACKEND_TABLE.name);
+    }
+#endif
+
+    // Nothing precomputed survives a reset
+    wipe(nonce_pool, sizeof(nonce_pool));
+    wipe(keypair_pool, sizeof(keypair_pool));
+    uint8_t raw_pool_key[32];
+    hal_rng_generate(raw_pool_key, sizeof(raw_pool_key));
+    pool_key = hal_gcm_key_create(raw_pool_key);
+    wipe(raw_pool_key, sizeof(raw_pool_key));
+    pool_lock = xSemaphoreCreateMutex();
+    xTaskCreate(precompute_main, "crypto_idle", HAL_PRECOMPUTE_STACK, NULL, HAL_PRECOMPUTE_PRIORITY, &precompute_task);
+    return 0;
+}
+
+// Random bytes from the pool, falling back to the DRBG when it runs dry
 int hal_rng_generate(uint8_t *buf, size_t len) {
-    // ESP32-S2 has a hardware TRNG enabled by default in the Wi-Fi/BT stack or bootloader.
-    // esp_fill_random() uses this hardware RNG.
-    esp_fill_random(buf, len);
-    return 0; // Success
+    if (!rng_lock) {
+        // Before hal_crypto_init: straight from the hardware RNG
+        esp_fill_random(buf, len);
+        return 0;
+    }
+
+    int ret = 0;
+    xSemaphoreTake(rng_lock, portMAX_DELAY);
+    if (len <= rng_pool_avail) {
+        rng_pool_avail -= len;
+        memcpy(buf, &rng_pool[rng_pool_avail], len);
+        wipe(&rng_pool[rng_pool_avail], len); // Never hand out the same bytes twice
+    } else {
+        ret = drbg_fill_locked(buf, len);
+    }
+    xSemaphoreGive(rng_lock);
+    return ret;
+}
+
+void hal_rng_refill(void) {
+    if (!rng_lock) return;
+    xSemaphoreTake(rng_lock, portMAX_DELAY);
+    if (rng_pool_avail < HAL_RNG_POOL_SIZE &&
+        drbg_fill_locked(&rng_pool[rng_pool_avail], HAL_RNG_POOL_SIZE - rng_pool_avail) == 0) {
+        rng_pool_avail = HAL_RNG_POOL_SIZE;
+    }
+    xSemaphoreGive(rng_lock);
 }
 
 // SHA-256 Wrapper
 int hal_sha256(const uint8_t *input, size_t len, uint8_t output[32]) {
-    int ret = mbedtls_sha256(input, len, output, 0); // 0 = SHA-256 (not 224)
+    hal_sha256_ctx_t ctx;
+    int ret = hal_sha256_init(&ctx);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "SHA256 Failed: -0x%04X", -ret);
+        return ret;
+    }
+    hal_sha256_update(&ctx, input, len);
+    return hal_sha256_final(&ctx, output);
+}
+
+int hal_sha256_init(hal_sha256_ctx_t *ctx) {
+    return HAL_BACKEND_TABLE.sha256_init(ctx);
+}
+
+int hal_sha256_update(hal_sha256_ctx_t *ctx, const uint8_t *data, size_t len) {
+    return HAL_BACKEND_TABLE.sha256_update(ctx, data, len);
+}
+
+int hal_sha256_final(hal_sha256_ctx_t *ctx, uint8_t output[32]) {
+    int ret = HAL_BACKEND_TABLE.sha256_final(ctx, output);
     if (ret != 0) {
         ESP_LOGE(TAG, "SHA256 Failed: -0x%04X", -ret);
     }
     return ret;
 }
 
+void hal_sha256_clone(hal_sha256_ctx_t *dst, const hal_sha256_ctx_t *src) {
+    HAL_BACKEND_TABLE.sha256_clone(dst, src);
+}
+
+// Keys longer than a block are hashed first; CTAP2 only uses 32-byte keys
+int hal_hmac_sha256(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t msg_len, uint8_t output[32]) {
+    uint8_t pad[64] = {0};
+    hal_sha256_ctx_t ctx;
+    int ret = 0;
+    if (key_len > sizeof(pad)) {
+        ret = hal_sha256(key, key_len, pad);
+    } else {
+        memcpy(pad, key, key_len);
+    }
+
+    // Inner: H((K ^ ipad) || msg)
+    for (size_t i = 0; i < sizeof(pad); i++) pad[i] ^= 0x36;
+    if (ret == 0) ret = hal_sha256_init(&ctx);
+    if (ret == 0) {
+        hal_sha256_update(&ctx, pad, sizeof(pad));
+        hal_sha256_update(&ctx, msg, msg_len);
+        ret = hal_sha256_final(&ctx, output);
+    }
+
+    // Outer: H((K ^ opad) || inner)
+    for (size_t i = 0; i < sizeof(pad); i++) pad[i] ^= 0x36 ^ 0x5c;
+    if (ret == 0) ret = hal_sha256_init(&ctx);
+    if (ret == 0) {
+        hal_sha256_update(&ctx, pad, sizeof(pad));
+        hal_sha256_update(&ctx, output, 32);
+        ret = hal_sha256_final(&ctx, output);
+    }
+    wipe(pad, sizeof(pad));
+    return ret;
+}
+
 // ECC P-256 Key Generation
 int hal_ecc_generate_keypair(uint8_t *private_key, uint8_t *public_key) {
-    mbedtls_entropy_context entropy;
-    mbedtls_ctr_drbg_context ctr_drbg;
-    mbedtls_pk_context pk;
-    int ret;
+    uint32_t start = esp_cpu_get_cycle_count();
 
-    mbedtls_entropy_init(&entropy);
-    mbedtls_ctr_drbg_init(&ctr_drbg);
-    mbedtls_pk_init(&pk);
-
-    // Seed RNG
-    // Note: In ESP32, mbedtls_entropy_func uses hardware RNG automatically
-    ret = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, NULL, 0);
-    if (ret != 0) goto exit;
-
-    // Generate Keypair (SECP256R1)
-    ret = mbedtls_pk_setup(&pk, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY));
-    if (ret != 0) goto exit;
-
-    ret = mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(pk), 
-                              mbedtls_ctr_drbg_random, &ctr_drbg);
-    if (ret != 0) goto exit;
-
-    // Export Private Key (32 bytes)
-    ret = mbedtls_mpi_write_binary(&mbedtls_pk_ec(pk)->d, private_key, 32);
-    if (ret != 0) goto exit;
-
-    // Export Public Key (65 bytes: 0x04 + X + Y)
-    size_t olen;
-    ret = mbedtls_ecp_point_write_binary(&mbedtls_pk_ec(pk)->grp, &mbedtls_pk_ec(pk)->Q,
-                                         MBEDTLS_ECP_PF_UNCOMPRESSED, &olen, public_key, 65);
-    if (ret != 0) goto exit;
-
-exit:
-    mbedtls_pk_free(&pk);
-    mbedtls_ctr_drbg_free(&ctr_drbg);
-    mbedtls_entropy_free(&entropy);
-    
+    // Private Key (32 bytes), Public Key (65 bytes: 0x04 + X + Y)
+    int ret = HAL_BACKEND_TABLE.p256_keygen(private_key, public_key);
     if (ret != 0) {
         ESP_LOGE(TAG, "ECC Gen Failed: -0x%04X", -ret);
+    } else {
+        ESP_LOGD(TAG, "keygen: %lu cycles", (unsigned long)(esp_cpu_get_cycle_count() - start));
     }
     return ret;
 }
 
-// ECC P-256 Sign
-int hal_ecc_sign(const uint8_t *private_key, const uint8_t *hash, uint8_t *signature) {
-    mbedtls_entropy_context entropy;
-    mbedtls_ctr_drbg_context ctr_drbg;
-    mbedtls_pk_context pk;
-    mbedtls_mpi r, s;
+int hal_ecc_public_key(const uint8_t *private_key, uint8_t *public_key) {
+    return HAL_BACKEND_TABLE.p256_public_key(private_key, public_key);
+}
+
+int hal_ecdh_p256(const uint8_t *private_key, const uint8_t *peer_public_key, uint8_t shared_x[32]) {
+    int ret = HAL_BACKEND_TABLE.p256_ecdh(private_key, peer_public_key, shared_x);
+    if (ret != 0) {
+        ESP_LOGW(TAG, "ECDH Failed: -0x%04X", -ret);
+    }
+    return ret;
+}
+
+// Credential keypair from the pool, generated inline if the pool is empty
+int hal_ecc_take_keypair(uint8_t *private_key, uint8_t *public_key) {
+    keypair_entry_t entry;
+    bool found = false;
+
+    if (pool_lock) {
+        xSemaphoreTake(pool_lock, portMAX_DELAY);
+        for (int i = 0; i < HAL_KEYPAIR_POOL_SIZE; i++) {
+            if (!keypair_pool[i].ready) continue;
+            entry = keypair_pool[i];
+            wipe(&keypair_pool[i], sizeof(keypair_pool[i]));
+            found = true;
+            break;
+        }
+        xSemaphoreGive(pool_lock);
+    }
+
+    int ret = -1;
+    if (found) {
+        xTaskNotifyGive(precompute_task);
+        ret = hal_gcm_key_decrypt(pool_key, entry.iv, sizeof(entry.iv), entry.pub, sizeof(entry.pub),
+                                  entry.wrapped, sizeof(entry.wrapped), private_key, entry.tag,
+                                  sizeof(entry.tag));
+        if (ret == 0) {
+            memcpy(public_key, entry.pub, sizeof(entry.pub));
+        }
+        wipe(&entry, sizeof(entry));
+    }
+    if (ret != 0) {
+        ret = hal_ecc_generate_keypair(private_key, public_key);
+    }
+    return ret;
+}
+
+#if !HAL_ECDSA_DETERMINISTIC
+// Claim a precomputed nonce. The slot is wiped before the lock is released.
+static bool nonce_take(uint8_t *ktinv, uint8_t *t, uint8_t *r) {
+    bool found = false;
+    if (!pool_lock) return false;
+
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    for (int i = 0; i < HAL_NONCE_POOL_SIZE; i++) {
+        nonce_entry_t *e = &nonce_pool[i];
+        if (!e->ready) continue;
+        memcpy(ktinv, e->ktinv, 32);
+        memcpy(t, e->t, 32);
+        memcpy(r, e->r, 32);
+        wipe(e, sizeof(*e));
+        found = true;
+        break;
+    }
+    xSemaphoreGive(pool_lock);
+
+    if (found) xTaskNotifyGive(precompute_task);
+    return found;
+}
+#endif
+
+static bool nonce_pool_full(void) {
+    bool full = true;
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    for (int i = 0; i < HAL_NONCE_POOL_SIZE; i++) {
+        if (!nonce_pool[i].ready) full = false;
+    }
+    xSemaphoreGive(pool_lock);
+    return full;
+}
+
+static void nonce_put(const uint8_t *ktinv, const uint8_t *t, const uint8_t *r) {
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    for (int i = 0; i < HAL_NONCE_POOL_SIZE; i++) {
+        nonce_entry_t *e = &nonce_pool[i];
+        if (e->ready) continue;
+        memcpy(e->ktinv, ktinv, 32);
+        memcpy(e->t, t, 32);
+        memcpy(e->r, r, 32);
+        e->ready = true;
+        break;
+    }
+    xSemaphoreGive(pool_lock);
+}
+
+static bool keypair_pool_full(void) {
+    bool full = true;
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    for (int i = 0; i < HAL_KEYPAIR_POOL_SIZE; i++) {
+        if (!keypair_pool[i].ready) full = false;
+    }
+    xSemaphoreGive(pool_lock);
+    return full;
+}
+
+void hal_precompute_levels(size_t *nonces, size_t *keypairs) {
+    *nonces = 0;
+    *keypairs = 0;
+    if (!pool_lock) return;
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    for (int i = 0; i < HAL_NONCE_POOL_SIZE; i++) {
+        *nonces += nonce_pool[i].ready;
+    }
+    for (int i = 0; i < HAL_KEYPAIR_POOL_SIZE; i++) {
+        *keypairs += keypair_pool[i].ready;
+    }
+    xSemaphoreGive(pool_lock);
+}
+
+// Generate, wrap and store one keypair
+static int keypair_refill_one(void) {
+    keypair_entry_t entry;
+    uint8_t priv[32];
+
+    int ret = hal_ecc_generate_keypair(priv, entry.pub);
+    if (ret == 0) {
+        hal_rng_generate(entry.iv, sizeof(entry.iv));
+        ret = hal_gcm_key_encrypt(pool_key, entry.iv, sizeof(entry.iv), entry.pub, sizeof(entry.pub),
+                                  priv, sizeof(priv), entry.wrapped, entry.tag, sizeof(entry.tag));
+    }
+    wipe(priv, sizeof(priv));
+    if (ret != 0) return ret;
+
+    entry.ready = true;
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    for (int i = 0; i < HAL_KEYPAIR_POOL_SIZE; i++) {
+        if (keypair_pool[i].ready) continue;
+        keypair_pool[i] = entry;
+        break;
+    }
+    xSemaphoreGive(pool_lock);
+    return 0;
+}
+
+// Fills one entry at a time, alternating between the pools so a burst of
+// registrations (one keypair and one attestation nonce each) drains both
+// evenly, then sleeps until something is consumed
+static void precompute_main(void *arg) {
+    bool keypair_turn = false;
+    for (;;) {
+        // RFC 6979 signing derives its nonce from the message, nothing to precompute
+        bool need_nonce = !HAL_ECDSA_DETERMINISTIC && !nonce_pool_full();
+        bool need_keypair = !keypair_pool_full();
+        if (!need_nonce && !need_keypair) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        int ret;
+        if (need_keypair && (keypair_turn || !need_nonce)) {
+            ret = keypair_refill_one();
+        } else {
+            uint8_t ktinv[32], t[32], r[32];
+            ret = HAL_BACKEND_TABLE.p256_nonce(ktinv, t, r);
+            if (ret == 0) nonce_put(ktinv, t, r);
+            wipe(ktinv, sizeof(ktinv));
+            wipe(t, sizeof(t));
+        }
+        keypair_turn = !keypair_turn;
+        if (ret != 0) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+}
+
+static int ecdsa_sign(const uint8_t *d, const uint8_t *hash, uint8_t *sig_rs) {
+    uint32_t start = esp_cpu_get_cycle_count();
     int ret;
 
-    mbedtls_entropy_init(&entropy);
-    mbedtls_ctr_drbg_init(&ctr_drbg);
-    mbedtls_pk_init(&pk);
-    mbedtls_mpi_init(&r);
-    mbedtls_mpi_init(&s);
-
-    ret = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, NULL, 0);
-    if (ret != 0) goto exit;
-
-    // Import Private Key
-    ret = mbedtls_pk_setup(&pk, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY));
-    if (ret != 0) goto exit;
-    
-    mbedtls_ecp_group_load(&mbedtls_pk_ec(pk)->grp, MBEDTLS_ECP_DP_SECP256R1);
-    mbedtls_mpi_read_binary(&mbedtls_pk_ec(pk)->d, private_key, 32);
-
-    // Sign Hash
-    ret = mbedtls_ecdsa_sign(&mbedtls_pk_ec(pk)->grp, &r, &s, &mbedtls_pk_ec(pk)->d,
-                             hash, 32, mbedtls_ctr_drbg_random, &ctr_drbg);
-    if (ret != 0) goto exit;
-
-    // Encode Signature in ASN.1 DER (U2F requirement)
-    // Sequence { Integer r, Integer s }
-    // We'll use a simplified manual encoding or mbedtls_ecdsa_write_signature if available.
-    // mbedtls_ecdsa_write_signature writes full ASN.1 signature.
-    
-    size_t sig_len;
-    ret = mbedtls_ecdsa_write_signature(&mbedtls_pk_ec(pk)->grp, MBEDTLS_MD_SHA256,
-                                        hash, 32, signature, &sig_len,
-                                        mbedtls_ctr_drbg_random, &ctr_drbg);
-    // Note: signature buffer should be large enough (approx 72 bytes)
-    
-exit:
-    mbedtls_mpi_free(&r);
-    mbedtls_mpi_free(&s);
-    mbedtls_pk_free(&pk);
-    mbedtls_ctr_drbg_free(&ctr_drbg);
-    mbedtls_entropy_free(&entropy);
+#if HAL_ECDSA_DETERMINISTIC
+    ret = HAL_BACKEND_TABLE.p256_sign(d, hash, sig_rs);
+#else
+    uint8_t ktinv[32], t[32], r[32];
+    bool precomputed = nonce_take(ktinv, t, r);
+    if (precomputed) {
+        ret = HAL_BACKEND_TABLE.p256_sign_nonce(d, hash, ktinv, t, r, sig_rs);
+        wipe(ktinv, sizeof(ktinv));
+        wipe(t, sizeof(t));
+    }
+    if (!precomputed || ret != 0) {
+        // Pool empty: full sign, k*G on the request path
+        ret = HAL_BACKEND_TABLE.p256_sign(d, hash, sig_rs);
+    }
+#endif
 
     if (ret != 0) {
         ESP_LOGE(TAG, "ECC Sign Failed: -0x%04X", -ret);
-        return ret;
+    } else {
+        ESP_LOGD(TAG, "sign: %lu cycles", (unsigned long)(esp_cpu_get_cycle_count() - start));
+    }
+    return ret;
+}
+
+// ECC P-256 Sign: one signature, raw r||s
+int hal_ecc_sign_raw(const uint8_t *private_key, const uint8_t *hash, uint8_t *sig_rs) {
+    return ecdsa_sign(private_key, hash, sig_rs);
+}
+
+hal_ecc_key_t *hal_ecc_key_create(const uint8_t *private_key) {
+    for (int i = 0; i < HAL_ECC_MAX_KEYS; i++) {
+        struct hal_ecc_key *key = &ecc_keys[i];
+        if (key->used) continue;
+
+        if (HAL_BACKEND_TABLE.p256_check_key(private_key) != 0) {
+            ESP_LOGE(TAG, "Invalid ECC key");
+            return NULL;
+        }
+        memcpy(key->d, private_key, sizeof(key->d));
+        key->used = true;
+        return key;
+    }
+    ESP_LOGE(TAG, "No free ECC key slot");
+    return NULL;
+}
+
+int hal_ecc_sign_key(const hal_ecc_key_t *key, const uint8_t *hash, uint8_t *sig_rs) {
+    if (!key) return HAL_BACKEND_ERR_BAD_INPUT;
+    return ecdsa_sign(key->d, hash, sig_rs);
+}
+
+// One 32-byte big-endian integer as a DER INTEGER. The leading-zero scan
+// always covers all 32 bytes and does not branch on the value.
+static size_t der_put_int(uint8_t *out, const uint8_t *v) {
+    size_t skip = 0;
+    uint32_t seen = 0;
+    for (int i = 0; i < 32; i++) {
+        seen |= v[i];
+        skip += (seen == 0);
     }
-    return sig_len; // Return actual signature length
+    skip -= (skip == 32); // Zero is encoded as a single 0x00
+    size_t len = 32 - skip;
+    size_t pad = v[skip] >> 7; // High bit set: prefix 0x00 to keep it positive
+
+    out[0] = 0x02;
+    out[1] = (uint8_t)(len + pad);
+    out[2] = 0x00;
+    memcpy(out + 2 + pad, v + skip, len);
+    return 2 + pad + len;
+}
+
+// DER: SEQUENCE { INTEGER r, INTEGER s }
+int hal_ecdsa_sig_to_der(const uint8_t *sig_rs, uint8_t *der) {
+    size_t len = der_put_int(der + 2, sig_rs);
+    len += der_put_int(der + 2 + len, sig_rs + 32);
+    der[0] = 0x30;
+    der[1] = (uint8_t)len;
+    return (int)len + 2;
+}
+
+// ECC P-256 Sign, ASN.1 DER output (U2F and WebAuthn ES256)
+int hal_ecc_sign(const uint8_t *private_key, const uint8_t *hash, uint8_t *signature) {
+    uint8_t sig_rs[HAL_ECC_SIG_RAW_SIZE];
+    int ret = hal_ecc_sign_raw(private_key, hash, sig_rs);
+    if (ret != 0) return ret;
+    return hal_ecdsa_sig_to_der(sig_rs, signature); // Return actual signature length
+}
+
+// Ed25519 Key Generation
+int hal_ed25519_generate_keypair(uint8_t *seed, uint8_t *public_key) {
+    int ret = hal_rng_generate(seed, 32);
+    if (ret == 0) {
+        ret = HAL_BACKEND_TABLE.ed25519_public_key(seed, public_key);
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Ed25519 Gen Failed: -0x%04X", -ret);
+        wipe(seed, 32);
+    }
+    return ret;
+}
+
+int hal_ed25519_public_key(const uint8_t *seed, uint8_t *public_key) {
+    return HAL_BACKEND_TABLE.ed25519_public_key(seed, public_key);
+}
+
+// Ed25519 Sign
+int hal_ed25519_sign(const uint8_t *seed, const uint8_t *msg, size_t msg_len, uint8_t *signature) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    int ret = HAL_BACKEND_TABLE.ed25519_sign(seed, msg, msg_len, signature);
+    ESP_LOGD(TAG, "Ed25519 sign: %lu cycles", (unsigned long)(esp_cpu_get_cycle_count() - start));
+    return ret;
 }
 
 // AES-256-GCM Encrypt
@@ -129,21 +530,13 @@ int hal_aes_gcm_encrypt(const uint8_t *key, const uint8_t *iv, size_t iv_len,
                         const uint8_t *aad, size_t aad_len,
                         const uint8_t *input, size_t length,
                         uint8_t *output, uint8_t *tag, size_t tag_len) {
-    mbedtls_gcm_context ctx;
-    int ret;
-
-    mbedtls_gcm_init(&ctx);
-    
-    // 256-bit key = 32 bytes * 8 = 256 bits
-    ret = mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 256);
-    if (ret != 0) goto exit;
-
-    ret = mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, length,
-                                    iv, iv_len, aad, aad_len,
-                                    input, output, tag_len, tag);
-
-exit:
-    mbedtls_gcm_free(&ctx);
+    hal_gcm_ctx_t ctx;
+    int ret = HAL_BACKEND_TABLE.gcm_setkey(&ctx, key);
+    if (ret == 0) {
+        ret = HAL_BACKEND_TABLE.gcm_encrypt(&ctx, iv, iv_len, aad, aad_len,
+                                            input, length, output, tag, tag_len);
+        HAL_BACKEND_TABLE.gcm_free(&ctx);
+    }
     if (ret != 0) {
         ESP_LOGE(TAG, "AES GCM Encrypt Failed: -0x%04X", -ret);
     }
@@ -155,22 +548,74 @@ int hal_aes_gcm_decrypt(const uint8_t *key, const uint8_t *iv, size_t iv_len,
                         const uint8_t *aad, size_t aad_len,
                         const uint8_t *input, size_t length,
                         uint8_t *output, const uint8_t *tag, size_t tag_len) {
-    mbedtls_gcm_context ctx;
-    int ret;
+    hal_gcm_ctx_t ctx;
+    int ret = HAL_BACKEND_TABLE.gcm_setkey(&ctx, key);
+    if (ret == 0) {
+        ret = HAL_BACKEND_TABLE.gcm_decrypt(&ctx, iv, iv_len, aad, aad_len,
+                                            input, length, output, tag, tag_len);
+        HAL_BACKEND_TABLE.gcm_free(&ctx);
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "AES GCM Decrypt Failed: -0x%04X", -ret);
+    }
+    return ret;
+}
+
+int hal_aes_cbc_encrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length, uint8_t *output) {
+    if (length % 16 != 0) return HAL_BACKEND_ERR_BAD_INPUT;
+    return HAL_BACKEND_TABLE.cbc_encrypt(key, iv, input, length, output);
+}
+
+int hal_aes_cbc_decrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length, uint8_t *output) {
+    if (length % 16 != 0) return HAL_BACKEND_ERR_BAD_INPUT;
+    return HAL_BACKEND_TABLE.cbc_decrypt(key, iv, input, length, output);
+}
 
-    mbedtls_gcm_init(&ctx);
+hal_gcm_key_t *hal_gcm_key_create(const uint8_t *key) {
+    for (int i = 0; i < HAL_GCM_MAX_KEYS; i++) {
+        struct hal_gcm_key *k = &gcm_keys[i];
+        if (k->used) continue;
 
-    ret = mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 256);
-    if (ret != 0) goto exit;
+        int ret = HAL_BACKEND_TABLE.gcm_setkey(&k->ctx, key);
+        if (ret != 0) {
+            ESP_LOGE(TAG, "AES GCM Setkey Failed: -0x%04X", -ret);
+            return NULL;
+        }
+        k->lock = xSemaphoreCreateMutex();
+        k->used = true;
+        return k;
+    }
+    ESP_LOGE(TAG, "No free GCM key slot");
+    return NULL;
+}
 
-    ret = mbedtls_gcm_auth_decrypt(&ctx, length,
-                                   iv, iv_len, aad, aad_len,
-                                   tag, tag_len,
-                                   input, output);
+int hal_gcm_key_encrypt(hal_gcm_key_t *key, const uint8_t *iv, size_t iv_len,
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *input, size_t length,
+                        uint8_t *output, uint8_t *tag, size_t tag_len) {
+    if (!key) return HAL_BACKEND_ERR_BAD_INPUT;
 
-exit:
-    mbedtls_gcm_free(&ctx);
+    xSemaphoreTake(key->lock, portMAX_DELAY);
+    int ret = HAL_BACKEND_TABLE.gcm_encrypt(&key->ctx, iv, iv_len, aad, aad_len,
+                                            input, length, output, tag, tag_len);
+    xSemaphoreGive(key->lock);
     if (ret != 0) {
+        ESP_LOGE(TAG, "AES GCM Encrypt Failed: -0x%04X", -ret);
+    }
+    return ret;
+}
+
+int hal_gcm_key_decrypt(hal_gcm_key_t *key, const uint8_t *iv, size_t iv_len,
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *input, size_t length,
+                        uint8_t *output, const uint8_t *tag, size_t tag_len) {
+    if (!key) return HAL_BACKEND_ERR_BAD_INPUT;
+
+    xSemaphoreTake(key->lock, portMAX_DELAY);
+    int ret = HAL_BACKEND_TABLE.gcm_decrypt(&key->ctx, iv, iv_len, aad, aad_len,
+                                            input, length, output, tag, tag_len);
+    xSemaphoreGive(key->lock);
+    if (ret != 0 && ret != HAL_BACKEND_ERR_AUTH) {
         ESP_LOGE(TAG, "AES GCM Decrypt Failed: -0x%04X", -ret);
     }
     return ret;
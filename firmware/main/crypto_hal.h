@@ -4,17 +4,90 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// Seeds the process-wide DRBG and fills the RNG pool. Call once at boot,
+// before any other hal_* function.
+int hal_crypto_init(void);
+
 // RNG
+#define HAL_DRBG_RESEED_INTERVAL    1000 // DRBG requests between reseeds from the TRNG
+#define HAL_RNG_POOL_SIZE           256  // Prefilled bytes for IVs, nonces and keygen
+
 int hal_rng_generate(uint8_t *buf, size_t len);
+// Top the pool back up from the DRBG. Called from idle time.
+void hal_rng_refill(void);
 
 // SHA-256
 int hal_sha256(const uint8_t *input, size_t len, uint8_t output[32]);
 
+// SHA-256, incremental: hash each piece where it already sits instead of
+// concatenating into a staging buffer. A context can be cloned to finish
+// several messages that share a prefix. final() releases the context.
+typedef struct {
+    uint64_t opaque[20]; // Backend context (mbedtls_sha256_context), checked at build time
+} hal_sha256_ctx_t;
+
+int hal_sha256_init(hal_sha256_ctx_t *ctx);
+int hal_sha256_update(hal_sha256_ctx_t *ctx, const uint8_t *data, size_t len);
+int hal_sha256_final(hal_sha256_ctx_t *ctx, uint8_t output[32]);
+void hal_sha256_clone(hal_sha256_ctx_t *dst, const hal_sha256_ctx_t *src);
+
+// HMAC-SHA-256 (RFC 2104), over the SHA-256 above
+int hal_hmac_sha256(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t msg_len, uint8_t output[32]);
+
 // ECC P-256
 int hal_ecc_generate_keypair(uint8_t *private_key, uint8_t *public_key);
+// Same output, served from the idle-time keypair pool (falls back to generating inline)
+int hal_ecc_take_keypair(uint8_t *private_key, uint8_t *public_key);
+// Public key (0x04 | X | Y) of an existing private key
+int hal_ecc_public_key(const uint8_t *private_key, uint8_t *public_key);
+// ECDH: x coordinate of private_key times peer_public_key (0x04 | X | Y).
+// Fails for a peer key that is not on the curve.
+int hal_ecdh_p256(const uint8_t *private_key, const uint8_t *peer_public_key, uint8_t shared_x[32]);
+#define HAL_ECC_SIG_RAW_SIZE        64 // r || s
+#define HAL_ECC_SIG_DER_MAX         72
+#ifndef HAL_ECDSA_DETERMINISTIC
+#define HAL_ECDSA_DETERMINISTIC     0 // 1: RFC 6979 nonces instead of DRBG nonces
+#endif
+
+// Idle-time precomputation (crypto_idle task, started by hal_crypto_init).
+// Signing takes a precomputed (k^-1, r) if one is ready and falls back to a
+// full sign otherwise (nonces are not pooled with HAL_ECDSA_DETERMINISTIC).
+// hal_ecc_take_keypair() draws on a pool of pre-generated keypairs.
+#define HAL_NONCE_POOL_SIZE         4
+#define HAL_KEYPAIR_POOL_SIZE       4
+#define HAL_PRECOMPUTE_STACK        6144
+#define HAL_PRECOMPUTE_PRIORITY     (tskIDLE_PRIORITY + 1)
+
+// Entries currently ready in each pool (diagnostics, firmware/host benchmark)
+void hal_precompute_levels(size_t *nonces, size_t *keypairs);
+
+// Sign a 32-byte hash once, writing fixed-size r||s. Returns 0 on success.
+int hal_ecc_sign_raw(const uint8_t *private_key, const uint8_t *hash, uint8_t *sig_rs);
+
+// Long-lived private key (e.g. attestation), validated once and kept ready to sign
+#define HAL_ECC_MAX_KEYS            2
+typedef struct hal_ecc_key hal_ecc_key_t;
+hal_ecc_key_t *hal_ecc_key_create(const uint8_t *private_key);
+int hal_ecc_sign_key(const hal_ecc_key_t *key, const uint8_t *hash, uint8_t *sig_rs);
+// DER-encode r||s into at most HAL_ECC_SIG_DER_MAX bytes. Returns the length.
+int hal_ecdsa_sig_to_der(const uint8_t *sig_rs, uint8_t *der);
+// hal_ecc_sign_raw() + hal_ecdsa_sig_to_der(). Returns the DER length or a negative error.
 int hal_ecc_sign(const uint8_t *private_key, const uint8_t *hash, uint8_t *signature);
 
-// AES-256-GCM (To be implemented)
+// Signature algorithms, numbered by their COSE identifiers
+#define HAL_ALG_ES256               (-7)
+#define HAL_ALG_EDDSA               (-8)
+
+// Ed25519 (libsodium). The 32-byte seed is the private key; signing is
+// deterministic and needs no RNG.
+#define HAL_ED25519_PUB_SIZE        32
+#define HAL_ED25519_SIG_SIZE        64
+int hal_ed25519_generate_keypair(uint8_t *seed, uint8_t *public_key);
+int hal_ed25519_public_key(const uint8_t *seed, uint8_t *public_key);
+// PureEdDSA: signs the message itself, not a hash of it. Returns 0 on success.
+int hal_ed25519_sign(const uint8_t *seed, const uint8_t *msg, size_t msg_len, uint8_t *signature);
+
+// AES-256-GCM, one-shot (key schedule expanded per call)
 int hal_aes_gcm_encrypt(const uint8_t *key, const uint8_t *iv, size_t iv_len,
                         const uint8_t *aad, size_t aad_len,
                         const uint8_t *input, size_t length,
@@ -25,4 +98,27 @@ int hal_aes_gcm_decrypt(const uint8_t *key, const uint8_t *iv, size_t iv_len,
                         const uint8_t *input, size_t length,
                         uint8_t *output, const uint8_t *tag, size_t tag_len);
 
+// AES-256-CBC without padding: length must be a multiple of 16
+int hal_aes_cbc_encrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length, uint8_t *output);
+int hal_aes_cbc_decrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *input, size_t length, uint8_t *output);
+
+// AES-256-GCM with a long-lived key (key wrapping): the key schedule is
+// expanded once in hal_gcm_key_create() and reused by every call. Calls on
+// the same key are serialised internally.
+#ifndef HAL_GCM_MAX_KEYS
+#define HAL_GCM_MAX_KEYS            2 // Master key-wrap key and the keypair pool key
+#endif
+typedef struct hal_gcm_key hal_gcm_key_t;
+hal_gcm_key_t *hal_gcm_key_create(const uint8_t *key);
+int hal_gcm_key_encrypt(hal_gcm_key_t *key, const uint8_t *iv, size_t iv_len,
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *input, size_t length,
+                        uint8_t *output, uint8_t *tag, size_t tag_len);
+// Authentication failure is an expected outcome here (probing credential
+// lists) and is returned without logging.
+int hal_gcm_key_decrypt(hal_gcm_key_t *key, const uint8_t *iv, size_t iv_len,
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *input, size_t length,
+                        uint8_t *output, const uint8_t *tag, size_t tag_len);
+
 #endif // CRYPTO_HAL_H
@@ -0,0 +1,303 @@
+#include <string.h>
+#include "crypto_backend.h"
+
+// Known-answer vectors shared by every backend. Nothing here depends on
+// ESP-IDF, so the same file runs on the device and in firmware/host.
+
+// FIPS 180-2 (SHA-256)
+static const uint8_t sha_abc[32] = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+};
+static const char sha_448_msg[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+static const uint8_t sha_448[32] = {
+    0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+    0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1,
+};
+static const uint8_t sha_million_a[32] = {
+    0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+    0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e, 0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0,
+};
+
+// GCM spec (McGrew/Viega) test case 16: AES-256, 96-bit IV, AAD, 60-byte plaintext
+static const uint8_t gcm_key[32] = {
+    0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08,
+    0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08,
+};
+static const uint8_t gcm_iv[12] = {
+    0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
+};
+static const uint8_t gcm_aad[20] = {
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xab, 0xad, 0xda, 0xd2,
+};
+static const uint8_t gcm_pt[60] = {
+    0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+    0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+    0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+    0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39,
+};
+static const uint8_t gcm_ct[60] = {
+    0x52, 0x2d, 0xc1, 0xf0, 0x99, 0x56, 0x7d, 0x07, 0xf4, 0x7f, 0x37, 0xa3, 0x2a, 0x84, 0x42, 0x7d,
+    0x64, 0x3a, 0x8c, 0xdc, 0xbf, 0xe5, 0xc0, 0xc9, 0x75, 0x98, 0xa2, 0xbd, 0x25, 0x55, 0xd1, 0xaa,
+    0x8c, 0xb0, 0x8e, 0x48, 0x59, 0x0d, 0xbb, 0x3d, 0xa7, 0xb0, 0x8b, 0x10, 0x56, 0x82, 0x88, 0x38,
+    0xc5, 0xf6, 0x1e, 0x63, 0x93, 0xba, 0x7a, 0x0a, 0xbc, 0xc9, 0xf6, 0x62,
+};
+static const uint8_t gcm_tag[16] = {
+    0x76, 0xfc, 0x6e, 0xce, 0x0f, 0x4e, 0x17, 0x68, 0xcd, 0xdf, 0x88, 0x53, 0xbb, 0x2d, 0x55, 0x1b,
+};
+
+// SP 800-38A F.2.5 (CBC-AES256.Encrypt), first two blocks
+static const uint8_t cbc_key[32] = {
+    0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+    0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4,
+};
+static const uint8_t cbc_iv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+};
+static const uint8_t cbc_pt[32] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+};
+static const uint8_t cbc_ct[32] = {
+    0xf5, 0x8c, 0x4c, 0x04, 0xd6, 0xe5, 0xf1, 0xba, 0x77, 0x9e, 0xab, 0xfb, 0x5f, 0x7b, 0xfb, 0xd6,
+    0x9c, 0xfc, 0x4e, 0x96, 0x7e, 0xdb, 0x80, 0x8d, 0x67, 0x9f, 0x77, 0x7b, 0xc6, 0x70, 0x2c, 0x7d,
+};
+
+// RFC 6979 A.2.5: P-256 key, SHA-256 signature of "sample"
+static const uint8_t p256_priv[32] = {
+    0xc9, 0xaf, 0xa9, 0xd8, 0x45, 0xba, 0x75, 0x16, 0x6b, 0x5c, 0x21, 0x57, 0x67, 0xb1, 0xd6, 0x93,
+    0x4e, 0x50, 0xc3, 0xdb, 0x36, 0xe8, 0x9b, 0x12, 0x7b, 0x8a, 0x62, 0x2b, 0x12, 0x0f, 0x67, 0x21,
+};
+static const uint8_t p256_pub[65] = {
+    0x04,
+    0x60, 0xfe, 0xd4, 0xba, 0x25, 0x5a, 0x9d, 0x31, 0xc9, 0x61, 0xeb, 0x74, 0xc6, 0x35, 0x6d, 0x68,
+    0xc0, 0x49, 0xb8, 0x92, 0x3b, 0x61, 0xfa, 0x6c, 0xe6, 0x69, 0x62, 0x2e, 0x60, 0xf2, 0x9f, 0xb6,
+    0x79, 0x03, 0xfe, 0x10, 0x08, 0xb8, 0xbc, 0x99, 0xa4, 0x1a, 0xe9, 0xe9, 0x56, 0x28, 0xbc, 0x64,
+    0xf2, 0xf1, 0xb2, 0x0c, 0x2d, 0x7e, 0x9f, 0x51, 0x77, 0xa3, 0xc2, 0x94, 0xd4, 0x46, 0x22, 0x99,
+};
+static const uint8_t p256_sig_sample[64] = {
+    0xef, 0xd4, 0x8b, 0x2a, 0xac, 0xb6, 0xa8, 0xfd, 0x11, 0x40, 0xdd, 0x9c, 0xd4, 0x5e, 0x81, 0xd6,
+    0x9d, 0x2c, 0x87, 0x7b, 0x56, 0xaa, 0xf9, 0x91, 0xc3, 0x4d, 0x0e, 0xa8, 0x4e, 0xaf, 0x37, 0x16,
+    0xf7, 0xcb, 0x1c, 0x94, 0x2d, 0x65, 0x7c, 0x41, 0xd4, 0x36, 0xc7, 0xa1, 0xb6, 0xe2, 0x9f, 0x65,
+    0xf3, 0xe9, 0x00, 0xdb, 0xb9, 0xaf, 0xf4, 0x06, 0x4d, 0xc4, 0xab, 0x2f, 0x84, 0x3a, 0xcd, 0xa8,
+};
+
+// NIST CAVS 14.1 ECC CDH primitive, P-256 COUNT = 0
+static const uint8_t ecdh_peer[65] = {
+    0x04,
+    0x70, 0x0c, 0x48, 0xf7, 0x7f, 0x56, 0x58, 0x4c, 0x5c, 0xc6, 0x32, 0xca, 0x65, 0x64, 0x0d, 0xb9,
+    0x1b, 0x6b, 0xac, 0xce, 0x3a, 0x4d, 0xf6, 0xb4, 0x2c, 0xe7, 0xcc, 0x83, 0x88, 0x33, 0xd2, 0x87,
+    0xdb, 0x71, 0xe5, 0x09, 0xe3, 0xfd, 0x9b, 0x06, 0x0d, 0xdb, 0x20, 0xba, 0x5c, 0x51, 0xdc, 0xc5,
+    0x94, 0x8d, 0x46, 0xfb, 0xf6, 0x40, 0xdf, 0xe0, 0x44, 0x17, 0x82, 0xca, 0xb8, 0x5f, 0xa4, 0xac,
+};
+static const uint8_t ecdh_priv[32] = {
+    0x7d, 0x7d, 0xc5, 0xf7, 0x1e, 0xb2, 0x9d, 0xda, 0xf8, 0x0d, 0x62, 0x14, 0x63, 0x2e, 0xea, 0xe0,
+    0x3d, 0x90, 0x58, 0xaf, 0x1f, 0xb6, 0xd2, 0x2e, 0xd8, 0x0b, 0xad, 0xb6, 0x2b, 0xc1, 0xa5, 0x34,
+};
+static const uint8_t ecdh_z[32] = {
+    0x46, 0xfc, 0x62, 0x10, 0x64, 0x20, 0xff, 0x01, 0x2e, 0x54, 0xa4, 0x34, 0xfb, 0xdd, 0x2d, 0x25,
+    0xcc, 0xc5, 0x85, 0x20, 0x60, 0x56, 0x1e, 0x68, 0x04, 0x0d, 0xd7, 0x77, 0x89, 0x97, 0xbd, 0x7b,
+};
+
+// RFC 8032 7.1, TEST 2 (one-byte message)
+static const uint8_t ed_seed[32] = {
+    0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda, 0x9d, 0xb6, 0xc3, 0x46, 0xec, 0x11, 0x4e, 0x0f,
+    0x5b, 0x8a, 0x31, 0x9f, 0x35, 0xab, 0xa6, 0x24, 0xda, 0x8c, 0xf6, 0xed, 0x4f, 0xb8, 0xa6, 0xfb,
+};
+static const uint8_t ed_pub[32] = {
+    0x3d, 0x40, 0x17, 0xc3, 0xe8, 0x43, 0x89, 0x5a, 0x92, 0xb7, 0x0a, 0xa7, 0x4d, 0x1b, 0x7e, 0xbc,
+    0x9c, 0x98, 0x2c, 0xcf, 0x2e, 0xc4, 0x96, 0x8c, 0xc0, 0xcd, 0x55, 0xf1, 0x2a, 0xf4, 0x66, 0x0c,
+};
+static const uint8_t ed_msg[1] = {0x72};
+static const uint8_t ed_sig[64] = {
+    0x92, 0xa0, 0x09, 0xa9, 0xf0, 0xd4, 0xca, 0xb8, 0x72, 0x0e, 0x82, 0x0b, 0x5f, 0x64, 0x25, 0x40,
+    0xa2, 0xb2, 0x7b, 0x54, 0x16, 0x50, 0x3f, 0x8f, 0xb3, 0x76, 0x22, 0x23, 0xeb, 0xdb, 0x69, 0xda,
+    0x08, 0x5a, 0xc1, 0xe4, 0x3e, 0x15, 0x99, 0x6e, 0x45, 0x8f, 0x36, 0x13, 0xd0, 0xf1, 0x1d, 0x8c,
+    0x38, 0x7b, 0x2e, 0xae, 0xb4, 0x30, 0x2a, 0xee, 0xb0, 0x0d, 0x29, 0x16, 0x12, 0xbb, 0x0c, 0x00,
+};
+
+static int check_sha256(const hal_backend_t *b, const char **failed) {
+    hal_sha256_ctx_t ctx, prefix;
+    uint8_t out[32];
+
+    *failed = "sha256 abc";
+    b->sha256_init(&ctx);
+    b->sha256_update(&ctx, (const uint8_t *)"abc", 3);
+    if (b->sha256_final(&ctx, out) != 0 || memcmp(out, sha_abc, 32) != 0) return -1;
+
+    // Uneven pieces across block boundaries, and a clone taken mid-message
+    *failed = "sha256 448-bit";
+    b->sha256_init(&ctx);
+    b->sha256_update(&ctx, (const uint8_t *)sha_448_msg, 5);
+    b->sha256_clone(&prefix, &ctx);
+    b->sha256_update(&ctx, (const uint8_t *)sha_448_msg + 5, sizeof(sha_448_msg) - 1 - 5);
+    if (b->sha256_final(&ctx, out) != 0 || memcmp(out, sha_448, 32) != 0) return -1;
+
+    *failed = "sha256 clone";
+    b->sha256_update(&prefix, (const uint8_t *)sha_448_msg + 5, sizeof(sha_448_msg) - 1 - 5);
+    if (b->sha256_final(&prefix, out) != 0 || memcmp(out, sha_448, 32) != 0) return -1;
+
+    *failed = "sha256 million a";
+    uint8_t chunk[100];
+    memset(chunk, 'a', sizeof(chunk));
+    b->sha256_init(&ctx);
+    for (int i = 0; i < 10000; i++) {
+        b->sha256_update(&ctx, chunk, sizeof(chunk));
+    }
+    if (b->sha256_final(&ctx, out) != 0 || memcmp(out, sha_million_a, 32) != 0) return -1;
+    return 0;
+}
+
+static int check_gcm(const hal_backend_t *b, const char **failed) {
+    hal_gcm_ctx_t ctx;
+    uint8_t out[sizeof(gcm_pt)];
+    uint8_t tag[16];
+    int ret = -1;
+
+    *failed = "gcm setkey";
+    if (b->gcm_setkey(&ctx, gcm_key) != 0) return -1;
+
+    *failed = "gcm encrypt";
+    if (b->gcm_encrypt(&ctx, gcm_iv, sizeof(gcm_iv), gcm_aad, sizeof(gcm_aad), gcm_pt, sizeof(gcm_pt),
+                       out, tag, sizeof(tag)) != 0 ||
+        memcmp(out, gcm_ct, sizeof(gcm_ct)) != 0 || memcmp(tag, gcm_tag, sizeof(gcm_tag)) != 0) {
+        goto exit;
+    }
+
+    *failed = "gcm decrypt";
+    if (b->gcm_decrypt(&ctx, gcm_iv, sizeof(gcm_iv), gcm_aad, sizeof(gcm_aad), gcm_ct, sizeof(gcm_ct),
+                       out, gcm_tag, sizeof(gcm_tag)) != 0 ||
+        memcmp(out, gcm_pt, sizeof(gcm_pt)) != 0) {
+        goto exit;
+    }
+
+    // Truncated tags (key handles use 16, but callers may ask for less) and forgeries
+    *failed = "gcm truncated tag";
+    if (b->gcm_decrypt(&ctx, gcm_iv, sizeof(gcm_iv), gcm_aad, sizeof(gcm_aad), gcm_ct, sizeof(gcm_ct),
+                       out, gcm_tag, 12) != 0) {
+        goto exit;
+    }
+
+    *failed = "gcm bad tag";
+    uint8_t bad_tag[16];
+    memcpy(bad_tag, gcm_tag, sizeof(bad_tag));
+    bad_tag[15] ^= 0x01;
+    if (b->gcm_decrypt(&ctx, gcm_iv, sizeof(gcm_iv), gcm_aad, sizeof(gcm_aad), gcm_ct, sizeof(gcm_ct),
+                       out, bad_tag, sizeof(bad_tag)) != HAL_BACKEND_ERR_AUTH) {
+        goto exit;
+    }
+
+    *failed = "gcm bad aad";
+    if (b->gcm_decrypt(&ctx, gcm_iv, sizeof(gcm_iv), gcm_aad, sizeof(gcm_aad) - 1, gcm_ct, sizeof(gcm_ct),
+                       out, gcm_tag, sizeof(gcm_tag)) != HAL_BACKEND_ERR_AUTH) {
+        goto exit;
+    }
+    ret = 0;
+
+exit:
+    b->gcm_free(&ctx);
+    return ret;
+}
+
+static int check_cbc(const hal_backend_t *b, const char **failed) {
+    uint8_t out[sizeof(cbc_pt)];
+
+    *failed = "cbc encrypt";
+    if (b->cbc_encrypt(cbc_key, cbc_iv, cbc_pt, sizeof(cbc_pt), out) != 0 || memcmp(out, cbc_ct, sizeof(out)) != 0) {
+        return -1;
+    }
+
+    *failed = "cbc decrypt";
+    if (b->cbc_decrypt(cbc_key, cbc_iv, cbc_ct, sizeof(cbc_ct), out) != 0 || memcmp(out, cbc_pt, sizeof(out)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int check_p256(const hal_backend_t *b, const char **failed) {
+    uint8_t pub[65];
+    uint8_t hash[32];
+    hal_sha256_ctx_t ctx;
+
+    *failed = "p256 public key";
+    if (b->p256_public_key(p256_priv, pub) != 0 || memcmp(pub, p256_pub, sizeof(pub)) != 0) return -1;
+
+    *failed = "p256 verify";
+    b->sha256_init(&ctx);
+    b->sha256_update(&ctx, (const uint8_t *)"sample", 6);
+    b->sha256_final(&ctx, hash);
+    if (b->p256_verify(p256_pub, hash, p256_sig_sample) != 0) return -1;
+
+    *failed = "p256 verify rejects";
+    hash[0] ^= 0x01;
+    if (b->p256_verify(p256_pub, hash, p256_sig_sample) == 0) return -1;
+    return 0;
+}
+
+// Signatures use random nonces, so these round-trip through p256_verify
+// instead of matching fixed bytes. Needs init() and hal_rng_generate().
+static int check_p256_sign(const hal_backend_t *b, const char **failed) {
+    uint8_t priv[32], pub[65], pub2[65];
+    uint8_t ktinv[32], t[32], r[32];
+    uint8_t sig[64];
+    uint8_t hash[32];
+    int ret = -1;
+
+    memset(hash, 0xA5, sizeof(hash));
+
+    *failed = "p256 keygen";
+    if (b->p256_keygen(priv, pub) != 0 || b->p256_check_key(priv) != 0) goto exit;
+    if (b->p256_public_key(priv, pub2) != 0 || memcmp(pub, pub2, sizeof(pub)) != 0) goto exit;
+
+    *failed = "p256 check_key rejects";
+    if (b->p256_check_key((const uint8_t[32]){0}) == 0) goto exit;
+
+    *failed = "p256 sign";
+    if (b->p256_sign(priv, hash, sig) != 0 || b->p256_verify(pub, hash, sig) != 0) goto exit;
+
+    *failed = "p256 sign with precomputed nonce";
+    if (b->p256_nonce(ktinv, t, r) != 0 || b->p256_sign_nonce(priv, hash, ktinv, t, r, sig) != 0) goto exit;
+    if (memcmp(sig, r, sizeof(r)) != 0 || b->p256_verify(pub, hash, sig) != 0) goto exit;
+
+    // Shares the signing group, so it also waits for init()
+    *failed = "p256 ecdh";
+    uint8_t z[32];
+    if (b->p256_ecdh(ecdh_priv, ecdh_peer, z) != 0 || memcmp(z, ecdh_z, sizeof(z)) != 0) goto exit;
+
+    *failed = "p256 ecdh rejects off-curve";
+    uint8_t off_curve[65];
+    memcpy(off_curve, ecdh_peer, sizeof(off_curve));
+    off_curve[64] ^= 0x01;
+    if (b->p256_ecdh(ecdh_priv, off_curve, z) == 0) goto exit;
+    ret = 0;
+
+exit:
+    memset(priv, 0, sizeof(priv));
+    memset(ktinv, 0, sizeof(ktinv));
+    memset(t, 0, sizeof(t));
+    return ret;
+}
+
+static int check_ed25519(const hal_backend_t *b, const char **failed) {
+    uint8_t pub[32];
+    uint8_t sig[64];
+
+    *failed = "ed25519 public key";
+    if (b->ed25519_public_key(ed_seed, pub) != 0 || memcmp(pub, ed_pub, sizeof(pub)) != 0) return -1;
+
+    *failed = "ed25519 sign";
+    if (b->ed25519_sign(ed_seed, ed_msg, sizeof(ed_msg), sig) != 0 || memcmp(sig, ed_sig, sizeof(sig)) != 0) return -1;
+    return 0;
+}
+
+int hal_backend_selftest(const hal_backend_t *b, const char **failed) {
+    if (check_sha256(b, failed) != 0) return -1;
+    if (check_gcm(b, failed) != 0) return -1;
+    if (check_cbc(b, failed) != 0) return -1;
+    if (check_p256(b, failed) != 0) return -1;
+    if (check_p256_sign(b, failed) != 0) return -1;
+    if (check_ed25519(b, failed) != 0) return -1;
+    *failed = NULL;
+    return 0;
+}
@@ -2,7 +2,12 @@
 #include "cbor_minimal.h"
 #include "u2f.h" // For send_response
 #include "crypto_hal.h"
+#include "user_presence.h"
+#include "cred_store.h"
+#include "counter_store.h"
+#include "client_pin.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <string.h>
 
 static const char *TAG = "CTAP2";
@@ -10,42 +15,449 @@ static const char *TAG = "CTAP2";
 // AAGUID (16 bytes) - Zero for generic
 static const uint8_t aaguid[16] = {0};
 
-static void send_ctap2_response(uint32_t cid, uint8_t status, uint8_t *data, size_t len) {
-    uint8_t resp[1024];
-    resp[0] = status;
-    if (len > 0) {
-        memcpy(&resp[1], data, len);
+static void send_ctap2_response(uint32_t cid, uint8_t status, const uint8_t *data, size_t len) {
+    // Status byte and CBOR body go out as separate segments, no staging copy
+    const u2f_hid_segment_t segs[] = {
+        {&status, 1},
+        {data, (uint16_t)len},
+    };
+    u2f_send_segments(cid, U2FHID_CBOR, segs, 2);
+}
+
+// Responses are encoded straight into the buffer the HID layer packetizes
+// from, behind the status byte. Only the worker task handles CTAP2.
+static uint8_t resp_buf[1 + CTAP2_MAX_RESPONSE_SIZE];
+
+static void response_begin(cbor_encoder_t *enc) {
+    cbor_encoder_init(enc, &resp_buf[1], CTAP2_MAX_RESPONSE_SIZE);
+}
+
+static void response_send(uint32_t cid, const cbor_encoder_t *enc) {
+    if (enc->error) {
+        ESP_LOGE(TAG, "Response needs %u bytes, have %u", (unsigned)enc->offset, CTAP2_MAX_RESPONSE_SIZE);
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return;
+    }
+    resp_buf[0] = CTAP2_OK;
+    const u2f_hid_segment_t seg = {resp_buf, (uint16_t)(1 + enc->offset)};
+    u2f_send_segments(cid, U2FHID_CBOR, &seg, 1);
+}
+
+// Wait for the button with KEEPALIVE reporting UPNEEDED, as the host expects
+static uint8_t wait_user_presence(void) {
+    u2f_hid_set_keepalive_status(U2FHID_STATUS_UPNEEDED);
+    up_result_t res = up_wait(CTAP2_UP_TIMEOUT_MS);
+    u2f_hid_set_keepalive_status(U2FHID_STATUS_PROCESSING);
+
+    switch (res) {
+        case UP_OK:
+            return CTAP2_OK;
+        case UP_CANCELLED:
+            return CTAP2_ERR_KEEPALIVE_CANCEL;
+        default:
+            return CTAP2_ERR_USER_ACTION_TIMEOUT;
+    }
+}
+
+// Request schemas. Each command's map is decoded in one pass into a typed
+// struct; nested entities reuse the same decoder.
+static uint8_t schema_status(cbor_schema_result_t res) {
+    switch (res) {
+        case CBOR_SCHEMA_OK: return CTAP2_OK;
+        case CBOR_SCHEMA_MISSING: return CTAP2_ERR_MISSING_PARAM;
+        case CBOR_SCHEMA_TYPE: return CTAP2_ERR_CBOR_UNEXPECTED_TYPE;
+        case CBOR_SCHEMA_LENGTH: return CTAP2_ERR_LIMIT_EXCEEDED;
+        default: return CTAP2_ERR_INVALID_CBOR;
     }
-    // Send as U2FHID_CBOR (0x90)
-    // Note: u2f.c send_response expects CMD. U2FHID_CBOR is 0x90.
-    // We need to expose a way to send generic HID commands or reuse u2f_send_response
-    // Assuming u2f.c has a public send function or we modify it.
-    // For now, we'll assume u2f.c handles the framing if we pass the right CMD.
-    // But u2f.c's send_response is static. We'll need to fix that or duplicate logic.
-    // Let's assume we can call a public version.
+}
+
+#define DECODE_SCHEMA(dec, fields, out) \
+    schema_status(cbor_decode_schema((dec), (fields), sizeof(fields) / sizeof((fields)[0]), (out), NULL))
+
+typedef struct {
+    cbor_item_t client_data_hash;
+    cbor_item_t rp;
+    cbor_item_t user;
+    cbor_item_t pub_key_cred_params;
+    cbor_item_t exclude_list;
+    cbor_item_t options;
+    cbor_item_t pin_auth;
+    uint64_t pin_protocol;
+} make_credential_req_t;
+
+static const cbor_field_t make_credential_schema[] = {
+    CBOR_FIELD(0x01, CBOR_BYTES, true, make_credential_req_t, client_data_hash, 0),
+    CBOR_FIELD(0x02, CBOR_MAP, true, make_credential_req_t, rp, 0),
+    CBOR_FIELD(0x03, CBOR_MAP, true, make_credential_req_t, user, 0),
+    CBOR_FIELD(0x04, CBOR_ARRAY, true, make_credential_req_t, pub_key_cred_params, 0),
+    CBOR_FIELD(0x05, CBOR_ARRAY, false, make_credential_req_t, exclude_list, CTAP2_MAX_CRED_COUNT_IN_LIST),
+    CBOR_FIELD(0x07, CBOR_MAP, false, make_credential_req_t, options, 0),
+    CBOR_FIELD(0x08, CBOR_BYTES, false, make_credential_req_t, pin_auth, 0),
+    CBOR_FIELD(0x09, CBOR_UINT, false, make_credential_req_t, pin_protocol, 0),
+};
+
+typedef struct {
+    cbor_item_t rp_id;
+    cbor_item_t client_data_hash;
+    cbor_item_t allow_list;
+    cbor_item_t pin_auth;
+    uint64_t pin_protocol;
+} get_assertion_req_t;
+
+static const cbor_field_t get_assertion_schema[] = {
+    CBOR_FIELD(0x01, CBOR_TEXT, true, get_assertion_req_t, rp_id, 0),
+    CBOR_FIELD(0x02, CBOR_BYTES, true, get_assertion_req_t, client_data_hash, 0),
+    CBOR_FIELD(0x03, CBOR_ARRAY, false, get_assertion_req_t, allow_list, CTAP2_MAX_CRED_COUNT_IN_LIST),
+    CBOR_FIELD(0x06, CBOR_BYTES, false, get_assertion_req_t, pin_auth, 0),
+    CBOR_FIELD(0x07, CBOR_UINT, false, get_assertion_req_t, pin_protocol, 0),
+};
+
+// PublicKeyCredentialRpEntity: only "id" is used
+typedef struct {
+    cbor_item_t id;
+} rp_entity_t;
+
+static const cbor_field_t rp_entity_schema[] = {
+    CBOR_TEXT_FIELD("id", CBOR_TEXT, true, rp_entity_t, id, 0),
+};
+
+// PublicKeyCredentialUserEntity: only the user handle is kept
+typedef struct {
+    cbor_item_t id;
+} user_entity_t;
+
+static const cbor_field_t user_entity_schema[] = {
+    CBOR_TEXT_FIELD("id", CBOR_BYTES, true, user_entity_t, id, CRED_STORE_USER_ID_MAX),
+};
+
+// MakeCredential options, absent ones false
+typedef struct {
+    bool rk;
+    bool uv;
+} make_credential_options_t;
+
+static const cbor_field_t make_credential_options_schema[] = {
+    CBOR_TEXT_FIELD("rk", CBOR_FIELD_BOOL, false, make_credential_options_t, rk, 0),
+    CBOR_TEXT_FIELD("uv", CBOR_FIELD_BOOL, false, make_credential_options_t, uv, 0),
+};
+
+// PublicKeyCredentialDescriptor; transports are skipped
+typedef struct {
+    cbor_item_t id;
+    cbor_item_t type;
+} cred_descriptor_t;
+
+static const cbor_field_t cred_descriptor_schema[] = {
+    CBOR_TEXT_FIELD("id", CBOR_BYTES, true, cred_descriptor_t, id, 0),
+    CBOR_TEXT_FIELD("type", CBOR_TEXT, true, cred_descriptor_t, type, 0),
+};
+
+// PublicKeyCredentialParameters
+typedef struct {
+    int64_t alg;
+    cbor_item_t type;
+} cred_param_t;
+
+static const cbor_field_t cred_param_schema[] = {
+    CBOR_TEXT_FIELD("alg", CBOR_FIELD_INT, true, cred_param_t, alg, 0),
+    CBOR_TEXT_FIELD("type", CBOR_TEXT, true, cred_param_t, type, 0),
+};
+
+static bool is_public_key(const cbor_item_t *type) {
+    return type->len == 10 && memcmp(type->data, "public-key", 10) == 0;
+}
+
+// clientDataHash is always exactly 32 bytes
+static uint8_t check_client_data_hash(const cbor_item_t *cdh) {
+    return cdh->len == 32 ? CTAP2_OK : CTAP2_ERR_INVALID_CBOR;
+}
+
+// allowList / excludeList, the IDs point into the request buffer
+typedef struct {
+    u2f_key_handle_ref_t ids[CTAP2_MAX_CRED_COUNT_IN_LIST];
+    size_t count;
+} cred_list_t;
+
+// The count was bounded by the schema; an absent list is empty
+static uint8_t parse_cred_list(const cbor_item_t *item, cred_list_t *list) {
+    cbor_decoder_t dec;
+    size_t count;
+    list->count = 0;
+    if (!item->data) return CTAP2_OK;
+    cbor_item_decoder(item, &dec);
+    cbor_decode_array_header(&dec, &count);
     
-    // HACK: calling internal static function is impossible. 
-    // We will rely on u2f.c to expose a public sender or handle it there.
-    // For this file, let's assume `u2f_send_hid_msg(cid, cmd, data, len)` exists.
-    // I will add `u2f_send_response` to u2f.h
+    for (size_t j = 0; j < item->count; j++) {
+        cred_descriptor_t desc = {0};
+        uint8_t status = DECODE_SCHEMA(&dec, cred_descriptor_schema, &desc);
+        if (status != CTAP2_OK) return status;
+        
+        // IDs longer than any we issue cannot be ours
+        if (is_public_key(&desc.type) && desc.id.len <= CTAP2_MAX_CRED_ID_LENGTH) {
+            list->ids[list->count].data = desc.id.data;
+            list->ids[list->count].len = (uint8_t)desc.id.len;
+            list->count++;
+        }
+    }
+    return CTAP2_OK;
+}
+
+// pubKeyCredParams: the first entry we support, in the platform's order of preference
+static uint8_t parse_cred_params(const cbor_item_t *item, int32_t *alg) {
+    cbor_decoder_t dec;
+    size_t count;
+    *alg = 0;
+    cbor_item_decoder(item, &dec);
+    cbor_decode_array_header(&dec, &count);
     
-    // u2f.h is included, so we can call it directly.
-    u2f_send_response(cid, 0x90, resp, 1 + len); // 0x90 = U2FHID_CBOR
+    for (size_t j = 0; j < item->count; j++) {
+        cred_param_t param = {0};
+        uint8_t status = DECODE_SCHEMA(&dec, cred_param_schema, &param);
+        if (status != CTAP2_OK) return status;
+        
+        if (*alg == 0 && is_public_key(&param.type) &&
+            (param.alg == HAL_ALG_ES256 || param.alg == HAL_ALG_EDDSA)) {
+            *alg = (int32_t)param.alg;
+        }
+    }
+    return *alg != 0 ? CTAP2_OK : CTAP2_ERR_UNSUPPORTED_ALGORITHM;
 }
 
-static void handle_get_info(uint32_t cid) {
-    uint8_t buf[512];
+static uint8_t parse_rp_id(const cbor_item_t *rp, cbor_item_t *rp_id) {
+    cbor_decoder_t dec;
+    rp_entity_t entity = {0};
+    cbor_item_decoder(rp, &dec);
+    uint8_t status = DECODE_SCHEMA(&dec, rp_entity_schema, &entity);
+    *rp_id = entity.id;
+    return status;
+}
+
+static uint8_t parse_user_id(const cbor_item_t *user, cbor_item_t *user_id) {
+    cbor_decoder_t dec;
+    user_entity_t entity = {0};
+    cbor_item_decoder(user, &dec);
+    uint8_t status = DECODE_SCHEMA(&dec, user_entity_schema, &entity);
+    *user_id = entity.id;
+    return status;
+}
+
+// There is no built-in user verification; a PIN is verified through pinAuth
+static uint8_t parse_options(const cbor_item_t *item, make_credential_options_t *options) {
+    cbor_decoder_t dec;
+    memset(options, 0, sizeof(*options));
+    if (!item->data) return CTAP2_OK;
+    cbor_item_decoder(item, &dec);
+    uint8_t status = DECODE_SCHEMA(&dec, make_credential_options_schema, options);
+    if (status == CTAP2_OK && options->uv) status = CTAP2_ERR_UNSUPPORTED_OPTION;
+    return status;
+}
+
+// Streaming prefetch. While a long request is still arriving, the worker
+// feeds each received prefix through ctap2_stream_feed(): top-level entries
+// are consumed once complete, rpId is hashed and allowList/excludeList
+// descriptors are unwrapped one by one as they land. The handlers reuse
+// whatever refers to the same bytes of the same transaction and compute
+// the rest, so a request that arrives in one packet is handled as before.
+typedef struct {
+    uint32_t txn;
+    const uint8_t *msg;         // HID payload, command byte first
+    size_t offset;              // Next unconsumed byte of the request map
+    size_t entries;             // Top-level entries left
+    size_t list_items;          // Descriptors left in the list being walked
+    bool started;               // Map header consumed
+    bool in_list;
+    bool done;
+    const uint8_t *rp_id;       // Where rpId sits in the request, once hashed
+    size_t rp_id_len;
+    uint8_t app_param[32];
+    const uint8_t *list;        // List head, as cbor_item_t.data
+    bool list_done;             // Every descriptor tried, in order, under app_param
+    const uint8_t *found_id;    // First one that unwrapped
+    uint8_t found_key[32];
+    int32_t found_alg;
+} cred_stream_t;
+
+static cred_stream_t stream;
+
+void ctap2_stream_reset(void) {
+    memset(&stream, 0, sizeof(stream)); // Includes found_key
+}
+
+static void stream_rp_id(uint8_t cmd, cbor_decoder_t *value) {
+    cbor_item_t rp_id;
+    if (cmd == CTAP2_GET_ASSERTION) {
+        const char *text;
+        if (!cbor_decode_text(value, &text, &rp_id.len)) return;
+        rp_id.data = (const uint8_t *)text;
+    } else {
+        rp_entity_t entity = {0};
+        if (DECODE_SCHEMA(value, rp_entity_schema, &entity) != CTAP2_OK) return;
+        rp_id = entity.id;
+    }
+    hal_sha256(rp_id.data, rp_id.len, stream.app_param);
+    stream.rp_id = rp_id.data;
+    stream.rp_id_len = rp_id.len;
+}
+
+static void stream_descriptor(const cred_descriptor_t *desc) {
+    if (stream.found_id || !is_public_key(&desc->type) || desc->id.len > CTAP2_MAX_CRED_ID_LENGTH) return;
+    const u2f_key_handle_ref_t ref = {desc->id.data, (uint8_t)desc->id.len};
+    if (u2f_unwrap_first(stream.app_param, &ref, 1, stream.found_key, &stream.found_alg) == 0) {
+        stream.found_id = desc->id.data;
+    }
+}
+
+void ctap2_stream_feed(uint32_t txn, const uint8_t *msg, size_t received) {
+    if (stream.msg != msg || stream.txn != txn) {
+        ctap2_stream_reset();
+        stream.txn = txn;
+        stream.msg = msg;
+    }
+    if (stream.done || received < 1) return;
+
+    // Where rpId and the credential list sit in each command's map
+    uint8_t cmd = msg[0];
+    int64_t rp_key, list_key;
+    if (cmd == CTAP2_GET_ASSERTION) {
+        rp_key = 0x01;
+        list_key = 0x03;
+    } else if (cmd == CTAP2_MAKE_CREDENTIAL) {
+        rp_key = 0x02;
+        list_key = 0x05;
+    } else {
+        stream.done = true;
+        return;
+    }
+
+    // Anything that does not decode yet is retried with more bytes; if it
+    // is malformed for good, the handler reports it
+    cbor_decoder_t dec;
+    cbor_decoder_init(&dec, msg + 1, received - 1);
+    dec.offset = stream.offset;
+    if (!stream.started) {
+        if (!cbor_decode_map_header(&dec, &stream.entries)) return;
+        stream.started = true;
+    }
+
+    while (stream.in_list || stream.entries > 0) {
+        if (stream.in_list) {
+            if (stream.list_items == 0) {
+                stream.in_list = false;
+                stream.list_done = true;
+                stream.entries--;
+                continue;
+            }
+            cred_descriptor_t desc = {0};
+            if (DECODE_SCHEMA(&dec, cred_descriptor_schema, &desc) != CTAP2_OK) break;
+            stream.list_items--;
+            stream_descriptor(&desc);
+            continue;
+        }
+
+        size_t entry = dec.offset;
+        int64_t key;
+        if (!cbor_decode_int(&dec, &key)) break;
+
+        // The list is walked item by item, once its rpId is known
+        size_t count;
+        if (key == list_key && stream.rp_id && !stream.list && cbor_peek_major_type(&dec) == CBOR_ARRAY) {
+            size_t head = dec.offset;
+            if (!cbor_decode_array_header(&dec, &count)) {
+                dec.offset = entry;
+                break;
+            }
+            if (count <= CTAP2_MAX_CRED_COUNT_IN_LIST) {
+                stream.list = dec.buf + head;
+                stream.list_items = count;
+                stream.in_list = true;
+                continue;
+            }
+            dec.offset = head; // Over the limit: skipped whole, the handler rejects it
+        }
+
+        cbor_decoder_t value = dec;
+        if (!cbor_skip(&dec)) {
+            dec.offset = entry;
+            break;
+        }
+        stream.entries--;
+        if (key == rp_key && !stream.rp_id) stream_rp_id(cmd, &value);
+    }
+
+    stream.offset = dec.offset;
+    stream.done = !stream.in_list && stream.entries == 0;
+}
+
+// SHA-256 of rpId, unless the stream already hashed this one
+static void hash_rp_id(const cbor_item_t *rp_id, uint8_t *app_param) {
+    if (stream.rp_id && stream.rp_id == rp_id->data && stream.rp_id_len == rp_id->len) {
+        memcpy(app_param, stream.app_param, 32);
+        return;
+    }
+    hal_sha256(rp_id->data, rp_id->len, app_param);
+}
+
+// u2f_unwrap_first() over the list, unless the stream already walked it
+static int unwrap_first(const uint8_t *app_param, const cbor_item_t *item, const cred_list_t *list,
+                        uint8_t *private_key, int32_t *alg) {
+    if (stream.list_done && item->data == stream.list && memcmp(app_param, stream.app_param, 32) == 0) {
+        int found = -1;
+        for (size_t i = 0; stream.found_id && i < list->count; i++) {
+            if (list->ids[i].data == stream.found_id) {
+                memcpy(private_key, stream.found_key, 32);
+                *alg = stream.found_alg;
+                found = (int)i;
+                break;
+            }
+        }
+        memset(stream.found_key, 0, sizeof(stream.found_key));
+        return found;
+    }
+    return u2f_unwrap_first(app_param, list->ids, list->count, private_key, alg);
+}
+
+// COSE_Key for a new credential, or with CLIENT_PIN_COSE_ALG the clientPIN
+// key agreement key. With a NULL-buffer encoder this is the sizing pass that
+// gives the attested credential data length up front.
+static void encode_cose_key(cbor_encoder_t *enc, int32_t alg, const uint8_t *pub_key) {
+    if (alg == HAL_ALG_EDDSA) {
+        // { 1:1 (OKP), 3:-8 (EdDSA), -1:6 (Ed25519), -2:X }
+        cbor_encode_map_start(enc, 4);
+        cbor_encode_uint(enc, 1); cbor_encode_uint(enc, 1);
+        cbor_encode_uint(enc, 3); cbor_encode_int(enc, HAL_ALG_EDDSA);
+        cbor_encode_int(enc, -1); cbor_encode_uint(enc, 6);
+        cbor_encode_int(enc, -2); cbor_encode_bytes(enc, pub_key, 32);
+        return;
+    }
+
+    // { 1:2 (EC2), 3:alg, -1:1 (P-256), -2:X, -3:Y }
+    cbor_encode_map_start(enc, 5);
+    cbor_encode_uint(enc, 1); cbor_encode_uint(enc, 2);
+    cbor_encode_uint(enc, 3); cbor_encode_int(enc, alg);
+    cbor_encode_int(enc, -1); cbor_encode_uint(enc, 1);
+    cbor_encode_int(enc, -2); cbor_encode_bytes(enc, &pub_key[1], 32);
+    cbor_encode_int(enc, -3); cbor_encode_bytes(enc, &pub_key[33], 32);
+}
+
+// GetInfo only changes with configuration, so it is encoded once and sent
+// from here as is. Anything that changes what it reports calls
+// ctap2_get_info_invalidate().
+static uint8_t info_buf[CTAP2_INFO_MAX_SIZE];
+static size_t info_len = 0;
+static bool info_valid = false;
+
+static void build_get_info(void) {
     cbor_encoder_t enc;
-    cbor_encoder_init(&enc, buf, sizeof(buf));
+    cbor_encoder_init(&enc, info_buf, sizeof(info_buf));
     
-    // Map(4)
-    cbor_encode_map_start(&enc, 4);
+    // Map(8)
+    cbor_encode_map_start(&enc, 8);
     
     // 1: Versions ["FIDO_2_0", "U2F_V2"]
     cbor_encode_uint(&enc, 0x01);
     cbor_encode_array_start(&enc, 2);
-    cbor_encode_text(&enc, "FIDO_2_0");
-    cbor_encode_text(&enc, "U2F_V2");
+    cbor_encode_text_lit(&enc, "FIDO_2_0");
+    cbor_encode_text_lit(&enc, "U2F_V2");
     
     // 2: Extensions []
     cbor_encode_uint(&enc, 0x02);
@@ -55,361 +467,849 @@ static void handle_get_info(uint32_t cid) {
     cbor_encode_uint(&enc, 0x03);
     cbor_encode_bytes(&enc, aaguid, 16);
     
-    // 4: Options { "rk": true, "up": true }
+    // 4: Options { "rk": true, "up": true, "clientPin": set?, "credMgmt": true }
     cbor_encode_uint(&enc, 0x04);
-    cbor_encode_map_start(&enc, 2);
-    cbor_encode_text(&enc, "rk");
-    cbor_encode_uint(&enc, 1); // true
-    cbor_encode_text(&enc, "up");
-    cbor_encode_uint(&enc, 1); // true
+    cbor_encode_map_start(&enc, 4);
+    cbor_encode_text_lit(&enc, "rk");
+    cbor_encode_bool(&enc, true);
+    cbor_encode_text_lit(&enc, "up");
+    cbor_encode_bool(&enc, true);
+    cbor_encode_text_lit(&enc, "clientPin");
+    cbor_encode_bool(&enc, client_pin_is_set());
+    cbor_encode_text_lit(&enc, "credMgmt");
+    cbor_encode_bool(&enc, true);
+    
+    // 6: pinProtocols [1]
+    cbor_encode_uint(&enc, 0x06);
+    cbor_encode_array_start(&enc, 1);
+    cbor_encode_uint(&enc, CLIENT_PIN_PROTOCOL);
+    
+    // 7: maxCredentialCountInList, 8: maxCredentialIdLength
+    // Lets the platform send a whole allowList/excludeList in one request
+    cbor_encode_uint(&enc, 0x07);
+    cbor_encode_uint(&enc, CTAP2_MAX_CRED_COUNT_IN_LIST);
+    cbor_encode_uint(&enc, 0x08);
+    cbor_encode_uint(&enc, CTAP2_MAX_CRED_ID_LENGTH);
+    
+    // 10: algorithms, in our order of preference
+    static const int32_t algs[] = {HAL_ALG_ES256, HAL_ALG_EDDSA};
+    cbor_encode_uint(&enc, 0x0A);
+    cbor_encode_array_start(&enc, 2);
+    for (size_t i = 0; i < 2; i++) {
+        cbor_encode_map_start(&enc, 2);
+        cbor_encode_text_lit(&enc, "alg");
+        cbor_encode_int(&enc, algs[i]);
+        cbor_encode_text_lit(&enc, "type");
+        cbor_encode_text_lit(&enc, "public-key");
+    }
     
-    send_ctap2_response(cid, CTAP2_OK, buf, enc.offset);
+    if (enc.error) {
+        ESP_LOGE(TAG, "GetInfo needs %u bytes, have %u", (unsigned)enc.offset, CTAP2_INFO_MAX_SIZE);
+        info_len = 0;
+        return;
+    }
+    info_len = enc.offset;
+    info_valid = true;
+}
+
+void ctap2_init(void) {
+    client_pin_init();
+    build_get_info();
+}
+
+void ctap2_get_info_invalidate(void) {
+    info_valid = false;
+}
+
+static void handle_get_info(uint32_t cid) {
+    if (!info_valid) build_get_info();
+    if (!info_valid) {
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return;
+    }
+    send_ctap2_response(cid, CTAP2_OK, info_buf, info_len);
+}
+
+// Signature over authData || clientDataHash with a credential key. EdDSA
+// signs the message itself, so clientDataHash is copied in behind authData:
+// the caller leaves 32 bytes of room there. Returns the length, or -1.
+static int sign_auth_data(int32_t alg, const uint8_t *priv_key, uint8_t *auth_data, size_t ad_len,
+                          const uint8_t *client_data_hash, uint8_t *signature) {
+    if (alg == HAL_ALG_EDDSA) {
+        memcpy(&auth_data[ad_len], client_data_hash, 32);
+        return hal_ed25519_sign(priv_key, auth_data, ad_len + 32, signature) == 0 ? HAL_ED25519_SIG_SIZE : -1;
+    }
+    hal_sha256_ctx_t sha;
+    uint8_t sig_hash[32];
+    hal_sha256_init(&sha);
+    hal_sha256_update(&sha, auth_data, ad_len);
+    hal_sha256_update(&sha, client_data_hash, 32);
+    hal_sha256_final(&sha, sig_hash);
+    return hal_ecc_sign(priv_key, sig_hash, signature);
+}
+
+// pinAuth as MakeCredential and GetAssertion carry it: LEFT(HMAC(pinToken,
+// clientDataHash), 16). An empty one asks, after a touch, whether a PIN is
+// set. uv tells whether one was verified.
+static uint8_t check_pin_auth(const cbor_item_t *pin_auth, uint64_t pin_protocol, const uint8_t *client_data_hash,
+                              bool *uv) {
+    *uv = false;
+    if (!pin_auth->data) return CTAP2_OK;
+    if (pin_auth->len == 0) {
+        uint8_t status = wait_user_presence();
+        if (status != CTAP2_OK) return status;
+        return client_pin_is_set() ? CTAP2_ERR_PIN_INVALID : CTAP2_ERR_PIN_NOT_SET;
+    }
+    if (pin_protocol != CLIENT_PIN_PROTOCOL) return CTAP2_ERR_PIN_AUTH_INVALID;
+    uint8_t status = client_pin_verify(client_data_hash, 32, pin_auth->data, pin_auth->len);
+    *uv = status == CTAP2_OK;
+    return status;
 }
 
 static void handle_make_credential(uint32_t cid, uint8_t *payload, size_t len) {
     cbor_decoder_t dec;
+    make_credential_req_t req = {0};
+    make_credential_options_t options;
+    cbor_item_t rp_id;
+    cbor_item_t user_id;
+    cred_list_t exclude_list;
+    int32_t alg;
+    bool uv;
     cbor_decoder_init(&dec, payload, len);
-    
-    size_t map_size;
-    if (!cbor_decode_map_header(&dec, &map_size)) {
-        send_ctap2_response(cid, CTAP2_ERR_INVALID_CBOR, NULL, 0);
+    uint8_t status = DECODE_SCHEMA(&dec, make_credential_schema, &req);
+    if (status == CTAP2_OK) status = check_client_data_hash(&req.client_data_hash);
+    if (status == CTAP2_OK) status = parse_rp_id(&req.rp, &rp_id);
+    if (status == CTAP2_OK) status = parse_user_id(&req.user, &user_id);
+    if (status == CTAP2_OK) status = parse_options(&req.options, &options);
+    if (status == CTAP2_OK) status = parse_cred_params(&req.pub_key_cred_params, &alg);
+    if (status == CTAP2_OK) status = parse_cred_list(&req.exclude_list, &exclude_list);
+    if (status == CTAP2_OK) status = check_pin_auth(&req.pin_auth, req.pin_protocol, req.client_data_hash.data, &uv);
+    // Once a PIN is set, no credential is made without it
+    if (status == CTAP2_OK && !req.pin_auth.data && client_pin_is_set()) status = CTAP2_ERR_PIN_REQUIRED;
+    if (status != CTAP2_OK) {
+        send_ctap2_response(cid, status, NULL, 0);
         return;
     }
+    const uint8_t *client_data_hash = req.client_data_hash.data;
     
-    uint8_t client_data_hash[32] = {0};
-    char rp_id[64] = {0};
+    // Hashed where it sits in the request
+    uint8_t app_param[32];
+    hash_rp_id(&rp_id, app_param);
     
-    for (size_t i = 0; i < map_size; i++) {
-        uint64_t key;
-        if (!cbor_decode_uint(&dec, &key)) break;
-        
-        if (key == 0x01) { // clientDataHash
-            const uint8_t *cdh;
-            size_t cdh_len;
-            cbor_decode_bytes(&dec, &cdh, &cdh_len);
-            if (cdh_len == 32) memcpy(client_data_hash, cdh, 32);
-        } else if (key == 0x02) { // rp
-            size_t rp_map_size;
-            cbor_decode_map_header(&dec, &rp_map_size);
-            for (size_t j = 0; j < rp_map_size; j++) {
-                const char *k; size_t k_len;
-                cbor_decode_text(&dec, &k, &k_len);
-                if (strncmp(k, "id", k_len) == 0) {
-                    const char *v; size_t v_len;
-                    cbor_decode_text(&dec, &v, &v_len);
-                    if (v_len < sizeof(rp_id)) {
-                        memcpy(rp_id, v, v_len);
-                        rp_id[v_len] = 0;
-                    }
-                } else {
-                    // Skip value (simplified: assume text or bytes)
-                    int type = cbor_peek_major_type(&dec);
-                    if (type == CBOR_TEXT) { const char *t; size_t l; cbor_decode_text(&dec, &t, &l); }
-                    else if (type == CBOR_BYTES) { const uint8_t *b; size_t l; cbor_decode_bytes(&dec, &b, &l); }
-                }
-            }
-        } else {
-            // Skip other keys (user, pubKeyCredParams, etc)
-            // This is risky without a full skipper, but for now we assume standard structure
-            // For MVP, we just hope we parsed RP ID correctly.
-            // In a real implementation, we MUST skip properly.
-            // Let's just break if we found what we need? No, we might need to consume the stream.
-            // For this demo, we will assume RP ID comes early or we just parse what we can.
-        }
+    // Already registered here: the user confirms, then the platform is told
+    uint8_t excluded_priv_key[32];
+    int32_t excluded_alg;
+    if (exclude_list.count > 0 &&
+        unwrap_first(app_param, &req.exclude_list, &exclude_list, excluded_priv_key, &excluded_alg) >= 0) {
+        memset(excluded_priv_key, 0, sizeof(excluded_priv_key));
+        status = wait_user_presence();
+        send_ctap2_response(cid, status == CTAP2_OK ? CTAP2_ERR_CREDENTIAL_EXCLUDED : status, NULL, 0);
+        return;
     }
     
-    // Generate Key Pair
+    uint8_t up_status = wait_user_presence();
+    if (up_status != CTAP2_OK) {
+        send_ctap2_response(cid, up_status, NULL, 0);
+        return;
+    }
+
+    // Generate Key Pair (P-256 scalar or Ed25519 seed)
     uint8_t priv_key[32];
     uint8_t pub_key[65];
-    hal_ecc_generate_keypair(priv_key, pub_key);
-    
-    // Create Key Handle (Encrypted)
-    // We need a way to call the encryption logic from u2f.c or move it to a shared helper.
-    // For now, I'll duplicate the encryption logic here or expose a helper in u2f.h.
-    // Let's expose `u2f_create_key_handle` in u2f.c?
-    // Or just implement it here if I have access to master key?
-    // Master key is static in u2f.c.
-    // I should have exposed a function `u2f_wrap_key`.
-    
-    // HACK: For now, I will create a dummy key handle to proceed, 
-    // OR I will modify u2f.c to expose `u2f_wrap_key`.
-    // Let's modify u2f.c first? No, I am in the middle of this edit.
-    // I will assume `u2f_wrap_key` exists and I will add it to u2f.c in the next step.
-    
-    uint8_t key_handle[60];
-    uint8_t app_param[32];
-    hal_sha256((uint8_t*)rp_id, strlen(rp_id), app_param);
+    int kp_ret;
+    if (alg == HAL_ALG_EDDSA) {
+        kp_ret = hal_ed25519_generate_keypair(priv_key, pub_key);
+    } else {
+        kp_ret = hal_ecc_take_keypair(priv_key, pub_key);
+    }
+    if (kp_ret != 0) {
+        memset(priv_key, 0, sizeof(priv_key));
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return;
+    }
     
-    u2f_create_key_handle(app_param, priv_key, key_handle); 
+    // Create Key Handle (Encrypted), used as the credential ID
+    uint8_t key_handle[U2F_KH_MAX_SIZE];
+    int kh_len = u2f_create_credential_id(app_param, priv_key, alg, key_handle);
+    if (kh_len == 0) {
+        memset(priv_key, 0, sizeof(priv_key));
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return;
+    }
+
+    // Discoverable: the record is programmed before the response goes out,
+    // so an acknowledged credential survives power loss. Erasing for the
+    // next ones is left to idle time (cred_store_maintain()).
+    if (options.rk) {
+        cred_record_t rec;
+        memcpy(rec.rp_id_hash, app_param, 32);
+        memcpy(rec.cred_id, key_handle, kh_len);
+        rec.cred_id_len = (uint8_t)kh_len;
+        memcpy(rec.user_id, user_id.data, user_id.len);
+        rec.user_id_len = (uint8_t)user_id.len;
+        rec.rp_id_len = (uint8_t)(rp_id.len < CRED_STORE_RP_ID_MAX ? rp_id.len : CRED_STORE_RP_ID_MAX);
+        memcpy(rec.rp_id, rp_id.data, rec.rp_id_len);
+        esp_err_t err = cred_store_put(&rec);
+        if (err != ESP_OK) {
+            memset(priv_key, 0, sizeof(priv_key));
+            ESP_LOGE(TAG, "Resident credential not stored: %s", esp_err_to_name(err));
+            send_ctap2_response(cid, err == ESP_ERR_NO_MEM ? CTAP2_ERR_KEY_STORE_FULL : CTAP2_ERR_OTHER, NULL, 0);
+            return;
+        }
+    }
     
-    // Construct AuthData
-    uint8_t auth_data[512];
-    size_t ad_len = 0;
+    // authData goes straight into its byte string in the response; the
+    // COSE key is sized first so the string head is right
+    cbor_encoder_t cose;
+    cbor_encoder_init(&cose, NULL, 0);
+    encode_cose_key(&cose, alg, pub_key);
+    size_t ad_len = 32 + 1 + 4 + 16 + 2 + kh_len + cose.offset;
+
+    cbor_encoder_t enc;
+    response_begin(&enc);
+    cbor_encode_map_start(&enc, 3);
+    cbor_encode_uint(&enc, 0x01);
+    cbor_encode_text_lit(&enc, "packed");
+    cbor_encode_uint(&enc, 0x02);
+    uint8_t *auth_data = cbor_encode_bytes_reserve(&enc, ad_len);
+    // Room behind authData for sign_auth_data(), overwritten by attStmt
+    if (!auth_data || enc.size - enc.offset < 32) {
+        memset(priv_key, 0, sizeof(priv_key));
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return;
+    }
+    uint8_t *p = auth_data;
     
     // 1. RP ID Hash
-    memcpy(&auth_data[ad_len], app_param, 32); ad_len += 32;
+    memcpy(p, app_param, 32); p += 32;
     
-    // 2. Flags (UP=1, AT=1)
-    auth_data[ad_len++] = 0x41;
+    // 2. Flags (UP=1, AT=1, UV=1 after a verified pinAuth)
+    *p++ = uv ? 0x45 : 0x41;
     
-    // 3. Counter
-    auth_data[ad_len++] = 0; auth_data[ad_len++] = 0; auth_data[ad_len++] = 0; auth_data[ad_len++] = 1;
+    // 3. Counter: the credential's own starts with its first assertion
+    *p++ = 0; *p++ = 0; *p++ = 0; *p++ = 0;
     
     // 4. Attested Cred Data
-    memcpy(&auth_data[ad_len], aaguid, 16); ad_len += 16;
+    memcpy(p, aaguid, 16); p += 16;
     
     // Cred ID Len
-    auth_data[ad_len++] = 0x00;
-    auth_data[ad_len++] = 60; // Length of Key Handle
+    *p++ = 0x00;
+    *p++ = (uint8_t)kh_len; // Length of Key Handle
     
     // Cred ID (Key Handle)
-    memcpy(&auth_data[ad_len], key_handle, 60); ad_len += 60;
-    
-    // COSE Key (Map)
-    // We need to encode the public key in COSE format.
-    // Map(5) { 1:2 (EC2), 3:-7 (ES256), -1:1 (P-256), -2:X, -3:Y }
-    // We'll manually encode this part since our encoder is minimal.
-    // Map(5) = 0xA5
-    auth_data[ad_len++] = 0xA5;
-    
-    // 1: 2
-    auth_data[ad_len++] = 0x01; auth_data[ad_len++] = 0x02;
-    // 3: -7
-    auth_data[ad_len++] = 0x03; auth_data[ad_len++] = 0x26; // -7 is 0x20 | 6 = 0x26? No.
-    // -7 in CBOR: Major 1 (0x20) | 6 = 0x26. Correct.
-    
-    // -1: 1
-    auth_data[ad_len++] = 0x20; // -1
-    auth_data[ad_len++] = 0x01; // 1 (P-256)
-    
-    // -2: X
-    auth_data[ad_len++] = 0x21; // -2
-    auth_data[ad_len++] = 0x58; // Bytes(32) -> 0x40 | 24 = 0x58. Wait. 32 is 0x18?
-    // Bytes 32: 0x58, 0x20.
-    auth_data[ad_len++] = 0x20;
-    memcpy(&auth_data[ad_len], &pub_key[1], 32); ad_len += 32;
-    
-    // -3: Y
-    auth_data[ad_len++] = 0x22; // -3
-    auth_data[ad_len++] = 0x58; 
-    auth_data[ad_len++] = 0x20;
-    memcpy(&auth_data[ad_len], &pub_key[33], 32); ad_len += 32;
-    
-    // Response CBOR
-    uint8_t buf[1024];
-    cbor_encoder_t enc;
-    cbor_encoder_init(&enc, buf, sizeof(buf));
+    memcpy(p, key_handle, kh_len); p += kh_len;
     
-    cbor_encode_map_start(&enc, 3);
-    cbor_encode_uint(&enc, 0x01); cbor_encode_text(&enc, "packed");
-    cbor_encode_uint(&enc, 0x02); cbor_encode_bytes(&enc, auth_data, ad_len);
-    cbor_encode_uint(&enc, 0x03); 
+    // COSE Key
+    cbor_encoder_init(&cose, p, cose.offset);
+    encode_cose_key(&cose, alg, pub_key);
+    
+    // Self attestation: there is no certificate to send in x5c, so the
+    // credential key signs (authData || clientDataHash) and "alg" is its own
+    uint8_t signature[HAL_ECC_SIG_DER_MAX];
+    int sig_len = sign_auth_data(alg, priv_key, auth_data, ad_len, client_data_hash, signature);
+    memset(priv_key, 0, sizeof(priv_key));
+    if (sig_len <= 0) {
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return;
+    }
+
+    // 3: attStmt { "alg": credential alg, "sig": ... }
+    cbor_encode_uint(&enc, 0x03);
     cbor_encode_map_start(&enc, 2);
-    cbor_encode_text(&enc, "alg"); cbor_encode_int(&enc, -7);
-    cbor_encode_text(&enc, "sig");
+    cbor_encode_text_lit(&enc, "alg"); cbor_encode_int(&enc, alg);
+    cbor_encode_text_lit(&enc, "sig");
+    cbor_encode_bytes(&enc, signature, sig_len);
     
-    // Sign (authData || clientDataHash)
-    uint8_t sig_input[512 + 32];
-    memcpy(sig_input, auth_data, ad_len);
-    memcpy(sig_input + ad_len, client_data_hash, 32);
+    response_send(cid, &enc);
+}
+
+// Where a GetAssertion without an allowList left off, for
+// authenticatorGetNextAssertion. Bound to the requesting channel; any other
+// command, or CTAP2_NEXT_ASSERT_TIMEOUT_MS without one, drops it.
+typedef struct {
+    uint32_t cid;               // 0 = nothing to continue
+    uint8_t app_param[32];
+    uint8_t client_data_hash[32];
+    uint8_t flags;
+    uint32_t before;            // created of the last credential returned
+    size_t remaining;
+    int64_t expires_us;
+} next_assertion_t;
+
+static next_assertion_t next_assertion;
+
+// Assertion response for one credential, after user presence: takes the
+// credential's next counter value, signs, and wipes priv_key whatever
+// happens. user is set for a credential the platform did not name, and
+// numberOfCredentials is sent when above 1. False if an error was sent.
+static bool send_assertion(uint32_t cid, const uint8_t *app_param, const uint8_t *client_data_hash, uint8_t flags,
+                           const uint8_t *cred_id, size_t cred_id_len, int32_t alg, uint8_t *priv_key,
+                           const cred_record_t *user, size_t number_of_credentials) {
+    uint32_t counter = counter_store_next(counter_store_cred_id(cred_id, cred_id_len));
+    if (counter == 0) {
+        memset(priv_key, 0, 32);
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return false;
+    }
     
-    uint8_t sig_hash[32];
-    hal_sha256(sig_input, ad_len + 32, sig_hash);
+    // Response, authData built where it will be sent
+    cbor_encoder_t enc;
+    response_begin(&enc);
+    cbor_encode_map_start(&enc, 3 + (user ? 1 : 0) + (number_of_credentials > 1 ? 1 : 0));
     
-    // We need the attestation private key. It's static in u2f.c.
-    // I need to expose `u2f_sign_attestation(hash, sig)`.
+    // 1: credential { "id": ... }
+    cbor_encode_uint(&enc, 0x01);
+    cbor_encode_map_start(&enc, 1);
+    cbor_encode_text_lit(&enc, "id");
+    cbor_encode_bytes(&enc, cred_id, cred_id_len);
     
-    uint8_t signature[72];
-    int sig_len = u2f_sign_attestation(sig_hash, signature);
+    // 2: authData
+    const size_t ad_len = 32 + 1 + 4;
+    cbor_encode_uint(&enc, 0x02);
+    uint8_t *auth_data = cbor_encode_bytes_reserve(&enc, ad_len);
+    // Room behind authData for sign_auth_data(), overwritten by the
+    // signature entry below
+    if (!auth_data || enc.size - enc.offset < 32) {
+        memset(priv_key, 0, 32);
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return false;
+    }
+    
+    // RP ID Hash
+    memcpy(auth_data, app_param, 32);
+    
+    // Flags (UP=1, UV as the request verified it)
+    auth_data[32] = flags;
     
+    // Counter
+    auth_data[33] = (counter >> 24) & 0xFF;
+    auth_data[34] = (counter >> 16) & 0xFF;
+    auth_data[35] = (counter >> 8) & 0xFF;
+    auth_data[36] = counter & 0xFF;
+    
+    // Sign (authData || clientDataHash)
+    uint8_t signature[HAL_ECC_SIG_DER_MAX];
+    int sig_len = sign_auth_data(alg, priv_key, auth_data, ad_len, client_data_hash, signature);
+    memset(priv_key, 0, 32);
+    if (sig_len < 0) {
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
+        return false;
+    }
+    
+    // 3: signature
+    cbor_encode_uint(&enc, 0x03);
     cbor_encode_bytes(&enc, signature, sig_len);
     
-    send_ctap2_response(cid, CTAP2_OK, buf, enc.offset);
-}
-
-void ctap2_handle_cbor(uint32_t cid, uint8_t *payload, uint16_t len) {
-    if (len == 0) return;
-    uint8_t cmd = payload[0];
+    // 4: user { "id": ... }
+    if (user) {
+        cbor_encode_uint(&enc, 0x04);
+        cbor_encode_map_start(&enc, 1);
+        cbor_encode_text_lit(&enc, "id");
+        cbor_encode_bytes(&enc, user->user_id, user->user_id_len);
+    }
     
-    ESP_LOGI(TAG, "CTAP2 CMD: %02X", cmd);
+    // 5: numberOfCredentials, the rest come from GetNextAssertion
+    if (number_of_credentials > 1) {
+        cbor_encode_uint(&enc, 0x05);
+        cbor_encode_uint(&enc, number_of_credentials);
+    }
     
-    switch (cmd) {
-        case CTAP2_GET_INFO:
-            handle_get_info(cid);
-            break;
-        case CTAP2_MAKE_CREDENTIAL:
-            handle_make_credential(cid, payload + 1, len - 1);
-            break;
+    response_send(cid, &enc);
+    return true;
+}
+
 static void handle_get_assertion(uint32_t cid, uint8_t *payload, size_t len) {
     cbor_decoder_t dec;
+    get_assertion_req_t req = {0};
+    cred_list_t allow_list;
+    bool uv;
     cbor_decoder_init(&dec, payload, len);
-    
-    size_t map_size;
-    if (!cbor_decode_map_header(&dec, &map_size)) {
-        send_ctap2_response(cid, CTAP2_ERR_INVALID_CBOR, NULL, 0);
+    uint8_t status = DECODE_SCHEMA(&dec, get_assertion_schema, &req);
+    if (status == CTAP2_OK) status = check_client_data_hash(&req.client_data_hash);
+    if (status == CTAP2_OK) status = parse_cred_list(&req.allow_list, &allow_list);
+    if (status == CTAP2_OK) status = check_pin_auth(&req.pin_auth, req.pin_protocol, req.client_data_hash.data, &uv);
+    if (status != CTAP2_OK) {
+        send_ctap2_response(cid, status, NULL, 0);
         return;
     }
+    const uint8_t *client_data_hash = req.client_data_hash.data;
+    
+    // RP ID Hash
+    uint8_t app_param[32];
+    hash_rp_id(&req.rp_id, app_param);
     
-    char rp_id[64] = {0};
-    uint8_t client_data_hash[32] = {0};
+    // All candidates in one pass over the cached master-key context.
+    // Without an allowList, the newest resident credential for the RP.
     uint8_t found_priv_key[32];
-    uint8_t found_cred_id[64];
+    int32_t found_alg;
+    const uint8_t *found_cred_id = NULL;
     size_t found_cred_id_len = 0;
-    bool found = false;
-    
-    // First pass: get RP ID and ClientDataHash
-    // Note: We need to reset decoder or store offsets. 
-    // For simplicity, we parse linearly. If allowList comes before rpId, we might fail if we need rpId hash.
-    // Standard says map keys can be any order.
-    // We should parse all first.
-    
-    // Simplified: We assume we can parse everything.
-    // But we need RP ID to check allowList (because of AppParam binding).
-    // So we need to find RP ID first.
-    // Let's do a quick scan or just hope RP ID is early.
-    // Actually, we can just store the allowList offset and parse it later?
-    // Or just parse everything into variables.
-    
-    // We'll parse linearly. If we hit allowList and don't have RP ID yet, we are in trouble.
-    // But usually RP ID is early.
-    // Better approach: Parse everything, store pointers to complex structures.
-    
-    const uint8_t *allow_list_ptr = NULL;
-    size_t allow_list_len = 0; // This is not byte len, but item count? No, we need raw ptr.
-    // cbor_minimal doesn't support "skip and save ptr".
-    
-    // Let's just parse and hope.
+    cred_record_t resident;
+    size_t resident_count = 0;
+    bool is_resident = !req.allow_list.data;
+    if (is_resident) {
+        resident_count = cred_store_find(app_param, &resident, 1);
+        if (resident_count > 0) {
+            const u2f_key_handle_ref_t ref = {resident.cred_id, resident.cred_id_len};
+            if (u2f_unwrap_first(app_param, &ref, 1, found_priv_key, &found_alg) == 0) {
+                found_cred_id = resident.cred_id;
+                found_cred_id_len = resident.cred_id_len;
+            }
+        }
+    } else {
+        int found_idx = unwrap_first(app_param, &req.allow_list, &allow_list, found_priv_key, &found_alg);
+        if (found_idx >= 0) {
+            found_cred_id = allow_list.ids[found_idx].data;
+            found_cred_id_len = allow_list.ids[found_idx].len;
+        }
+    }
+    if (!found_cred_id) {
+        send_ctap2_response(cid, CTAP2_ERR_NO_CREDENTIALS, NULL, 0);
+        return;
+    }
+
+    uint8_t up_status = wait_user_presence();
+    if (up_status != CTAP2_OK) {
+        memset(found_priv_key, 0, sizeof(found_priv_key));
+        send_ctap2_response(cid, up_status, NULL, 0);
+        return;
+    }
+    uint8_t flags = uv ? 0x05 : 0x01;
+    if (!send_assertion(cid, app_param, client_data_hash, flags, found_cred_id, found_cred_id_len, found_alg,
+                        found_priv_key, is_resident ? &resident : NULL, resident_count)) {
+        return;
+    }
     
-    for (size_t i = 0; i < map_size; i++) {
-        uint64_t key;
-        if (!cbor_decode_uint(&dec, &key)) break;
-        
-        if (key == 0x01) { // rpId
-            const char *t; size_t l;
-            cbor_decode_text(&dec, &t, &l);
-            if (l < sizeof(rp_id)) {
-                memcpy(rp_id, t, l);
-                rp_id[l] = 0;
+    // The platform fetches the RP's older credentials one by one
+    if (resident_count > 1) {
+        next_assertion.cid = cid;
+        memcpy(next_assertion.app_param, app_param, 32);
+        memcpy(next_assertion.client_data_hash, client_data_hash, 32);
+        next_assertion.flags = flags;
+        next_assertion.before = resident.created;
+        next_assertion.remaining = resident_count - 1;
+        next_assertion.expires_us = esp_timer_get_time() + CTAP2_NEXT_ASSERT_TIMEOUT_MS * 1000LL;
+    }
+}
+
+// The next older credential, signed over the clientDataHash and with the
+// same flags as the GetAssertion it continues. User presence from that
+// command covers the whole batch.
+static void handle_get_next_assertion(uint32_t cid) {
+    next_assertion_t *na = &next_assertion;
+    if (na->cid != cid || na->remaining == 0 || esp_timer_get_time() > na->expires_us) {
+        memset(na, 0, sizeof(*na));
+        send_ctap2_response(cid, CTAP2_ERR_NOT_ALLOWED, NULL, 0);
+        return;
+    }
+
+    cred_record_t resident;
+    uint8_t priv_key[32];
+    int32_t alg;
+    bool found = false;
+    while (!found && cred_store_find_before(na->app_param, na->before, &resident)) {
+        na->before = resident.created;
+        const u2f_key_handle_ref_t ref = {resident.cred_id, resident.cred_id_len};
+        found = u2f_unwrap_first(na->app_param, &ref, 1, priv_key, &alg) == 0;
+    }
+    if (!found) {
+        memset(na, 0, sizeof(*na));
+        send_ctap2_response(cid, CTAP2_ERR_NOT_ALLOWED, NULL, 0);
+        return;
+    }
+
+    na->remaining--;
+    na->expires_us = esp_timer_get_time() + CTAP2_NEXT_ASSERT_TIMEOUT_MS * 1000LL;
+    if (!send_assertion(cid, na->app_param, na->client_data_hash, na->flags, resident.cred_id,
+                        resident.cred_id_len, alg, priv_key, &resident, 0) || na->remaining == 0) {
+        memset(na, 0, sizeof(*na));
+    }
+}
+
+// authenticatorClientPIN. The PIN state and the crypto behind it live in
+// client_pin.c; this decodes the request and encodes the reply.
+typedef struct {
+    uint64_t pin_protocol;
+    uint64_t sub_command;
+    cbor_item_t key_agreement;
+    cbor_item_t pin_auth;
+    cbor_item_t new_pin_enc;
+    cbor_item_t pin_hash_enc;
+} client_pin_req_t;
+
+static const cbor_field_t client_pin_schema[] = {
+    CBOR_FIELD(0x01, CBOR_UINT, true, client_pin_req_t, pin_protocol, 0),
+    CBOR_FIELD(0x02, CBOR_UINT, true, client_pin_req_t, sub_command, 0),
+    CBOR_FIELD(0x03, CBOR_MAP, false, client_pin_req_t, key_agreement, 0),
+    CBOR_FIELD(0x04, CBOR_BYTES, false, client_pin_req_t, pin_auth, 0),
+    CBOR_FIELD(0x05, CBOR_BYTES, false, client_pin_req_t, new_pin_enc, 0),
+    CBOR_FIELD(0x06, CBOR_BYTES, false, client_pin_req_t, pin_hash_enc, 0),
+};
+
+// The platform's key agreement key, an EC2 P-256 COSE_Key
+typedef struct {
+    uint64_t kty;
+    uint64_t crv;
+    cbor_item_t x;
+    cbor_item_t y;
+} cose_ec2_key_t;
+
+static const cbor_field_t cose_ec2_key_schema[] = {
+    CBOR_FIELD(1, CBOR_UINT, true, cose_ec2_key_t, kty, 0),
+    CBOR_FIELD(-1, CBOR_UINT, true, cose_ec2_key_t, crv, 0),
+    CBOR_FIELD(-2, CBOR_BYTES, true, cose_ec2_key_t, x, 32),
+    CBOR_FIELD(-3, CBOR_BYTES, true, cose_ec2_key_t, y, 32),
+};
+
+// As 0x04 | X | Y; whether the point is on the curve is left to ECDH
+static uint8_t parse_platform_key(const cbor_item_t *item, uint8_t *public_key) {
+    cbor_decoder_t dec;
+    cose_ec2_key_t key = {0};
+    if (!item->data) return CTAP2_ERR_MISSING_PARAM;
+    cbor_item_decoder(item, &dec);
+    uint8_t status = DECODE_SCHEMA(&dec, cose_ec2_key_schema, &key);
+    if (status != CTAP2_OK) return status;
+    if (key.kty != 2 || key.crv != 1 || key.x.len != 32 || key.y.len != 32) return CTAP2_ERR_INVALID_PARAMETER;
+    public_key[0] = 0x04;
+    memcpy(&public_key[1], key.x.data, 32);
+    memcpy(&public_key[33], key.y.data, 32);
+    return CTAP2_OK;
+}
+
+static void handle_client_pin(uint32_t cid, uint8_t *payload, size_t len) {
+    cbor_decoder_t dec;
+    client_pin_req_t req = {0};
+    cbor_decoder_init(&dec, payload, len);
+    uint8_t status = DECODE_SCHEMA(&dec, client_pin_schema, &req);
+    if (status == CTAP2_OK && req.pin_protocol != CLIENT_PIN_PROTOCOL) status = CTAP2_ERR_INVALID_PARAMETER;
+    if (status != CTAP2_OK) {
+        send_ctap2_response(cid, status, NULL, 0);
+        return;
+    }
+
+    cbor_encoder_t enc;
+    uint8_t key[65];
+    switch (req.sub_command) {
+        case CTAP2_PIN_GET_RETRIES:
+            // { 3: retries }
+            response_begin(&enc);
+            cbor_encode_map_start(&enc, 1);
+            cbor_encode_uint(&enc, 0x03);
+            cbor_encode_uint(&enc, client_pin_retries());
+            response_send(cid, &enc);
+            return;
+
+        case CTAP2_PIN_GET_KEY_AGREEMENT:
+            // { 1: COSE_Key }
+            status = client_pin_key_agreement(key);
+            if (status != CTAP2_OK) break;
+            response_begin(&enc);
+            cbor_encode_map_start(&enc, 1);
+            cbor_encode_uint(&enc, 0x01);
+            encode_cose_key(&enc, CLIENT_PIN_COSE_ALG, key);
+            response_send(cid, &enc);
+            return;
+
+        case CTAP2_PIN_SET_PIN:
+            if (!req.pin_auth.data || !req.new_pin_enc.data) status = CTAP2_ERR_MISSING_PARAM;
+            if (status == CTAP2_OK) status = parse_platform_key(&req.key_agreement, key);
+            if (status == CTAP2_OK) {
+                status = client_pin_set(key, req.pin_auth.data, req.pin_auth.len,
+                                        req.new_pin_enc.data, req.new_pin_enc.len);
             }
-        } else if (key == 0x02) { // clientDataHash
-            const uint8_t *d; size_t l;
-            cbor_decode_bytes(&dec, &d, &l);
-            if (l == 32) memcpy(client_data_hash, d, 32);
-        } else if (key == 0x03) { // allowList
-            // We need to process this. If we don't have RP ID yet, we can't verify.
-            // But we can try to verify later?
-            // Let's just process it here. If RP ID is empty, we fail.
-            if (rp_id[0] == 0) {
-                ESP_LOGW(TAG, "AllowList found before RP ID. Not supported in this minimal parser.");
-                // We could continue and hope RP ID was default? No.
-                // Just skip it? We can't skip easily.
-                // We must process it.
+            if (status == CTAP2_OK) ctap2_get_info_invalidate(); // clientPin is now true
+            break;
+
+        case CTAP2_PIN_CHANGE_PIN:
+            if (!req.pin_auth.data || !req.new_pin_enc.data || !req.pin_hash_enc.data) {
+                status = CTAP2_ERR_MISSING_PARAM;
             }
-            
-            uint8_t app_param[32];
-            hal_sha256((uint8_t*)rp_id, strlen(rp_id), app_param);
-            
-            size_t arr_size;
-            cbor_decode_array_header(&dec, &arr_size);
-            
-            for (size_t j = 0; j < arr_size; j++) {
-                size_t map_sz;
-                cbor_decode_map_header(&dec, &map_sz);
-                // Credential Descriptor Map
-                // type (text), id (bytes), transports (array)
-                
-                uint8_t current_cred_id[64];
-                size_t current_cred_id_len = 0;
-                
-                for (size_t k = 0; k < map_sz; k++) {
-                    const char *mk; size_t mk_len;
-                    cbor_decode_text(&dec, &mk, &mk_len);
-                    if (strncmp(mk, "id", mk_len) == 0) {
-                        const uint8_t *b; size_t bl;
-                        cbor_decode_bytes(&dec, &b, &bl);
-                        if (bl <= 64) {
-                            memcpy(current_cred_id, b, bl);
-                            current_cred_id_len = bl;
-                        }
-                    } else {
-                        // Skip value
-                        int type = cbor_peek_major_type(&dec);
-                        if (type == CBOR_TEXT) { const char *t; size_t l; cbor_decode_text(&dec, &t, &l); }
-                        else if (type == CBOR_BYTES) { const uint8_t *b; size_t l; cbor_decode_bytes(&dec, &b, &l); }
-                        else if (type == CBOR_ARRAY) { size_t s; cbor_decode_array_header(&dec, &s); /* Skip items? Too hard */ } 
-                        // If we hit array (transports), we are stuck without recursive skipper.
-                        // Assume transports is last or not present.
-                    }
-                }
-                
-                if (!found && current_cred_id_len > 0) {
-                    // Try to unwrap
-                    if (u2f_unwrap_key_handle(app_param, current_cred_id, current_cred_id_len, found_priv_key) == 0) {
-                        found = true;
-                        memcpy(found_cred_id, current_cred_id, current_cred_id_len);
-                        found_cred_id_len = current_cred_id_len;
-                    }
-                }
+            if (status == CTAP2_OK) status = parse_platform_key(&req.key_agreement, key);
+            if (status == CTAP2_OK) {
+                status = client_pin_change(key, req.pin_auth.data, req.pin_auth.len, req.new_pin_enc.data,
+                                           req.new_pin_enc.len, req.pin_hash_enc.data, req.pin_hash_enc.len);
             }
-        } else {
-            // Skip unknown
+            break;
+
+        case CTAP2_PIN_GET_PIN_TOKEN: {
+            // { 2: pinTokenEnc }
+            uint8_t token_enc[CLIENT_PIN_TOKEN_SIZE];
+            if (!req.pin_hash_enc.data) status = CTAP2_ERR_MISSING_PARAM;
+            if (status == CTAP2_OK) status = parse_platform_key(&req.key_agreement, key);
+            if (status == CTAP2_OK) {
+                status = client_pin_get_token(key, req.pin_hash_enc.data, req.pin_hash_enc.len, token_enc);
+            }
+            if (status != CTAP2_OK) break;
+            response_begin(&enc);
+            cbor_encode_map_start(&enc, 1);
+            cbor_encode_uint(&enc, 0x02);
+            cbor_encode_bytes(&enc, token_enc, sizeof(token_enc));
+            response_send(cid, &enc);
+            return;
         }
+
+        default:
+            status = CTAP2_ERR_INVALID_PARAMETER;
+            break;
     }
-    
-    if (!found) {
-        send_ctap2_response(cid, CTAP2_ERR_NO_CREDENTIALS, NULL, 0);
+    send_ctap2_response(cid, status, NULL, 0);
+}
+
+// authenticatorCredentialManagement. Everything but getNext needs a
+// pinUvAuthParam from the current pinToken; getNext continues an
+// enumeration the token already opened. Every step is read from the store
+// through a cursor, one credential per response.
+typedef struct {
+    uint64_t sub_command;
+    cbor_item_t params;
+    uint64_t pin_protocol;
+    cbor_item_t pin_auth;
+} cred_mgmt_req_t;
+
+static const cbor_field_t cred_mgmt_schema[] = {
+    CBOR_FIELD(0x01, CBOR_UINT, true, cred_mgmt_req_t, sub_command, 0),
+    CBOR_FIELD(0x02, CBOR_MAP, false, cred_mgmt_req_t, params, 0),
+    CBOR_FIELD(0x03, CBOR_UINT, false, cred_mgmt_req_t, pin_protocol, 0),
+    CBOR_FIELD(0x04, CBOR_BYTES, false, cred_mgmt_req_t, pin_auth, 0),
+};
+
+typedef struct {
+    cbor_item_t rp_id_hash;
+    cbor_item_t credential_id;
+} cred_mgmt_params_t;
+
+static const cbor_field_t cred_mgmt_params_schema[] = {
+    CBOR_FIELD(0x01, CBOR_BYTES, false, cred_mgmt_params_t, rp_id_hash, 32),
+    CBOR_FIELD(0x02, CBOR_MAP, false, cred_mgmt_params_t, credential_id, 0),
+};
+
+// Largest subCommandParams a pinUvAuthParam is checked over: an rpIDHash,
+// or a credential descriptor with one of our IDs
+#define CRED_MGMT_PARAMS_MAX    (CTAP2_MAX_CRED_ID_LENGTH + 32)
+
+// The enumeration in progress, if any. Any other command ends it.
+static struct {
+    uint8_t next;           // Subcommand that continues it, 0 if none
+    uint32_t cid;
+    cred_cursor_t cursor;
+    uint8_t rp_id_hash[32];
+} enumeration;
+
+// pinUvAuthParam = LEFT(HMAC(pinToken, subCommand || subCommandParams), 16),
+// the parameters as the platform encoded them
+static uint8_t check_cred_mgmt_auth(const cred_mgmt_req_t *req) {
+    if (!req->pin_auth.data) return CTAP2_ERR_PIN_REQUIRED;
+    if (req->pin_protocol != CLIENT_PIN_PROTOCOL) return CTAP2_ERR_PIN_AUTH_INVALID;
+    if (req->params.len > CRED_MGMT_PARAMS_MAX) return CTAP2_ERR_LIMIT_EXCEEDED;
+    uint8_t msg[1 + CRED_MGMT_PARAMS_MAX];
+    msg[0] = (uint8_t)req->sub_command;
+    if (req->params.data) memcpy(&msg[1], req->params.data, req->params.len);
+    return client_pin_verify(msg, 1 + req->params.len, req->pin_auth.data, req->pin_auth.len);
+}
+
+// { 3: rp { "id" }, 4: rpIDHash, [5: totalRPs] }
+static void send_rp(uint32_t cid, const cred_record_t *rec, size_t total) {
+    cbor_encoder_t enc;
+    response_begin(&enc);
+    cbor_encode_map_start(&enc, total ? 3 : 2);
+    cbor_encode_uint(&enc, 0x03);
+    cbor_encode_map_start(&enc, 1);
+    cbor_encode_text_lit(&enc, "id");
+    cbor_encode_text_n(&enc, rec->rp_id, rec->rp_id_len);
+    cbor_encode_uint(&enc, 0x04);
+    cbor_encode_bytes(&enc, rec->rp_id_hash, 32);
+    if (total) {
+        cbor_encode_uint(&enc, 0x05);
+        cbor_encode_uint(&enc, total);
+    }
+    response_send(cid, &enc);
+}
+
+// { 6: user { "id" }, 7: credentialID, 8: publicKey, [9: totalCredentials] }.
+// The public key is not stored: it is derived from the unwrapped credential.
+static void send_cred(uint32_t cid, const cred_record_t *rec, size_t total) {
+    uint8_t priv_key[32];
+    uint8_t pub_key[65];
+    int32_t alg;
+    int ret = u2f_unwrap_credential_id(rec->rp_id_hash, rec->cred_id, rec->cred_id_len, priv_key, &alg);
+    if (ret == 0) {
+        ret = alg == HAL_ALG_EDDSA ? hal_ed25519_public_key(priv_key, pub_key) : hal_ecc_public_key(priv_key, pub_key);
+    }
+    memset(priv_key, 0, sizeof(priv_key));
+    if (ret != 0) {
+        send_ctap2_response(cid, CTAP2_ERR_OTHER, NULL, 0);
         return;
     }
-    
-    // Generate Assertion
-    uint8_t auth_data[512];
-    size_t ad_len = 0;
-    
-    // RP ID Hash
-    uint8_t app_param[32];
-    hal_sha256((uint8_t*)rp_id, strlen(rp_id), app_param);
-    memcpy(&auth_data[ad_len], app_param, 32); ad_len += 32;
-    
-    // Flags (UP=1)
-    auth_data[ad_len++] = 0x01;
-    
-    // Counter
-    auth_data[ad_len++] = 0; auth_data[ad_len++] = 0; auth_data[ad_len++] = 0; auth_data[ad_len++] = 2; // TODO: Use real counter
-    
-    // Sign (authData || clientDataHash)
-    uint8_t sig_input[512 + 32];
-    memcpy(sig_input, auth_data, ad_len);
-    memcpy(sig_input + ad_len, client_data_hash, 32);
-    
-    uint8_t sig_hash[32];
-    hal_sha256(sig_input, ad_len + 32, sig_hash);
-    
-    uint8_t signature[72];
-    int sig_len = hal_ecc_sign(found_priv_key, sig_hash, signature);
-    
-    // Response
-    uint8_t buf[1024];
+
     cbor_encoder_t enc;
-    cbor_encoder_init(&enc, buf, sizeof(buf));
-    
-    cbor_encode_map_start(&enc, 3);
-    
-    // 1: credential { "id": ... }
-    cbor_encode_uint(&enc, 0x01);
+    response_begin(&enc);
+    cbor_encode_map_start(&enc, total ? 4 : 3);
+    cbor_encode_uint(&enc, 0x06);
     cbor_encode_map_start(&enc, 1);
-    cbor_encode_text(&enc, "id");
-    cbor_encode_bytes(&enc, found_cred_id, found_cred_id_len);
+    cbor_encode_text_lit(&enc, "id");
+    cbor_encode_bytes(&enc, rec->user_id, rec->user_id_len);
+    cbor_encode_uint(&enc, 0x07);
+    cbor_encode_map_start(&enc, 2);
+    cbor_encode_text_lit(&enc, "id");
+    cbor_encode_bytes(&enc, rec->cred_id, rec->cred_id_len);
+    cbor_encode_text_lit(&enc, "type");
+    cbor_encode_text_lit(&enc, "public-key");
+    cbor_encode_uint(&enc, 0x08);
+    encode_cose_key(&enc, alg, pub_key);
+    if (total) {
+        cbor_encode_uint(&enc, 0x09);
+        cbor_encode_uint(&enc, total);
+    }
+    response_send(cid, &enc);
+}
+
+static void handle_cred_mgmt(uint32_t cid, uint8_t *payload, size_t len) {
+    cbor_decoder_t dec;
+    cred_mgmt_req_t req = {0};
+    cred_mgmt_params_t params = {0};
+    cbor_decoder_init(&dec, payload, len);
+    uint8_t status = DECODE_SCHEMA(&dec, cred_mgmt_schema, &req);
+    if (status == CTAP2_OK && req.params.data) {
+        cbor_item_decoder(&req.params, &dec);
+        status = DECODE_SCHEMA(&dec, cred_mgmt_params_schema, &params);
+    }
+    if (status != CTAP2_OK) {
+        enumeration.next = 0;
+        send_ctap2_response(cid, status, NULL, 0);
+        return;
+    }
+
+    // getNext: only straight after the previous step, on the same channel
+    cred_record_t rec;
+    if (req.sub_command == CTAP2_CM_ENUMERATE_RPS_NEXT || req.sub_command == CTAP2_CM_ENUMERATE_CREDS_NEXT) {
+        bool found = false;
+        if (enumeration.next == req.sub_command && enumeration.cid == cid) {
+            found = req.sub_command == CTAP2_CM_ENUMERATE_RPS_NEXT
+                        ? cred_store_next_rp(&enumeration.cursor, &rec)
+                        : cred_store_next_cred(&enumeration.cursor, enumeration.rp_id_hash, &rec);
+        }
+        if (!found) {
+            enumeration.next = 0;
+            send_ctap2_response(cid, CTAP2_ERR_NOT_ALLOWED, NULL, 0);
+            return;
+        }
+        if (req.sub_command == CTAP2_CM_ENUMERATE_RPS_NEXT) {
+            send_rp(cid, &rec, 0);
+        } else {
+            send_cred(cid, &rec, 0);
+        }
+        return;
+    }
+    enumeration.next = 0;
+
+    switch (req.sub_command) {
+        case CTAP2_CM_GET_CREDS_METADATA:
+        case CTAP2_CM_ENUMERATE_RPS_BEGIN:
+            break;
+        case CTAP2_CM_ENUMERATE_CREDS_BEGIN:
+            if (params.rp_id_hash.len != 32) status = CTAP2_ERR_MISSING_PARAM;
+            break;
+        case CTAP2_CM_DELETE_CREDENTIAL:
+            if (!params.credential_id.data) status = CTAP2_ERR_MISSING_PARAM;
+            break;
+        default:
+            status = CTAP2_ERR_INVALID_PARAMETER;
+            break;
+    }
+    if (status == CTAP2_OK) status = check_cred_mgmt_auth(&req);
+    if (status != CTAP2_OK) {
+        send_ctap2_response(cid, status, NULL, 0);
+        return;
+    }
+
+    cbor_encoder_t enc;
+    size_t total;
+    switch (req.sub_command) {
+        case CTAP2_CM_GET_CREDS_METADATA:
+            // { 1: existingResidentCredentialsCount, 2: maxPossibleRemainingResidentCredentialsCount }
+            response_begin(&enc);
+            cbor_encode_map_start(&enc, 2);
+            cbor_encode_uint(&enc, 0x01);
+            cbor_encode_uint(&enc, cred_store_count());
+            cbor_encode_uint(&enc, 0x02);
+            cbor_encode_uint(&enc, CRED_STORE_MAX_CREDS - cred_store_count());
+            response_send(cid, &enc);
+            break;
+
+        case CTAP2_CM_ENUMERATE_RPS_BEGIN:
+            enumeration.cursor = (cred_cursor_t)CRED_STORE_CURSOR_INIT;
+            total = cred_store_rp_count();
+            if (total == 0 || !cred_store_next_rp(&enumeration.cursor, &rec)) {
+                send_ctap2_response(cid, CTAP2_ERR_NO_CREDENTIALS, NULL, 0);
+                break;
+            }
+            if (total > 1) {
+                enumeration.next = CTAP2_CM_ENUMERATE_RPS_NEXT;
+                enumeration.cid = cid;
+            }
+            send_rp(cid, &rec, total);
+            break;
+
+        case CTAP2_CM_ENUMERATE_CREDS_BEGIN:
+            enumeration.cursor = (cred_cursor_t)CRED_STORE_CURSOR_INIT;
+            memcpy(enumeration.rp_id_hash, params.rp_id_hash.data, 32);
+            total = cred_store_find(enumeration.rp_id_hash, NULL, 0);
+            if (total == 0 || !cred_store_next_cred(&enumeration.cursor, enumeration.rp_id_hash, &rec)) {
+                send_ctap2_response(cid, CTAP2_ERR_NO_CREDENTIALS, NULL, 0);
+                break;
+            }
+            if (total > 1) {
+                enumeration.next = CTAP2_CM_ENUMERATE_CREDS_NEXT;
+                enumeration.cid = cid;
+            }
+            send_cred(cid, &rec, total);
+            break;
+
+        case CTAP2_CM_DELETE_CREDENTIAL: {
+            // Appends a tombstone; the index forgets it at once
+            cred_descriptor_t desc = {0};
+            cbor_item_decoder(&params.credential_id, &dec);
+            status = DECODE_SCHEMA(&dec, cred_descriptor_schema, &desc);
+            if (status == CTAP2_OK) {
+                esp_err_t err = cred_store_delete(desc.id.data, desc.id.len);
+                status = err == ESP_OK ? CTAP2_OK
+                         : err == ESP_ERR_NOT_FOUND ? CTAP2_ERR_NO_CREDENTIALS : CTAP2_ERR_OTHER;
+            }
+            send_ctap2_response(cid, status, NULL, 0);
+            break;
+        }
+    }
+}
+
+void ctap2_handle_cbor(uint32_t cid, uint8_t *payload, uint16_t len) {
+    if (len == 0) return;
+    uint8_t cmd = payload[0];
     
-    // 2: authData
-    cbor_encode_uint(&enc, 0x02);
-    cbor_encode_bytes(&enc, auth_data, ad_len);
+    ESP_LOGI(TAG, "CTAP2 CMD: %02X", cmd);
     
-    // 3: signature
-    cbor_encode_uint(&enc, 0x03);
-    cbor_encode_bytes(&enc, signature, sig_len);
+    // Only GetNextAssertion and credMgmt's getNext continue the previous command
+    if (cmd != CTAP2_GET_NEXT_ASSERT) memset(&next_assertion, 0, sizeof(next_assertion));
+    if (cmd != CTAP2_CRED_MGMT) enumeration.next = 0;
     
-    send_ctap2_response(cid, CTAP2_OK, buf, enc.offset);
-}
+    switch (cmd) {
+        case CTAP2_GET_INFO:
+            handle_get_info(cid);
+            break;
+        case CTAP2_MAKE_CREDENTIAL:
+            handle_make_credential(cid, payload + 1, len - 1);
+            break;
+        case CTAP2_GET_ASSERTION:
+            handle_get_assertion(cid, payload + 1, len - 1);
+            break;
+        case CTAP2_GET_NEXT_ASSERT:
+            handle_get_next_assertion(cid);
+            break;
+        case CTAP2_CLIENT_PIN:
+            handle_client_pin(cid, payload + 1, len - 1);
+            break;
+        case CTAP2_CRED_MGMT:
+            handle_cred_mgmt(cid, payload + 1, len - 1);
+            break;
         default:
             send_ctap2_response(cid, CTAP2_ERR_UNSUPPORTED_OP, NULL, 0);
             break;
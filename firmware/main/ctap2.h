@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include "u2f.h"
 
 // CTAP2 Commands
 #define CTAP2_MAKE_CREDENTIAL   0x01
@@ -9,11 +10,76 @@
 #define CTAP2_CLIENT_PIN        0x06
 #define CTAP2_RESET             0x07
 #define CTAP2_GET_NEXT_ASSERT   0x08
+#define CTAP2_CRED_MGMT         0x0A
+
+// authenticatorClientPIN subcommands
+#define CTAP2_PIN_GET_RETRIES           0x01
+#define CTAP2_PIN_GET_KEY_AGREEMENT     0x02
+#define CTAP2_PIN_SET_PIN               0x03
+#define CTAP2_PIN_CHANGE_PIN            0x04
+#define CTAP2_PIN_GET_PIN_TOKEN         0x05
+
+// authenticatorCredentialManagement subcommands
+#define CTAP2_CM_GET_CREDS_METADATA     0x01
+#define CTAP2_CM_ENUMERATE_RPS_BEGIN    0x02
+#define CTAP2_CM_ENUMERATE_RPS_NEXT     0x03
+#define CTAP2_CM_ENUMERATE_CREDS_BEGIN  0x04
+#define CTAP2_CM_ENUMERATE_CREDS_NEXT   0x05
+#define CTAP2_CM_DELETE_CREDENTIAL      0x06
 
 // CTAP2 Status Codes
 #define CTAP2_OK                0x00
+#define CTAP2_ERR_INVALID_PARAMETER 0x02
+#define CTAP2_ERR_CBOR_UNEXPECTED_TYPE 0x11
 #define CTAP2_ERR_INVALID_CBOR  0x12
 #define CTAP2_ERR_MISSING_PARAM 0x14
+#define CTAP2_ERR_LIMIT_EXCEEDED 0x15
+#define CTAP2_ERR_CREDENTIAL_EXCLUDED 0x19
+#define CTAP2_ERR_UNSUPPORTED_ALGORITHM 0x26
+#define CTAP2_ERR_KEY_STORE_FULL 0x28
+#define CTAP2_ERR_UNSUPPORTED_OPTION 0x2B
+#define CTAP2_ERR_NO_CREDENTIALS 0x2E
 #define CTAP2_ERR_UNSUPPORTED_OP 0x2B
+#define CTAP2_ERR_KEEPALIVE_CANCEL 0x2D
+#define CTAP2_ERR_USER_ACTION_TIMEOUT 0x2F
+#define CTAP2_ERR_NOT_ALLOWED   0x30
+#define CTAP2_ERR_PIN_INVALID   0x31
+#define CTAP2_ERR_PIN_BLOCKED   0x32
+#define CTAP2_ERR_PIN_AUTH_INVALID 0x33
+#define CTAP2_ERR_PIN_AUTH_BLOCKED 0x34
+#define CTAP2_ERR_PIN_NOT_SET   0x35
+#define CTAP2_ERR_PIN_REQUIRED  0x36
+#define CTAP2_ERR_PIN_POLICY_VIOLATION 0x37
+#define CTAP2_ERR_OTHER         0x7F
+
+#define CTAP2_UP_TIMEOUT_MS     30000
+
+// How long GetNextAssertion may follow the command before it
+#define CTAP2_NEXT_ASSERT_TIMEOUT_MS    30000
 
+// allowList/excludeList limits, advertised in GetInfo (0x07, 0x08).
+// Foreign IDs are rejected by their keyed tag, so long lists stay cheap.
+#define CTAP2_MAX_CRED_COUNT_IN_LIST    20
+#define CTAP2_MAX_CRED_ID_LENGTH        U2F_KH_MAX_SIZE
+
+// Largest encoded response body; bigger ones fail with CTAP2_ERR_OTHER
+#ifndef CTAP2_MAX_RESPONSE_SIZE
+#define CTAP2_MAX_RESPONSE_SIZE         1024
+#endif
+
+// Encoded GetInfo response, built at init and kept until invalidated
+#ifndef CTAP2_INFO_MAX_SIZE
+#define CTAP2_INFO_MAX_SIZE             256
+#endif
+
+void ctap2_init(void);
 void ctap2_handle_cbor(uint32_t cid, uint8_t *payload, uint16_t len);
+// Configuration reported by GetInfo changed: rebuilt on the next request
+void ctap2_get_info_invalidate(void);
+
+// Overlap request parsing with CTAPHID reassembly (worker task only).
+// Feed the received prefix of a CBOR message (command byte first) as it
+// grows; txn tells transactions that reuse a buffer apart. Feed the whole
+// message once more before ctap2_handle_cbor(), reset after it.
+void ctap2_stream_feed(uint32_t txn, const uint8_t *msg, size_t received);
+void ctap2_stream_reset(void);
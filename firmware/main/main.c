@@ -8,12 +8,18 @@
 #include "tusb.h"
 #include "tusb_cdc_acm.h"
 #include "u2f.h"
+#include "ctap2.h"
+#include "cred_store.h"
+#include "user_presence.h"
 
 static const char *TAG = "U2F_MAIN";
 
 // Pin Definitions (Adjust based on Schematic)
 #define LED_PIN     18
-#define BUTTON_PIN  0
+
+// USB Task (TinyUSB device stack)
+#define USB_TASK_STACK      4096
+#define USB_TASK_PRIORITY   (configMAX_PRIORITIES - 2)
 
 // Initialize NVS (Non-Volatile Storage)
 void init_nvs() {
@@ -32,40 +38,45 @@ void init_gpio() {
     gpio_reset_pin(LED_PIN);
     gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
     
-    // Button Input (Pull-up)
-    gpio_reset_pin(BUTTON_PIN);
-    gpio_set_direction(BUTTON_PIN, GPIO_MODE_INPUT);
-    gpio_set_pull_mode(BUTTON_PIN, GPIO_PULLUP_ONLY);
+    // Button Input (interrupt driven, see user_presence.c)
+    up_init();
     
     ESP_LOGI(TAG, "GPIO Initialized");
 }
 
+// USB Task: blocks on the TinyUSB event queue and services every event as it
+// arrives. Reassembly happens here; complete messages go to the U2F worker.
+static void usb_task(void *arg) {
+    ESP_LOGI(TAG, "Initializing TinyUSB...");
+    tusb_init();
+
+    while (1) {
+        tud_task(); // Blocks until the next USB event
+    }
+}
+
 // Main Application Entry Point
 void app_main(void) {
     ESP_LOGI(TAG, "Starting ESP32 U2F Token...");
 
     // 1. Init Hardware
     init_nvs();
+    if (cred_store_init() != ESP_OK) {
+        ESP_LOGW(TAG, "No resident credential storage");
+    }
     init_gpio();
+    u2f_init();
+    ctap2_init();
 
-    // 2. Init USB Stack (TinyUSB)
-    ESP_LOGI(TAG, "Initializing TinyUSB...");
-    tusb_init();
+    // 2. Start USB Stack (TinyUSB) in its own task
+    xTaskCreate(usb_task, "usb", USB_TASK_STACK, NULL, USB_TASK_PRIORITY, NULL);
 
-    // 3. Main Loop
+    // 3. Main Loop (status LED only, USB is serviced by usb_task)
     while (1) {
-        // Handle TinyUSB tasks
-        tud_task(); 
-        
         // Simple Blink to show life
         static int led_state = 0;
         gpio_set_level(LED_PIN, led_state);
         led_state = !led_state;
-        
-        // Check Button
-        if (gpio_get_level(BUTTON_PIN) == 0) {
-            ESP_LOGI(TAG, "Button Pressed!");
-        }
 
         vTaskDelay(pdMS_TO_TICKS(100)); // 100ms delay
     }
@@ -97,3 +108,8 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
   // Pass HID report to U2F stack
   u2f_handle_report((uint8_t*)buffer, bufsize);
 }
+
+// Invoked when an IN report has been delivered to the host
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len) {
+  u2f_hid_tx_complete();
+}
@@ -1,37 +1,32 @@
 #include <string.h>
 #include "esp_log.h"
-#include "tusb.h"
 #include "u2f.h"
 #include "crypto_hal.h"
+#include "user_presence.h"
 #include "nvs.h"
+#include "counter_store.h"
 
 static const char *TAG = "U2F";
 
-// U2F HID Packet Structure
-typedef struct __attribute__((packed)) {
-    uint32_t cid;
-    union {
-        struct {
-            uint8_t cmd;
-            uint8_t bcnt_h;
-            uint8_t bcnt_l;
-            uint8_t data[U2F_HID_PACKET_SIZE - 7];
-        } init;
-        struct {
-            uint8_t seq;
-            uint8_t data[U2F_HID_PACKET_SIZE - 5];
-        } cont;
-    };
-} u2f_hid_packet_t;
+static uint8_t device_master_key[32];
+static hal_gcm_key_t *master_wrap_key = NULL; // Expanded once, wraps every key handle
+static hal_sha256_ctx_t kh_tag_base; // SHA-256 midstate after one block of tag key, cloned per check
 
-// State for fragmentation (Simplified: assumes single transaction for now)
-static uint32_t current_cid = 0;
-static uint8_t apdu_buffer[1024];
-static uint16_t apdu_len = 0;
-static uint16_t apdu_idx = 0;
+// Tag key = SHA-256("OpenFIDO-ESP kh tag" | MasterKey), absorbed as one zero-padded
+// 64-byte block so each tag costs a single compression on top of the midstate.
+static void init_kh_tag_base(void) {
+    static const char label[] = "OpenFIDO-ESP kh tag";
+    uint8_t block[64] = {0};
+    hal_sha256_ctx_t sha;
+    hal_sha256_init(&sha);
+    hal_sha256_update(&sha, (const uint8_t *)label, sizeof(label) - 1);
+    hal_sha256_update(&sha, device_master_key, 32);
+    hal_sha256_final(&sha, block);
 
-static uint32_t global_counter = 0;
-static uint8_t device_master_key[32];
+    hal_sha256_init(&kh_tag_base);
+    hal_sha256_update(&kh_tag_base, block, sizeof(block));
+    memset(block, 0, sizeof(block));
+}
 
 static void load_device_key() {
     nvs_handle_t my_handle;
@@ -50,126 +45,208 @@ static void load_device_key() {
         nvs_commit(my_handle);
     }
     nvs_close(my_handle);
+    master_wrap_key = hal_gcm_key_create(device_master_key);
+    init_kh_tag_base();
 }
 
+// Counters live in the counter journal; one left in NVS by older firmware
+// becomes its floor
 static void load_counter() {
-    nvs_handle_t my_handle;
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_handle);
+    esp_err_t err = counter_store_init();
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Error (%s) opening counter journal!", esp_err_to_name(err));
         return;
     }
-    
-    err = nvs_get_u32(my_handle, "counter", &global_counter);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        global_counter = 1;
-        nvs_set_u32(my_handle, "counter", global_counter);
-        nvs_commit(my_handle);
-    }
-    nvs_close(my_handle);
-    ESP_LOGI(TAG, "Counter loaded: %lu", global_counter);
-}
 
-static void increment_counter() {
-    global_counter++;
     nvs_handle_t my_handle;
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_handle);
-    if (err == ESP_OK) {
-        nvs_set_u32(my_handle, "counter", global_counter);
-        nvs_commit(my_handle);
+    uint32_t legacy;
+    if (nvs_open("storage", NVS_READONLY, &my_handle) == ESP_OK) {
+        if (nvs_get_u32(my_handle, "counter", &legacy) == ESP_OK) {
+            counter_store_raise(COUNTER_GLOBAL, legacy);
+        }
         nvs_close(my_handle);
     }
 }
 
+// Attestation Key (Static for Demo - In prod, generate/store securely)
+static const uint8_t attestation_private_key[32] = {
+    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88
+};
+
+// Attestation Cert (Placeholder until a certificate for the key above is provisioned)
+static const uint8_t attestation_cert[] = {
+    0x30, 0x00 // SEQ, Len 0
+};
+
+static const uint8_t sw_no_error[] = {0x90, 0x00};
+
+// Validated once at boot, see hal_ecc_key_create()
+static hal_ecc_key_t *attestation_key = NULL;
+
 void u2f_init(void) {
     ESP_LOGI(TAG, "U2F Stack Initialized");
+    hal_crypto_init();
+    attestation_key = hal_ecc_key_create(attestation_private_key);
     load_counter();
     load_device_key();
+    u2f_hid_init();
 }
 
-void u2f_send_response(uint32_t cid, uint8_t cmd, uint8_t *data, uint16_t len) {
-    u2f_hid_packet_t resp;
-    memset(&resp, 0, sizeof(resp));
-    
-    resp.cid = cid;
-    resp.init.cmd = cmd;
-    resp.init.bcnt_h = (len >> 8) & 0xFF;
-    resp.init.bcnt_l = len & 0xFF;
-    
-    uint16_t to_copy = (len > (U2F_HID_PACKET_SIZE - 7)) ? (U2F_HID_PACKET_SIZE - 7) : len;
-    memcpy(resp.init.data, data, to_copy);
-    
-    tud_hid_report(0, &resp, U2F_HID_PACKET_SIZE);
-    
-    // TODO: Handle fragmentation for larger responses
+// Keyed tag over AppParam | Version | Nonce: 45 bytes plus padding fit one block
+static void kh_tag(const uint8_t *application_parameter, const uint8_t *version_nonce, uint8_t tag[32]) {
+    hal_sha256_ctx_t sha;
+    hal_sha256_clone(&sha, &kh_tag_base);
+    hal_sha256_update(&sha, application_parameter, 32);
+    hal_sha256_update(&sha, version_nonce, 1 + U2F_KH_NONCE_SIZE);
+    hal_sha256_final(&sha, tag);
 }
 
-// Attestation Key (Static for Demo - In prod, generate/store securely)
-static const uint8_t attestation_private_key[32] = {
-    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
-    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
-    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
-    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88
-};
+static bool kh_tag_matches(const uint8_t *application_parameter, const uint8_t *key_handle) {
+    uint8_t tag[32];
+    kh_tag(application_parameter, key_handle, tag);
+    const uint8_t *kh_tag_ptr = key_handle + U2F_KH_SIZE - U2F_KH_TAG_SIZE;
+    uint8_t diff = 0;
+    for (int i = 0; i < U2F_KH_TAG_SIZE; i++) {
+        diff |= tag[i] ^ kh_tag_ptr[i];
+    }
+    return diff == 0;
+}
 
-int u2f_create_key_handle(const uint8_t *application_parameter, const uint8_t *private_key, uint8_t *key_handle) {
-    // Key Handle: [IV(12) | EncryptedKey(32) | Tag(16)] = 60 bytes
-    uint8_t kh_iv[12];
-    hal_rng_generate(kh_iv, 12);
-    
-    uint8_t kh_ciphertext[32];
-    uint8_t kh_tag[16];
+int u2f_create_credential_id(const uint8_t *application_parameter, const uint8_t *private_key, int32_t alg,
+                             uint8_t *key_handle) {
+    // Key Handle v1: [Format(1) | Nonce(12) | EncryptedKey(32) | GCMTag(16) | KeyedTag(8)] = 69 bytes
+    uint8_t *format_nonce = key_handle;
+    format_nonce[0] = U2F_KH_VERSION_1 | (alg == HAL_ALG_EDDSA ? U2F_KH_FLAG_EDDSA : 0);
+    hal_rng_generate(format_nonce + 1, U2F_KH_NONCE_SIZE);
     
     // Encrypt Private Key with Master Key
-    // AAD = AppParam (Bind key to Application)
-    int ret = hal_aes_gcm_encrypt(device_master_key, kh_iv, 12,
-                        application_parameter, 32,
+    // AAD = AppParam | Format (Bind key to Application, format and algorithm)
+    uint8_t aad[33];
+    memcpy(aad, application_parameter, 32);
+    aad[32] = format_nonce[0];
+    int ret = hal_gcm_key_encrypt(master_wrap_key, format_nonce + 1, U2F_KH_NONCE_SIZE,
+                        aad, sizeof(aad),
                         private_key, 32,
-                        kh_ciphertext, kh_tag, 16);
+                        key_handle + 13, key_handle + 45, 16);
     
     if (ret != 0) return 0;
 
-    memcpy(key_handle, kh_iv, 12);
-    memcpy(key_handle + 12, kh_ciphertext, 32);
-    memcpy(key_handle + 44, kh_tag, 16);
+    uint8_t tag[32];
+    kh_tag(application_parameter, format_nonce, tag);
+    memcpy(key_handle + 61, tag, U2F_KH_TAG_SIZE);
     
-    return 60;
+    return U2F_KH_SIZE;
+}
+
+int u2f_create_key_handle(const uint8_t *application_parameter, const uint8_t *private_key, uint8_t *key_handle) {
+    return u2f_create_credential_id(application_parameter, private_key, HAL_ALG_ES256, key_handle);
 }
 
 int u2f_sign_attestation(const uint8_t *hash, uint8_t *signature) {
-    return hal_ecc_sign(attestation_private_key, hash, signature);
+    uint8_t sig_rs[HAL_ECC_SIG_RAW_SIZE];
+    int ret = hal_ecc_sign_key(attestation_key, hash, sig_rs);
+    if (ret != 0) return ret;
+    return hal_ecdsa_sig_to_der(sig_rs, signature);
 }
 
-int u2f_unwrap_key_handle(const uint8_t *application_parameter, const uint8_t *key_handle, uint8_t kh_len, uint8_t *private_key) {
-    if (kh_len != 60) return -1;
+static bool is_v1(const uint8_t *key_handle, uint8_t kh_len) {
+    return kh_len == U2F_KH_SIZE && (key_handle[0] & U2F_KH_VERSION_MASK) == U2F_KH_VERSION_1 &&
+           (key_handle[0] & ~(U2F_KH_VERSION_MASK | U2F_KH_FLAG_EDDSA)) == 0;
+}
+
+int u2f_unwrap_credential_id(const uint8_t *application_parameter, const uint8_t *key_handle, uint8_t kh_len,
+                             uint8_t *private_key, int32_t *alg) {
+    if (is_v1(key_handle, kh_len)) {
+        // Foreign or wrong-RP handles stop here, before any AES work
+        if (!kh_tag_matches(application_parameter, key_handle)) return -1;
+
+        uint8_t aad[33];
+        memcpy(aad, application_parameter, 32);
+        aad[32] = key_handle[0];
+        *alg = (key_handle[0] & U2F_KH_FLAG_EDDSA) ? HAL_ALG_EDDSA : HAL_ALG_ES256;
+        return hal_gcm_key_decrypt(master_wrap_key, key_handle + 1, U2F_KH_NONCE_SIZE,
+                                   aad, sizeof(aad),
+                                   key_handle + 13, 32,
+                                   private_key, key_handle + 45, 16);
+    }
+
+    if (kh_len != U2F_KH_LEGACY_SIZE) return -1;
     
-    // KH = [IV(12) | Cipher(32) | Tag(16)]
+    // Legacy KH = [IV(12) | Cipher(32) | Tag(16)], AAD = AppParam, always ES256
     const uint8_t *kh_iv_ptr = key_handle;
     const uint8_t *kh_cipher_ptr = key_handle + 12;
     const uint8_t *kh_tag_ptr = key_handle + 12 + 32;
     
-    return hal_aes_gcm_decrypt(device_master_key, kh_iv_ptr, 12,
-                                      application_parameter, 32,
-                                      kh_cipher_ptr, 32,
-                                      private_key, kh_tag_ptr, 16);
+    *alg = HAL_ALG_ES256;
+    return hal_gcm_key_decrypt(master_wrap_key, kh_iv_ptr, 12,
+                               application_parameter, 32,
+                               kh_cipher_ptr, 32,
+                               private_key, kh_tag_ptr, 16);
+}
+
+// U2F only signs with P-256: EdDSA credentials are not valid key handles there
+int u2f_unwrap_key_handle(const uint8_t *application_parameter, const uint8_t *key_handle, uint8_t kh_len, uint8_t *private_key) {
+    int32_t alg;
+    if (kh_len == U2F_KH_SIZE && key_handle[0] != U2F_KH_VERSION_1) return -1;
+    return u2f_unwrap_credential_id(application_parameter, key_handle, kh_len, private_key, &alg);
+}
+
+bool u2f_check_key_handle(const uint8_t *application_parameter, const uint8_t *key_handle, uint8_t kh_len) {
+    if (kh_len == U2F_KH_SIZE) {
+        return key_handle[0] == U2F_KH_VERSION_1 && kh_tag_matches(application_parameter, key_handle);
+    }
+
+    uint8_t private_key[32];
+    bool ok = u2f_unwrap_key_handle(application_parameter, key_handle, kh_len, private_key) == 0;
+    memset(private_key, 0, sizeof(private_key));
+    return ok;
+}
+
+int u2f_unwrap_first(const uint8_t *application_parameter, const u2f_key_handle_ref_t *khs, size_t count,
+                     uint8_t *private_key, int32_t *alg) {
+    for (size_t i = 0; i < count; i++) {
+        if (u2f_unwrap_credential_id(application_parameter, khs[i].data, khs[i].len, private_key, alg) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
 }
 
-static void process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
+void u2f_process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
     if (len < 4) return;
     
     uint8_t cla = apdu[0];
     uint8_t ins = apdu[1];
     uint8_t p1 = apdu[2];
     uint8_t p2 = apdu[3];
-    // Lc = apdu[4], Data starts at apdu[5] (Short APDU)
-    uint8_t lc = apdu[4];
-    uint8_t *data = &apdu[5];
+    uint16_t lc = 0;
+    uint16_t hdr_len = 4;
+    if (len >= 7 && apdu[4] == 0x00) {
+        // Extended Length: 00 | Lc(2), Data starts at apdu[7]
+        lc = (apdu[5] << 8) | apdu[6];
+        hdr_len = 7;
+    } else if (len >= 5) {
+        // Short APDU: Lc = apdu[4], Data starts at apdu[5]
+        lc = apdu[4];
+        hdr_len = 5;
+    }
+    uint8_t *data = &apdu[hdr_len];
     
     ESP_LOGI(TAG, "APDU: CLA=%02X INS=%02X P1=%02X P2=%02X LC=%d", cla, ins, p1, p2, lc);
     
     uint8_t resp_buf[512];
     uint16_t resp_len = 0;
     
+    if (hdr_len + lc > len) {
+        resp_buf[0] = 0x67; // Wrong Length
+        resp_buf[1] = 0x00;
+        u2f_send_response(cid, U2FHID_MSG, resp_buf, 2);
+        return;
+    }
+    
     switch (ins) {
         case U2F_INS_VERSION:
             if (len == 0) { // Handling cases where len might be just header
@@ -191,6 +268,14 @@ static void process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
                 break;
             }
             ESP_LOGI(TAG, "CMD: REGISTER");
+
+            // The host polls until the button has been pressed
+            if (!up_check()) {
+                resp_buf[0] = 0x69; // Cond. Not Satisfied (User Presence required)
+                resp_buf[1] = 0x85;
+                resp_len = 2;
+                break;
+            }
             
             uint8_t *challenge = data;
             uint8_t *app_param = data + 32;
@@ -198,7 +283,13 @@ static void process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
             // 1. Generate Keypair
             uint8_t priv_key[32];
             uint8_t pub_key[65];
-            hal_ecc_generate_keypair(priv_key, pub_key);
+            if (hal_ecc_take_keypair(priv_key, pub_key) != 0) {
+                memset(priv_key, 0, sizeof(priv_key));
+                resp_buf[0] = 0x6F; // No precise diagnosis
+                resp_buf[1] = 0x00;
+                resp_len = 2;
+                break;
+            }
             
             // 2. Construct Response
             resp_buf[0] = 0x05; // Reserved
@@ -207,9 +298,16 @@ static void process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
             memcpy(&resp_buf[1], pub_key, 65);
             resp_len = 1 + 65;
             
-            // Key Handle: [IV(12) | EncryptedKey(32) | Tag(16)] = 60 bytes
-            uint8_t kh_len = u2f_create_key_handle(app_param, priv_key, &resp_buf[resp_len + 1]);
-            resp_buf[resp_len++] = kh_len;
+            // Key Handle: v1 format, see u2f.h
+            int kh_len = u2f_create_key_handle(app_param, priv_key, &resp_buf[resp_len + 1]);
+            memset(priv_key, 0, sizeof(priv_key));
+            if (kh_len == 0) {
+                resp_buf[0] = 0x6F; // Wrapping failed
+                resp_buf[1] = 0x00;
+                resp_len = 2;
+                break;
+            }
+            resp_buf[resp_len++] = (uint8_t)kh_len;
             resp_len += kh_len;
             
             // Attestation Cert (Self-signed or minimal)
@@ -223,33 +321,37 @@ static void process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
             
             // Signature
             // Sig Input: 0x00 || AppParam || Challenge || KeyHandle || PubKey
-            // Size: 1 + 32 + 32 + 60 + 65 = 190
-            uint8_t sig_input[200];
-            sig_input[0] = 0x00;
-            memcpy(&sig_input[1], app_param, 32);
-            memcpy(&sig_input[33], challenge, 32);
-            memcpy(&sig_input[65], &resp_buf[resp_len - kh_len], kh_len); // Key Handle from buffer
-            memcpy(&sig_input[65 + kh_len], pub_key, 65);
-            
+            // Size: 1 + 32 + 32 + 69 + 65 = 199
+            static const uint8_t reserved = 0x00;
+            hal_sha256_ctx_t sha;
             uint8_t sig_hash[32];
-            hal_sha256(sig_input, 1 + 32 + 32 + kh_len + 65, sig_hash);
+            hal_sha256_init(&sha);
+            hal_sha256_update(&sha, &reserved, 1);
+            hal_sha256_update(&sha, app_param, 32);
+            hal_sha256_update(&sha, challenge, 32);
+            hal_sha256_update(&sha, &resp_buf[resp_len - kh_len], kh_len); // Key Handle from buffer
+            hal_sha256_update(&sha, pub_key, 65);
+            hal_sha256_final(&sha, sig_hash);
             
             uint8_t signature[72];
-            int sig_size = hal_ecc_sign(attestation_private_key, sig_hash, signature);
-            
-            // Append Cert (Mock: just 0s for now, browsers might reject)
-            // Ideally we need a pre-generated cert for the attestation key.
-            // We'll add a small placeholder.
-            resp_buf[resp_len++] = 0x30; // SEQ
-            resp_buf[resp_len++] = 0x00; // Len 0
-            
-            // Append Signature
-            memcpy(&resp_buf[resp_len], signature, sig_size);
-            resp_len += sig_size;
+            int sig_size = u2f_sign_attestation(sig_hash, signature);
+            if (sig_size <= 0) {
+                resp_buf[0] = 0x6F; // No precise diagnosis
+                resp_buf[1] = 0x00;
+                resp_len = 2;
+                break;
+            }
             
-            resp_buf[resp_len++] = 0x90;
-            resp_buf[resp_len++] = 0x00;
-            break;
+            // Response: [Prefix | Cert | Signature | SW], streamed without re-assembling.
+            // The certificate stays in flash.
+            const u2f_hid_segment_t reg_segs[] = {
+                {resp_buf, resp_len},
+                {attestation_cert, sizeof(attestation_cert)},
+                {signature, (uint16_t)sig_size},
+                {sw_no_error, sizeof(sw_no_error)},
+            };
+            u2f_send_segments(cid, U2FHID_MSG, reg_segs, 4);
+            return;
             
         case U2F_INS_AUTHENTICATE:
             if (lc < 65) { // Chal(32) + App(32) + KH_Len(1) + KH
@@ -266,46 +368,32 @@ static void process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
             uint8_t auth_kh_len = data[64];
             uint8_t *auth_kh = data + 65;
             
-            if (auth_kh_len != 60) {
+            if (lc < 65 + auth_kh_len) {
                 resp_buf[0] = 0x6A; // Wrong Data (Bad Key Handle)
                 resp_buf[1] = 0x80;
                 resp_len = 2;
                 break;
             }
             
-            // Check-only?
+            // Check-only: "ours" is answered with Cond. Not Satisfied, anything else with Wrong Data
             if (control == 0x07) {
-                resp_buf[0] = 0x69; // Cond. Not Satisfied (User Presence required)
-                resp_buf[1] = 0x85;
+                if (u2f_check_key_handle(auth_app_param, auth_kh, auth_kh_len)) {
+                    resp_buf[0] = 0x69;
+                    resp_buf[1] = 0x85;
+                } else {
+                    resp_buf[0] = 0x6A;
+                    resp_buf[1] = 0x80;
+                }
                 resp_len = 2;
                 break;
             }
             
-            // Enforce User Presence (Button)
-            // In real code: wait for button press or return "Not Satisfied" immediately if not pressed.
-            // For demo: assume pressed.
-            uint8_t user_presence = 0x01;
-            increment_counter();
-            uint32_t counter = global_counter;
-            
-            // Sign(AppParam || UserPresence || Counter || Challenge)
-            uint8_t auth_sig_input[32 + 1 + 4 + 32];
-            memcpy(&auth_sig_input[0], auth_app_param, 32);
-            auth_sig_input[32] = user_presence;
-            auth_sig_input[33] = (counter >> 24) & 0xFF;
-            auth_sig_input[34] = (counter >> 16) & 0xFF;
-            auth_sig_input[35] = (counter >> 8) & 0xFF;
-            auth_sig_input[36] = counter & 0xFF;
-            memcpy(&auth_sig_input[37], auth_challenge, 32);
-            
-            uint8_t auth_hash[32];
-            hal_sha256(auth_sig_input, sizeof(auth_sig_input), auth_hash);
-            
             // Recover Private Key from Key Handle
             uint8_t recovered_priv_key[32];
             int dec_ret = u2f_unwrap_key_handle(auth_app_param, auth_kh, auth_kh_len, recovered_priv_key);
             
             if (dec_ret != 0) {
+                memset(recovered_priv_key, 0, sizeof(recovered_priv_key));
                 ESP_LOGE(TAG, "Bad Key Handle (Decrypt Failed)");
                 resp_buf[0] = 0x6A; // Wrong Data
                 resp_buf[1] = 0x80;
@@ -313,15 +401,52 @@ static void process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
                 break;
             }
             
-            uint8_t auth_signature[72];
-            int auth_sig_size = hal_ecc_sign(recovered_priv_key, auth_hash, auth_signature);
+            // Enforce User Presence (Button), unless P1 is dont-enforce (0x08).
+            // The host re-sends the request until the press is seen.
+            uint8_t user_presence = 0x00;
+            if (control != 0x08) {
+                if (!up_check()) {
+                    memset(recovered_priv_key, 0, sizeof(recovered_priv_key));
+                    resp_buf[0] = 0x69; // Cond. Not Satisfied
+                    resp_buf[1] = 0x85;
+                    resp_len = 2;
+                    break;
+                }
+                user_presence = 0x01;
+            }
+            uint32_t counter = counter_store_next(COUNTER_GLOBAL);
+            if (counter == 0) {
+                memset(recovered_priv_key, 0, sizeof(recovered_priv_key));
+                resp_buf[0] = 0x6F; // No ceiling could be written
+                resp_buf[1] = 0x00;
+                resp_len = 2;
+                break;
+            }
             
+            // Sign(AppParam || UserPresence || Counter || Challenge)
+            // UP flag and counter sit in resp_buf already, in the order they are signed
             resp_buf[0] = user_presence;
             resp_buf[1] = (counter >> 24) & 0xFF;
             resp_buf[2] = (counter >> 16) & 0xFF;
             resp_buf[3] = (counter >> 8) & 0xFF;
             resp_buf[4] = counter & 0xFF;
-            memcpy(&resp_buf[5], auth_signature, auth_sig_size);
+            hal_sha256_ctx_t auth_sha;
+            uint8_t auth_hash[32];
+            hal_sha256_init(&auth_sha);
+            hal_sha256_update(&auth_sha, auth_app_param, 32);
+            hal_sha256_update(&auth_sha, resp_buf, 5);
+            hal_sha256_update(&auth_sha, auth_challenge, 32);
+            hal_sha256_final(&auth_sha, auth_hash);
+            
+            // Signature straight after the counter
+            int auth_sig_size = hal_ecc_sign(recovered_priv_key, auth_hash, &resp_buf[5]);
+            memset(recovered_priv_key, 0, sizeof(recovered_priv_key));
+            if (auth_sig_size < 0) {
+                resp_buf[0] = 0x6F; // No precise diagnosis
+                resp_buf[1] = 0x00;
+                resp_len = 2;
+                break;
+            }
             resp_len = 5 + auth_sig_size;
             
             resp_buf[resp_len++] = 0x90;
@@ -336,49 +461,5 @@ static void process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len) {
             break;
     }
     
-    send_response(cid, U2FHID_MSG, resp_buf, resp_len);
-}
-
-void u2f_handle_report(uint8_t *report, uint16_t len) {
-    u2f_hid_packet_t *pkt = (u2f_hid_packet_t *)report;
-    
-    if (pkt->cid == U2F_HID_CID_BROADCAST) {
-        if (pkt->init.cmd == U2FHID_INIT) {
-            // Handle Init
-            uint8_t nonce[8];
-            memcpy(nonce, pkt->init.data, 8);
-            
-            uint8_t resp[17];
-            memcpy(resp, nonce, 8);
-            // New CID
-            uint32_t new_cid = 0x12345678; // Static for now
-            resp[8] = (new_cid >> 24) & 0xFF;
-            resp[9] = (new_cid >> 16) & 0xFF;
-            resp[10] = (new_cid >> 8) & 0xFF;
-            resp[11] = new_cid & 0xFF;
-            resp[12] = 2; // Protocol version
-            resp[13] = 1; // Major
-            resp[14] = 0; // Minor
-            resp[15] = 0; // Build
-            resp[16] = 0; // Cap flags
-            
-            send_response(U2F_HID_CID_BROADCAST, U2FHID_INIT, resp, 17);
-            return;
-        }
-    }
-    
-    if (pkt->init.cmd == U2FHID_MSG) {
-        uint16_t payload_len = (pkt->init.bcnt_h << 8) | pkt->init.bcnt_l;
-        // Assuming single packet for now (short APDUs)
-        process_apdu(pkt->cid, pkt->init.data, payload_len);
-    }
-    else if (pkt->init.cmd == U2FHID_PING) {
-        uint16_t payload_len = (pkt->init.bcnt_h << 8) | pkt->init.bcnt_l;
-        u2f_send_response(pkt->cid, U2FHID_PING, pkt->init.data, payload_len);
-    }
-    else if (pkt->init.cmd == 0x90) { // U2FHID_CBOR
-        uint16_t payload_len = (pkt->init.bcnt_h << 8) | pkt->init.bcnt_l;
-        extern void ctap2_handle_cbor(uint32_t cid, uint8_t *payload, uint16_t len);
-        ctap2_handle_cbor(pkt->cid, pkt->init.data, payload_len);
-    }
+    u2f_send_response(cid, U2FHID_MSG, resp_buf, resp_len);
 }
@@ -1,10 +1,28 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 // U2F HID Constants
 #define U2F_HID_CID_BROADCAST   0xFFFFFFFF
 #define U2F_HID_PACKET_SIZE     64
+#define U2F_HID_INIT_DATA_SIZE  (U2F_HID_PACKET_SIZE - 7)
+#define U2F_HID_CONT_DATA_SIZE  (U2F_HID_PACKET_SIZE - 5)
+#define U2F_HID_MAX_SEQ         0x7F
+// 57 bytes in the init packet + 128 continuation packets of 59 bytes
+#define U2F_HID_MAX_MSG_SIZE    (U2F_HID_INIT_DATA_SIZE + (U2F_HID_MAX_SEQ + 1) * U2F_HID_CONT_DATA_SIZE)
+
+// Channel table and reassembly limits
+#define U2F_HID_MAX_CHANNELS    4 // Least recently used idle channel is evicted on INIT
+#define U2F_HID_MSG_TIMEOUT_MS  500 // Max gap between packets of one message
+#define U2F_HID_TX_TIMEOUT_MS   1000 // Max wait for the host to drain the IN endpoint
+#define U2F_HID_MAX_LOCK_S      10
+#define U2F_HID_KEEPALIVE_MS    100 // KEEPALIVE period while a MSG/CBOR request is being processed
+
+// Protocol/crypto worker task (handlers and signing run here, not in the USB task)
+#define U2F_HID_WORKER_STACK    10240
+#define U2F_HID_WORKER_PRIORITY 5
 
 // U2F HID Commands
 #define U2FHID_PING         (0x80 | 0x01)
@@ -12,17 +30,86 @@
 #define U2FHID_LOCK         (0x80 | 0x04)
 #define U2FHID_INIT         (0x80 | 0x06)
 #define U2FHID_WINK         (0x80 | 0x08)
+#define U2FHID_CBOR         (0x80 | 0x10)
+#define U2FHID_CANCEL       (0x80 | 0x11)
+#define U2FHID_KEEPALIVE    (0x80 | 0x3B)
 #define U2FHID_ERROR        (0x80 | 0x3F)
 
+// U2F HID Capability Flags (INIT response)
+#define U2FHID_CAPABILITY_WINK  0x01
+#define U2FHID_CAPABILITY_CBOR  0x04
+
+// U2F HID KEEPALIVE Status
+#define U2FHID_STATUS_PROCESSING    0x01
+#define U2FHID_STATUS_UPNEEDED      0x02
+
+// U2F HID Error Codes
+#define U2FHID_ERR_INVALID_CMD      0x01
+#define U2FHID_ERR_INVALID_PAR      0x02
+#define U2FHID_ERR_INVALID_LEN      0x03
+#define U2FHID_ERR_INVALID_SEQ      0x04
+#define U2FHID_ERR_MSG_TIMEOUT      0x05
+#define U2FHID_ERR_CHANNEL_BUSY     0x06
+#define U2FHID_ERR_INVALID_CHANNEL  0x0B
+#define U2FHID_ERR_OTHER            0x7F
+
+// Key handle / credential ID formats.
+// Legacy: IV(12) | EncryptedKey(32) | GCMTag(16), still accepted on unwrap.
+// v1:     Format(1) | Nonce(12) | EncryptedKey(32) | GCMTag(16) | KeyedTag(8)
+//         KeyedTag = SHA-256(TagKey-block | AppParam | Format | Nonce)[0..8], checked
+//         before decrypting so foreign handles cost one compression, not a GCM pass.
+//         Format = version | algorithm flag; EncryptedKey is a P-256 scalar or an Ed25519 seed.
+#define U2F_KH_LEGACY_SIZE      60
+#define U2F_KH_VERSION_1        0x01
+#define U2F_KH_VERSION_MASK     0x0F
+#define U2F_KH_FLAG_EDDSA       0x10
+#define U2F_KH_NONCE_SIZE       12
+#define U2F_KH_TAG_SIZE         8
+#define U2F_KH_SIZE             (1 + U2F_KH_NONCE_SIZE + 32 + 16 + U2F_KH_TAG_SIZE)
+#define U2F_KH_MAX_SIZE         U2F_KH_SIZE
+
 // U2F APDU Instructions
 #define U2F_INS_REGISTER        0x01
 #define U2F_INS_AUTHENTICATE    0x02
 #define U2F_INS_VERSION         0x03
 
+// One piece of a response, sent in order without being copied into a staging buffer
+typedef struct {
+    const uint8_t *data;
+    uint16_t len;
+} u2f_hid_segment_t;
+
+// A key handle / credential ID in place, e.g. inside a CTAP2 allowList
+typedef struct {
+    const uint8_t *data;
+    uint8_t len;
+} u2f_key_handle_ref_t;
+
 // Public API
 void u2f_init(void);
-void u2f_handle_report(uint8_t *report, uint16_t len);
-void u2f_send_response(uint32_t cid, uint8_t cmd, uint8_t *data, uint16_t len);
+void u2f_process_apdu(uint32_t cid, uint8_t *apdu, uint16_t len);
 int u2f_create_key_handle(const uint8_t *application_parameter, const uint8_t *private_key, uint8_t *key_handle);
 int u2f_unwrap_key_handle(const uint8_t *application_parameter, const uint8_t *key_handle, uint8_t kh_len, uint8_t *private_key);
+// CTAP2 credential IDs: same format, with the key's algorithm (HAL_ALG_*) bound in
+int u2f_create_credential_id(const uint8_t *application_parameter, const uint8_t *private_key, int32_t alg,
+                             uint8_t *key_handle);
+int u2f_unwrap_credential_id(const uint8_t *application_parameter, const uint8_t *key_handle, uint8_t kh_len,
+                             uint8_t *private_key, int32_t *alg);
+// True if the key handle was issued by this device for this application parameter.
+// v1 handles are checked by their keyed tag alone; legacy ones need a decrypt.
+bool u2f_check_key_handle(const uint8_t *application_parameter, const uint8_t *key_handle, uint8_t kh_len);
+// Try a list of key handles against one application parameter with the cached
+// master-key context. Returns the index of the first one that unwraps, or -1.
+int u2f_unwrap_first(const uint8_t *application_parameter, const u2f_key_handle_ref_t *khs, size_t count,
+                     uint8_t *private_key, int32_t *alg);
 int u2f_sign_attestation(const uint8_t *hash, uint8_t *signature);
+
+// HID Transport (u2f_hid.c)
+void u2f_hid_init(void);
+void u2f_hid_tick(void);
+void u2f_hid_tx_complete(void);
+void u2f_handle_report(uint8_t *report, uint16_t len);
+void u2f_send_response(uint32_t cid, uint8_t cmd, const uint8_t *data, uint16_t len);
+void u2f_send_segments(uint32_t cid, uint8_t cmd, const u2f_hid_segment_t *segs, size_t count);
+void u2f_send_error(uint32_t cid, uint8_t error);
+void u2f_hid_set_keepalive_status(uint8_t status);
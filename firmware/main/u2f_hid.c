@@ -0,0 +1,654 @@
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "tusb.h"
+#include "u2f.h"
+#include "ctap2.h"
+#include "cred_store.h"
+#include "counter_store.h"
+#include "crypto_hal.h"
+#include "user_presence.h"
+
+static const char *TAG = "U2F_HID";
+
+// U2F HID Packet Structure
+typedef struct __attribute__((packed)) {
+    uint8_t cid[4]; // Big-endian on the wire
+    union {
+        struct {
+            uint8_t cmd;
+            uint8_t bcnt_h;
+            uint8_t bcnt_l;
+            uint8_t data[U2F_HID_INIT_DATA_SIZE];
+        } init;
+        struct {
+            uint8_t seq;
+            uint8_t data[U2F_HID_CONT_DATA_SIZE];
+        } cont;
+    };
+} u2f_hid_packet_t;
+
+typedef enum {
+    CH_FREE = 0,
+    CH_IDLE,  // Allocated, no transaction
+    CH_RX,    // Reassembling a message
+    CH_READY, // Message complete, queued for the worker
+    CH_BUSY,  // Handler running on the buffer
+} u2f_hid_channel_state_t;
+
+// One allocated channel. The payload is reassembled in place and handed to
+// the protocol handlers straight from `buf`.
+typedef struct {
+    u2f_hid_channel_state_t state;
+    uint32_t cid;
+    int64_t last_used_us; // For LRU eviction
+    uint8_t cmd;
+    uint16_t bcnt;      // Total payload length announced in the init packet
+    uint16_t received;  // Bytes reassembled so far
+    uint8_t next_seq;
+    int64_t last_rx_us; // Arrival time of the last packet
+    int64_t req_start_us; // Arrival of the init packet, cleared on the first response packet
+    uint32_t txn;       // Transaction number, for ctap2_stream_feed()
+    bool feed_queued;   // A progress entry for this channel is in msg_queue
+    uint8_t buf[U2F_HID_MAX_MSG_SIZE];
+} u2f_hid_channel_t;
+
+static u2f_hid_channel_t channels[U2F_HID_MAX_CHANNELS];
+
+// Only one transaction runs at a time; other channels get ERR_CHANNEL_BUSY
+static u2f_hid_channel_t *active = NULL;
+static uint32_t next_txn = 0;
+
+// U2FHID_LOCK owner and expiry
+static u2f_hid_channel_t *lock_owner = NULL;
+static int64_t lock_until_us = 0;
+
+// Reassembly runs in the USB task (tud_hid_set_report_cb), the handlers in
+// the worker task. chan_lock guards the channel table between the two.
+static SemaphoreHandle_t chan_lock;
+static QueueHandle_t msg_queue;
+static TaskHandle_t worker_task;
+
+// TX: tx_lock serialises tud_hid_report() between the tasks, tx_done is given
+// from tud_hid_report_complete_cb to pace multi-packet responses.
+static SemaphoreHandle_t tx_lock;
+static SemaphoreHandle_t tx_done;
+
+// Single-packet replies generated in the USB task (INIT, errors) cannot wait
+// for the endpoint, since its completion is processed by that same task.
+// They are parked here and flushed from the completion callback.
+#define U2F_HID_TX_BACKLOG 4
+static u2f_hid_packet_t tx_backlog[U2F_HID_TX_BACKLOG];
+static uint8_t tx_backlog_head = 0;
+static uint8_t tx_backlog_count = 0;
+
+// KEEPALIVE while a MSG/CBOR handler runs. An esp_timer is used rather than a
+// FreeRTOS timer because the timer service task runs below the worker.
+static esp_timer_handle_t keepalive_timer;
+static uint32_t keepalive_cid = 0; // 0 once the response has started, guarded by tx_lock
+static volatile uint8_t keepalive_status = U2FHID_STATUS_PROCESSING;
+
+static inline uint32_t read_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void write_be32(uint8_t *p, uint32_t v) {
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static u2f_hid_channel_t *find_channel(uint32_t cid) {
+    for (int i = 0; i < U2F_HID_MAX_CHANNELS; i++) {
+        if (channels[i].state != CH_FREE && channels[i].cid == cid) {
+            return &channels[i];
+        }
+    }
+    return NULL;
+}
+
+static void expire_lock(void) {
+    if (lock_owner && esp_timer_get_time() > lock_until_us) {
+        lock_owner = NULL;
+    }
+}
+
+static bool channel_locked_out(const u2f_hid_channel_t *ch) {
+    expire_lock();
+    return lock_owner && lock_owner != ch;
+}
+
+// Return the channel to idle and end its transaction
+static void finish_transaction(u2f_hid_channel_t *ch) {
+    ch->state = CH_IDLE;
+    ch->received = 0;
+    ch->bcnt = 0;
+    ch->last_used_us = esp_timer_get_time();
+    if (active == ch) active = NULL;
+}
+
+static void free_channel(u2f_hid_channel_t *ch) {
+    if (lock_owner == ch) lock_owner = NULL;
+    if (active == ch) active = NULL;
+    ch->state = CH_FREE;
+    ch->cid = 0;
+}
+
+static uint32_t new_cid(void) {
+    uint32_t cid;
+    do {
+        hal_rng_generate((uint8_t *)&cid, sizeof(cid));
+    } while (cid == 0 || cid == U2F_HID_CID_BROADCAST || find_channel(cid));
+    return cid;
+}
+
+// Allocate a channel, evicting the least recently used idle one if the table is full
+static u2f_hid_channel_t *alloc_channel(void) {
+    u2f_hid_channel_t *victim = NULL;
+    expire_lock();
+    for (int i = 0; i < U2F_HID_MAX_CHANNELS; i++) {
+        u2f_hid_channel_t *ch = &channels[i];
+        if (ch->state == CH_FREE) {
+            victim = ch;
+            break;
+        }
+        if (ch->state != CH_IDLE || ch == lock_owner) continue;
+        if (!victim || ch->last_used_us < victim->last_used_us) {
+            victim = ch;
+        }
+    }
+    if (!victim) return NULL;
+
+    if (victim->state != CH_FREE) {
+        ESP_LOGI(TAG, "Evicting idle CID %08lX", victim->cid);
+        free_channel(victim);
+    }
+    victim->cid = new_cid();
+    victim->state = CH_IDLE;
+    victim->last_used_us = esp_timer_get_time();
+    return victim;
+}
+
+static void note_first_byte(uint32_t cid) {
+    u2f_hid_channel_t *ch = find_channel(cid);
+    if (ch && ch->req_start_us) {
+        ESP_LOGD(TAG, "CID %08lX: request-to-first-byte %lld us", cid, esp_timer_get_time() - ch->req_start_us);
+        ch->req_start_us = 0;
+    }
+}
+
+// Send now if the endpoint is free, otherwise park in the backlog. Caller holds tx_lock.
+static void send_packet_nowait_locked(const u2f_hid_packet_t *pkt) {
+    if (tx_backlog_count == 0 && tud_hid_ready() && tud_hid_report(0, pkt, U2F_HID_PACKET_SIZE)) {
+        return;
+    }
+    if (tx_backlog_count < U2F_HID_TX_BACKLOG) {
+        uint8_t slot = (tx_backlog_head + tx_backlog_count) % U2F_HID_TX_BACKLOG;
+        memcpy(&tx_backlog[slot], pkt, sizeof(*pkt));
+        tx_backlog_count++;
+    } else {
+        ESP_LOGW(TAG, "TX backlog full, dropping reply");
+    }
+}
+
+// Called from the USB task
+static void send_packet_nowait(const u2f_hid_packet_t *pkt) {
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    send_packet_nowait_locked(pkt);
+    xSemaphoreGive(tx_lock);
+}
+
+// Called from the worker: block until the IN endpoint takes the packet
+static bool send_packet_wait(const u2f_hid_packet_t *pkt) {
+    int64_t deadline = esp_timer_get_time() + (int64_t)U2F_HID_TX_TIMEOUT_MS * 1000;
+    for (;;) {
+        xSemaphoreTake(tx_lock, portMAX_DELAY);
+        bool sent = tx_backlog_count == 0 && tud_hid_ready() && tud_hid_report(0, pkt, U2F_HID_PACKET_SIZE);
+        xSemaphoreGive(tx_lock);
+        if (sent) return true;
+
+        int64_t left_us = deadline - esp_timer_get_time();
+        if (left_us <= 0) return false;
+        xSemaphoreTake(tx_done, pdMS_TO_TICKS(left_us / 1000) + 1);
+    }
+}
+
+void u2f_hid_tx_complete(void) {
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    if (tx_backlog_count > 0 && tud_hid_report(0, &tx_backlog[tx_backlog_head], U2F_HID_PACKET_SIZE)) {
+        tx_backlog_head = (tx_backlog_head + 1) % U2F_HID_TX_BACKLOG;
+        tx_backlog_count--;
+    }
+    xSemaphoreGive(tx_lock);
+    xSemaphoreGive(tx_done);
+}
+
+static void keepalive_cb(void *arg) {
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    // Skip the beat if the host is not draining the endpoint anyway
+    if (keepalive_cid != 0 && tx_backlog_count == 0) {
+        u2f_hid_packet_t pkt;
+        memset(&pkt, 0, sizeof(pkt));
+        write_be32(pkt.cid, keepalive_cid);
+        pkt.init.cmd = U2FHID_KEEPALIVE;
+        pkt.init.bcnt_l = 1;
+        pkt.init.data[0] = keepalive_status;
+        send_packet_nowait_locked(&pkt);
+    }
+    xSemaphoreGive(tx_lock);
+}
+
+static void keepalive_start(uint32_t cid) {
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    keepalive_cid = cid;
+    keepalive_status = U2FHID_STATUS_PROCESSING;
+    xSemaphoreGive(tx_lock);
+    esp_timer_start_periodic(keepalive_timer, (uint64_t)U2F_HID_KEEPALIVE_MS * 1000);
+}
+
+static void keepalive_stop(void) {
+    esp_timer_stop(keepalive_timer);
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    keepalive_cid = 0;
+    xSemaphoreGive(tx_lock);
+}
+
+// Called by handlers around the user presence wait
+void u2f_hid_set_keepalive_status(uint8_t status) {
+    keepalive_status = status;
+}
+
+void u2f_send_segments(uint32_t cid, uint8_t cmd, const u2f_hid_segment_t *segs, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += segs[i].len;
+    }
+    if (total > U2F_HID_MAX_MSG_SIZE) {
+        ESP_LOGE(TAG, "Response too large: %d bytes", (int)total);
+        u2f_send_error(cid, U2FHID_ERR_OTHER);
+        return;
+    }
+
+    bool from_worker = xTaskGetCurrentTaskHandle() == worker_task;
+    if (!from_worker && total > U2F_HID_INIT_DATA_SIZE) {
+        ESP_LOGE(TAG, "Multi-packet response outside the worker task");
+        return;
+    }
+    if (from_worker) {
+        // No KEEPALIVE may interleave with (or follow) the response
+        xSemaphoreTake(tx_lock, portMAX_DELAY);
+        keepalive_cid = 0;
+        xSemaphoreGive(tx_lock);
+    }
+
+    u2f_hid_packet_t pkt;
+    memset(&pkt, 0, sizeof(pkt));
+    write_be32(pkt.cid, cid);
+    pkt.init.cmd = cmd;
+    pkt.init.bcnt_h = (total >> 8) & 0xFF;
+    pkt.init.bcnt_l = total & 0xFF;
+
+    uint8_t *payload = pkt.init.data;
+    size_t room = U2F_HID_INIT_DATA_SIZE;
+    size_t seg = 0, seg_off = 0, sent = 0;
+    uint8_t seq = 0;
+
+    do {
+        // Gather the next packet's payload across segment boundaries
+        size_t fill = 0;
+        while (fill < room && seg < count) {
+            size_t n = segs[seg].len - seg_off;
+            if (n > room - fill) n = room - fill;
+            if (n > 0) {
+                memcpy(payload + fill, segs[seg].data + seg_off, n);
+            }
+            fill += n;
+            seg_off += n;
+            if (seg_off == segs[seg].len) {
+                seg++;
+                seg_off = 0;
+            }
+        }
+        memset(payload + fill, 0, room - fill);
+
+        if (!from_worker) {
+            send_packet_nowait(&pkt);
+        } else if (!send_packet_wait(&pkt)) {
+            ESP_LOGE(TAG, "CID %08lX: TX stalled after %d/%d bytes", cid, (int)sent, (int)total);
+            return;
+        }
+        if (sent == 0) {
+            note_first_byte(cid);
+        }
+        sent += fill;
+
+        // Everything after the first packet goes out as continuation packets
+        pkt.cont.seq = seq++;
+        payload = pkt.cont.data;
+        room = U2F_HID_CONT_DATA_SIZE;
+    } while (sent < total);
+}
+
+void u2f_send_response(uint32_t cid, uint8_t cmd, const uint8_t *data, uint16_t len) {
+    const u2f_hid_segment_t seg = {data, len};
+    u2f_send_segments(cid, cmd, &seg, 1);
+}
+
+void u2f_send_error(uint32_t cid, uint8_t error) {
+    u2f_send_response(cid, U2FHID_ERROR, &error, 1);
+}
+
+static void handle_init(uint32_t cid, const uint8_t *nonce) {
+    uint32_t resp_cid = cid;
+
+    if (cid == U2F_HID_CID_BROADCAST) {
+        u2f_hid_channel_t *ch = alloc_channel();
+        if (!ch) {
+            u2f_send_error(cid, U2FHID_ERR_CHANNEL_BUSY);
+            return;
+        }
+        resp_cid = ch->cid;
+    } else {
+        // INIT on an allocated channel resynchronises it, dropping any partial message
+        u2f_hid_channel_t *ch = find_channel(cid);
+        if (!ch) {
+            u2f_send_error(cid, U2FHID_ERR_INVALID_CHANNEL);
+            return;
+        }
+        if (ch->state == CH_BUSY) {
+            u2f_send_error(cid, U2FHID_ERR_CHANNEL_BUSY);
+            return;
+        }
+        finish_transaction(ch);
+    }
+
+    uint8_t resp[17];
+    memcpy(resp, nonce, 8);
+    write_be32(&resp[8], resp_cid);
+    resp[12] = 2; // Protocol version
+    resp[13] = 1; // Major
+    resp[14] = 0; // Minor
+    resp[15] = 0; // Build
+    resp[16] = U2FHID_CAPABILITY_WINK | U2FHID_CAPABILITY_CBOR;
+
+    u2f_send_response(cid, U2FHID_INIT, resp, 17);
+}
+
+static void handle_lock(u2f_hid_channel_t *ch) {
+    uint8_t seconds = ch->buf[0];
+    if (ch->bcnt != 1 || seconds > U2F_HID_MAX_LOCK_S) {
+        u2f_send_error(ch->cid, U2FHID_ERR_INVALID_PAR);
+        return;
+    }
+    xSemaphoreTake(chan_lock, portMAX_DELAY);
+    if (seconds == 0) {
+        lock_owner = NULL;
+    } else {
+        lock_owner = ch;
+        lock_until_us = esp_timer_get_time() + (int64_t)seconds * 1000000;
+    }
+    xSemaphoreGive(chan_lock);
+    u2f_send_response(ch->cid, U2FHID_LOCK, NULL, 0);
+}
+
+// Dispatch a fully reassembled message. Handlers work on the channel buffer
+// directly, the channel is only released once they return.
+static void dispatch_message(u2f_hid_channel_t *ch) {
+    switch (ch->cmd) {
+        case U2FHID_MSG:
+            u2f_process_apdu(ch->cid, ch->buf, ch->bcnt);
+            break;
+        case U2FHID_CBOR:
+            ctap2_handle_cbor(ch->cid, ch->buf, ch->bcnt);
+            break;
+        case U2FHID_PING:
+            u2f_send_response(ch->cid, U2FHID_PING, ch->buf, ch->bcnt);
+            break;
+        case U2FHID_WINK:
+            u2f_send_response(ch->cid, U2FHID_WINK, NULL, 0);
+            break;
+        case U2FHID_LOCK:
+            handle_lock(ch);
+            break;
+        default:
+            ESP_LOGW(TAG, "Unknown HID CMD: %02X", ch->cmd);
+            u2f_send_error(ch->cid, U2FHID_ERR_INVALID_CMD);
+            break;
+    }
+}
+
+// A CBOR message still arriving: let the idle worker start parsing the
+// prefix (ctap2_stream_feed). At most one such entry per channel is queued,
+// and only the active channel receives, so completed messages still fit.
+static void queue_progress(u2f_hid_channel_t *ch) {
+    if (ch->cmd != U2FHID_CBOR || ch->feed_queued) return;
+    if (xQueueSend(msg_queue, &ch, 0) == pdTRUE) {
+        ch->feed_queued = true;
+    }
+}
+
+// Hand a completed message to the worker. Only the channel pointer is queued.
+static void queue_message(u2f_hid_channel_t *ch) {
+    ch->state = CH_READY;
+    if (xQueueSend(msg_queue, &ch, 0) != pdTRUE) {
+        finish_transaction(ch);
+        u2f_send_error(ch->cid, U2FHID_ERR_CHANNEL_BUSY);
+    }
+}
+
+static void handle_init_packet(uint32_t cid, const u2f_hid_packet_t *pkt) {
+    uint16_t bcnt = (pkt->init.bcnt_h << 8) | pkt->init.bcnt_l;
+
+    if (pkt->init.cmd == U2FHID_INIT) {
+        if (bcnt != 8) {
+            u2f_send_error(cid, U2FHID_ERR_INVALID_LEN);
+            return;
+        }
+        handle_init(cid, pkt->init.data);
+        return;
+    }
+
+    u2f_hid_channel_t *ch = find_channel(cid);
+    if (!ch) {
+        u2f_send_error(cid, U2FHID_ERR_INVALID_CHANNEL);
+        return;
+    }
+
+    if (pkt->init.cmd == U2FHID_CANCEL) {
+        // No response of its own: the cancelled request answers with
+        // CTAP2_ERR_KEEPALIVE_CANCEL. Ignored if nothing is pending.
+        if (ch == active && (ch->state == CH_READY || ch->state == CH_BUSY)) {
+            ESP_LOGI(TAG, "CID %08lX: cancel", cid);
+            up_cancel();
+        } else if (ch == active && ch->state == CH_RX) {
+            finish_transaction(ch);
+        }
+        return;
+    }
+
+    if ((active && active != ch) || channel_locked_out(ch)) {
+        u2f_send_error(cid, U2FHID_ERR_CHANNEL_BUSY);
+        return;
+    }
+
+    if (ch->state == CH_RX) {
+        // A new message while the previous one is still incomplete
+        ESP_LOGW(TAG, "CID %08lX: init packet during reassembly", cid);
+        finish_transaction(ch);
+        u2f_send_error(cid, U2FHID_ERR_INVALID_SEQ);
+        return;
+    }
+
+    if (ch->state != CH_IDLE) {
+        u2f_send_error(cid, U2FHID_ERR_CHANNEL_BUSY);
+        return;
+    }
+
+    if (bcnt > U2F_HID_MAX_MSG_SIZE) {
+        u2f_send_error(cid, U2FHID_ERR_INVALID_LEN);
+        return;
+    }
+
+    uint16_t chunk = (bcnt > U2F_HID_INIT_DATA_SIZE) ? U2F_HID_INIT_DATA_SIZE : bcnt;
+    active = ch;
+    ch->state = CH_RX;
+    ch->cmd = pkt->init.cmd;
+    ch->bcnt = bcnt;
+    ch->received = chunk;
+    ch->next_seq = 0;
+    ch->last_rx_us = esp_timer_get_time();
+    ch->last_used_us = ch->last_rx_us;
+    ch->req_start_us = ch->last_rx_us;
+    ch->txn = ++next_txn;
+    memcpy(ch->buf, pkt->init.data, chunk);
+
+    if (ch->received == ch->bcnt) {
+        queue_message(ch);
+    } else {
+        queue_progress(ch);
+    }
+}
+
+static void handle_cont_packet(uint32_t cid, const u2f_hid_packet_t *pkt) {
+    u2f_hid_channel_t *ch = find_channel(cid);
+    if (!ch || ch->state != CH_RX || ch->received >= ch->bcnt) {
+        // Spurious continuation packets are ignored
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (pkt->cont.seq != ch->next_seq ||
+        now - ch->last_rx_us > (int64_t)U2F_HID_MSG_TIMEOUT_MS * 1000) {
+        ESP_LOGW(TAG, "CID %08lX: bad seq %d (expected %d)", cid, pkt->cont.seq, ch->next_seq);
+        finish_transaction(ch);
+        u2f_send_error(cid, U2FHID_ERR_INVALID_SEQ);
+        return;
+    }
+
+    uint16_t remaining = ch->bcnt - ch->received;
+    uint16_t chunk = (remaining > U2F_HID_CONT_DATA_SIZE) ? U2F_HID_CONT_DATA_SIZE : remaining;
+    memcpy(&ch->buf[ch->received], pkt->cont.data, chunk);
+    ch->received += chunk;
+    ch->next_seq++;
+    ch->last_rx_us = now;
+
+    if (ch->received == ch->bcnt) {
+        queue_message(ch);
+    } else {
+        queue_progress(ch);
+    }
+}
+
+// Expire partial messages whose sender went quiet
+void u2f_hid_tick(void) {
+    uint32_t expired[U2F_HID_MAX_CHANNELS];
+    int n_expired = 0;
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(chan_lock, portMAX_DELAY);
+    for (int i = 0; i < U2F_HID_MAX_CHANNELS; i++) {
+        u2f_hid_channel_t *ch = &channels[i];
+        if (ch->state != CH_RX || ch->received >= ch->bcnt) continue;
+        if (now - ch->last_rx_us > (int64_t)U2F_HID_MSG_TIMEOUT_MS * 1000) {
+            ESP_LOGW(TAG, "CID %08lX: message timeout (%d/%d bytes)", ch->cid, ch->received, ch->bcnt);
+            expired[n_expired++] = ch->cid;
+            finish_transaction(ch);
+        }
+    }
+    xSemaphoreGive(chan_lock);
+
+    // Sent outside chan_lock: the USB task needs it to retire IN transfers
+    for (int i = 0; i < n_expired; i++) {
+        u2f_send_error(expired[i], U2FHID_ERR_MSG_TIMEOUT);
+    }
+}
+
+// Called from the USB task
+void u2f_handle_report(uint8_t *report, uint16_t len) {
+    if (len < U2F_HID_PACKET_SIZE) return;
+
+    const u2f_hid_packet_t *pkt = (const u2f_hid_packet_t *)report;
+    uint32_t cid = read_be32(pkt->cid);
+
+    xSemaphoreTake(chan_lock, portMAX_DELAY);
+    if (pkt->init.cmd & 0x80) {
+        handle_init_packet(cid, pkt);
+    } else {
+        handle_cont_packet(cid, pkt);
+    }
+    xSemaphoreGive(chan_lock);
+}
+
+// Protocol/crypto worker. Runs the handlers so that signing never holds up
+// USB servicing, and expires stalled messages while the bus is quiet.
+static void worker_main(void *arg) {
+    for (;;) {
+        u2f_hid_channel_t *ch;
+        if (xQueueReceive(msg_queue, &ch, pdMS_TO_TICKS(U2F_HID_MSG_TIMEOUT_MS / 2)) != pdTRUE) {
+            u2f_hid_tick();
+            hal_rng_refill(); // Idle: top the RNG pool back up
+            cred_store_maintain(); // And erase ahead for resident credentials
+            counter_store_maintain(); // and for the counter journal
+            continue;
+        }
+
+        // The channel may have been resynchronised by INIT while queued
+        xSemaphoreTake(chan_lock, portMAX_DELAY);
+        bool ready = ch->state == CH_READY;
+        bool partial = ch->state == CH_RX;
+        if (ready) ch->state = CH_BUSY;
+        ch->feed_queued = false;
+        uint32_t txn = ch->txn;
+        uint16_t received = ch->received;
+        xSemaphoreGive(chan_lock);
+
+        // Progress entry: bytes below `received` no longer change (unless
+        // INIT resynchronises the channel, which also ends the transaction)
+        if (partial) {
+            ctap2_stream_feed(txn, ch->buf, received);
+            continue;
+        }
+        if (!ready) continue;
+
+        bool long_running = ch->cmd == U2FHID_MSG || ch->cmd == U2FHID_CBOR;
+        if (long_running) keepalive_start(ch->cid);
+        if (ch->cmd == U2FHID_CBOR) ctap2_stream_feed(txn, ch->buf, ch->bcnt);
+        dispatch_message(ch);
+        ctap2_stream_reset();
+        if (long_running) keepalive_stop();
+        counter_store_commit(); // Reservations queued by this request, now the response is out
+        hal_rng_refill();
+
+        xSemaphoreTake(chan_lock, portMAX_DELAY);
+        finish_transaction(ch);
+        // A CANCEL only applies to the transaction it arrived during
+        up_clear_cancel();
+        xSemaphoreGive(chan_lock);
+    }
+}
+
+void u2f_hid_init(void) {
+    memset(channels, 0, sizeof(channels));
+    active = NULL;
+    lock_owner = NULL;
+
+    chan_lock = xSemaphoreCreateMutex();
+    tx_lock = xSemaphoreCreateMutex();
+    tx_done = xSemaphoreCreateBinary();
+    const esp_timer_create_args_t keepalive_args = {
+        .callback = keepalive_cb,
+        .name = "u2f_keepalive",
+    };
+    esp_timer_create(&keepalive_args, &keepalive_timer);
+    msg_queue = xQueueCreate(U2F_HID_MAX_CHANNELS, sizeof(u2f_hid_channel_t *));
+    xTaskCreate(worker_main, "u2f_worker", U2F_HID_WORKER_STACK, NULL, U2F_HID_WORKER_PRIORITY, &worker_task);
+
+    ESP_LOGI(TAG, "HID transport ready (%d channels, %d byte messages)", U2F_HID_MAX_CHANNELS,
+             U2F_HID_MAX_MSG_SIZE);
+}
@@ -0,0 +1,102 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "user_presence.h"
+
+static const char *TAG = "UP";
+
+#define UP_PRESSED_BIT  (1 << 0)
+#define UP_CANCEL_BIT   (1 << 1)
+
+static EventGroupHandle_t up_events;
+
+// Last accepted press, set from the ISR and consumed by the handlers
+static portMUX_TYPE up_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t press_us = 0;
+static bool press_pending = false;
+
+// Only touched by the ISR
+static int64_t last_edge_us = 0;
+
+// Fires on both edges. A falling edge is a press only if the line had been
+// stable for UP_DEBOUNCE_MS before it, so bounce on press and release is dropped.
+static void IRAM_ATTR button_isr(void *arg) {
+    int64_t now = esp_timer_get_time();
+    bool stable = now - last_edge_us >= (int64_t)UP_DEBOUNCE_MS * 1000;
+    last_edge_us = now;
+    if (!stable || gpio_get_level(UP_BUTTON_PIN) != 0) return;
+
+    portENTER_CRITICAL_ISR(&up_mux);
+    press_us = now;
+    press_pending = true;
+    portEXIT_CRITICAL_ISR(&up_mux);
+
+    BaseType_t woken = pdFALSE;
+    xEventGroupSetBitsFromISR(up_events, UP_PRESSED_BIT, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Claim the pending press if it is recent enough
+static bool take_press(void) {
+    bool ok = false;
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&up_mux);
+    if (press_pending && now - press_us <= (int64_t)UP_GRACE_MS * 1000) {
+        ok = true;
+    }
+    press_pending = false;
+    portEXIT_CRITICAL(&up_mux);
+    return ok;
+}
+
+void up_init(void) {
+    up_events = xEventGroupCreate();
+
+    // Button Input (Pull-up)
+    gpio_reset_pin(UP_BUTTON_PIN);
+    gpio_set_direction(UP_BUTTON_PIN, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(UP_BUTTON_PIN, GPIO_PULLUP_ONLY);
+    gpio_set_intr_type(UP_BUTTON_PIN, GPIO_INTR_ANYEDGE);
+    gpio_install_isr_service(0);
+    gpio_isr_handler_add(UP_BUTTON_PIN, button_isr, NULL);
+}
+
+up_result_t up_wait(uint32_t timeout_ms) {
+    // Stale event bits are dropped, the grace window decides what still counts
+    xEventGroupClearBits(up_events, UP_PRESSED_BIT);
+    if (xEventGroupGetBits(up_events) & UP_CANCEL_BIT) {
+        return UP_CANCELLED;
+    }
+    if (take_press()) {
+        return UP_OK;
+    }
+
+    ESP_LOGI(TAG, "Waiting for user presence...");
+    EventBits_t bits = xEventGroupWaitBits(up_events, UP_PRESSED_BIT | UP_CANCEL_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(timeout_ms));
+    if (bits & UP_CANCEL_BIT) {
+        ESP_LOGI(TAG, "Cancelled by host");
+        return UP_CANCELLED;
+    }
+    if ((bits & UP_PRESSED_BIT) && take_press()) {
+        xEventGroupClearBits(up_events, UP_PRESSED_BIT);
+        return UP_OK;
+    }
+    return UP_TIMEOUT;
+}
+
+bool up_check(void) {
+    xEventGroupClearBits(up_events, UP_PRESSED_BIT);
+    return take_press();
+}
+
+void up_cancel(void) {
+    xEventGroupSetBits(up_events, UP_CANCEL_BIT);
+}
+
+void up_clear_cancel(void) {
+    xEventGroupClearBits(up_events, UP_CANCEL_BIT);
+}
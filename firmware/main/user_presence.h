@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Button (Active Low, GND when pressed)
+#define UP_BUTTON_PIN       0
+#define UP_DEBOUNCE_MS      20   // Edges closer together than this are contact bounce
+#define UP_GRACE_MS         1500 // A press this recent satisfies the next request
+
+typedef enum {
+    UP_OK = 0,
+    UP_TIMEOUT,
+    UP_CANCELLED,
+} up_result_t;
+
+void up_init(void);
+
+// Block until the button is pressed, the timeout expires or the pending
+// request is cancelled by the host (CTAPHID_CANCEL). A press within the last
+// UP_GRACE_MS counts. Each press satisfies one request only.
+up_result_t up_wait(uint32_t timeout_ms);
+
+// Non-blocking: consume a press from the grace window (U2F, where the host polls)
+bool up_check(void);
+
+void up_cancel(void);
+void up_clear_cancel(void);
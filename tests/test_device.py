@@ -1,10 +1,14 @@
 import sys
-from fido2.hid import CtapHidDevice
+import os
+import threading
+import time
+from fido2.hid import CtapHidDevice, CTAPHID, open_device
 from fido2.client import Fido2Client, UserInteraction
 from fido2.server import Fido2Server
 from fido2.webauthn import UserVerificationRequirement, AttestationConveyancePreference
-from fido2.ctap1 import Ctap1
+from fido2.ctap1 import Ctap1, ApduError, APDU
 from fido2.ctap2 import Ctap2
+from fido2.ctap import CtapError
 
 # Configuration (Match firmware/main/usb_descriptors.c)
 VID = 0xCAFE
@@ -20,6 +24,40 @@ def find_device():
     print("[-] Device not found! Make sure it is flashed and connected.")
     return None
 
+def with_touch(fn, timeout=10):
+    # U2F answers "conditions not satisfied" until the button is pressed; hosts poll
+    print("    Touch the button...")
+    deadline = time.time() + timeout
+    while True:
+        try:
+            return fn()
+        except ApduError as e:
+            if e.code != APDU.USE_NOT_SATISFIED or time.time() > deadline:
+                raise
+            time.sleep(0.1)
+
+def test_transport(dev):
+    print("\n=== Testing CTAPHID Transport ===")
+    try:
+        # Spans the init packet plus many continuation packets in both directions
+        for size in (0, 57, 58, 1024, 7609):
+            data = os.urandom(size)
+            echo = dev.call(CTAPHID.PING, data)
+            if echo != data:
+                print(f"[-] PING {size} bytes: echo mismatch ({len(echo)} bytes back)")
+                return
+        print("[+] Multi-packet PING Success!")
+
+        # A second client gets its own channel and can talk while the first is idle
+        other = open_device(dev.descriptor.path)
+        if other.call(CTAPHID.PING, b"hello") != b"hello" or dev.call(CTAPHID.PING, b"again") != b"again":
+            print("[-] Channels interfered with each other")
+            return
+        other.close()
+        print("[+] Concurrent channels Success!")
+    except Exception as e:
+        print(f"[-] Transport Test Failed: {e}")
+
 def test_u2f(dev):
     print("\n=== Testing U2F (CTAP1) ===")
     try:
@@ -29,17 +67,33 @@ def test_u2f(dev):
         challenge = b"A" * 32
         app_param = b"B" * 32
         
-        reg_res = ctap1.register(challenge, app_param)
+        reg_res = with_touch(lambda: ctap1.register(challenge, app_param))
         print("[+] Register Success!")
         print(f"    Public Key: {reg_res.public_key.hex()[:20]}...")
         print(f"    Key Handle: {reg_res.key_handle.hex()}")
         
         print("[*] Sending U2F Authenticate...")
-        auth_res = ctap1.authenticate(challenge, app_param, reg_res.key_handle)
+        auth_res = with_touch(lambda: ctap1.authenticate(challenge, app_param, reg_res.key_handle))
         print("[+] Authenticate Success!")
         print(f"    Counter: {auth_res.counter}")
         print(f"    Signature: {auth_res.signature.hex()[:20]}...")
-        
+
+        # Check-only: our handle -> USE_NOT_SATISFIED, wrong RP or foreign handle -> WRONG_DATA
+        print("[*] Sending U2F check-only...")
+        expected = [(app_param, reg_res.key_handle, APDU.USE_NOT_SATISFIED),
+                    (b"C" * 32, reg_res.key_handle, APDU.WRONG_DATA),
+                    (app_param, os.urandom(len(reg_res.key_handle)), APDU.WRONG_DATA)]
+        for app, kh, code in expected:
+            try:
+                ctap1.authenticate(challenge, app, kh, check_only=True)
+                print("[-] Check-only returned a signature")
+                return
+            except ApduError as e:
+                if e.code != code:
+                    print(f"[-] Check-only: expected {hex(code)}, got {hex(e.code)}")
+                    return
+        print("[+] Check-only Success!")
+
     except Exception as e:
         print(f"[-] U2F Test Failed: {e}")
 
@@ -51,6 +105,13 @@ def test_fido2(dev):
         print(f"[+] GetInfo Success!")
         print(f"    Versions: {info.versions}")
         print(f"    AAGUID: {info.aaguid.hex()}")
+        print(f"    Max credentials in list: {info.max_cred_count_in_list}, max ID length: {info.max_cred_id_length}")
+        if not info.max_cred_count_in_list or not info.max_cred_id_length:
+            print("[-] GetInfo does not advertise list limits (0x07/0x08)")
+        algs = [p["alg"] for p in (info.algorithms or [])]
+        print(f"    Algorithms: {algs}")
+        if -7 not in algs or -8 not in algs:
+            print("[-] GetInfo does not advertise ES256 and EdDSA (0x0A)")
         
         if "FIDO_2_0" not in info.versions:
             print("[-] Device does not claim FIDO2 support.")
@@ -61,6 +122,21 @@ def test_fido2(dev):
         # We'll try a basic MakeCredential if the library allows low-level access,
         # otherwise we just rely on GetInfo for this phase.
         print("[*] FIDO2 Basic checks passed.")
+
+        # The device must report UPNEEDED while waiting and honour CTAPHID_CANCEL
+        print("[*] MakeCredential, cancelled after 1s (do NOT touch the button)...")
+        statuses = set()
+        cancel = threading.Event()
+        threading.Timer(1.0, cancel.set).start()
+        try:
+            ctap2.make_credential(os.urandom(32), {"id": "example.com"}, {"id": b"user", "name": "user"},
+                                  [{"type": "public-key", "alg": -7}], event=cancel, on_keepalive=statuses.add)
+            print("[-] MakeCredential completed despite cancel")
+        except CtapError as e:
+            if e.code == CtapError.ERR.KEEPALIVE_CANCEL and 2 in statuses:
+                print("[+] KEEPALIVE/CANCEL Success!")
+            else:
+                print(f"[-] Unexpected cancel result: {e.code}, keepalive statuses {statuses}")
         
     except Exception as e:
         print(f"[-] FIDO2 Test Failed: {e}")
@@ -68,5 +144,6 @@ def test_fido2(dev):
 if __name__ == "__main__":
     dev = find_device()
     if dev:
+        test_transport(dev)
         test_u2f(dev)
         test_fido2(dev)